@@ -9,7 +9,7 @@
 /* ukfuse */
 #include "uk/fusedev_core.h"
 /* virtiofs */
-#include "uk/vf_bench_tests.h"
+#include "uk/vfdev.h"
 
 void create_files_runner(struct uk_fuse_dev *fusedev, FILES *amount_arr,
 			 size_t arr_size, int measurements);
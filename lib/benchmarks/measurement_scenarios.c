@@ -256,16 +256,11 @@ free_fc:
  */
 __nanosec list_dir(struct uk_fuse_dev *fusedev, FILES file_amount, int measurement) {
 	int rc = 0;
-	struct fuse_dirent *dirents;
-	size_t num_dirents;
+	struct uk_fuse_readdirplus rd;
+	const struct fuse_direntplus *direntplus;
+	size_t num_dirents = 0;
 	__nanosec start = 0, end = 0;
 
-	dirents = calloc(file_amount, sizeof(struct fuse_dirent));
-	if (!dirents) {
-		uk_pr_err("calloc failed \n");
-		return 0;
-	}
-
 	if (file_amount == 131072) {
 		uk_pr_info("hi\n");
 	}
@@ -283,16 +278,25 @@ __nanosec list_dir(struct uk_fuse_dev *fusedev, FILES file_amount, int measureme
 		O_RDONLY, &dc.fh);
 	if (unlikely(rc)) {
 		uk_pr_err("uk_fuse_request_open has failed \n");
-		goto free;
+		return 0;
 	}
 
 	start = _clock();
 
-	rc = uk_fuse_request_readdirplus(fusedev, 4096,
-		dc.nodeid, dc.fh, dirents, &num_dirents);
+	rc = uk_fuse_readdirplus_open(fusedev, dc.nodeid, dc.fh,
+		8192, true, &rd);
 	if (unlikely(rc)) {
-		uk_pr_err("uk_fuse_request_readdirplus has failed \n");
-		goto free;
+		uk_pr_err("uk_fuse_readdirplus_open has failed \n");
+		return 0;
+	}
+
+	while ((rc = uk_fuse_readdirplus_next(&rd, &direntplus)) > 0)
+		num_dirents++;
+
+	uk_fuse_readdirplus_close(&rd);
+	if (unlikely(rc)) {
+		uk_pr_err("uk_fuse_readdirplus_next has failed \n");
+		return 0;
 	}
 
 	end = _clock();
@@ -303,21 +307,16 @@ __nanosec list_dir(struct uk_fuse_dev *fusedev, FILES file_amount, int measureme
 		dc.nodeid, dc.fh);
 	if (unlikely(rc)) {
 		uk_pr_err("uk_fuse_request_release has failed \n");
-		goto free;
+		return 0;
 	}
 
 	rc = uk_fuse_request_forget(fusedev, dc.nodeid, 0);
 	if (unlikely(rc)) {
 		uk_pr_err("uk_fuse_request_forget has failed \n");
-		goto free;
+		return 0;
 	}
 
-	free(dirents);
 	return end - start;
-
-free:
-	free(dirents);
-	return 0;
 }
 
 /*
@@ -73,6 +73,10 @@
 #include "uk/fuse_i.h"
 #include "uk/fusedev_core.h"
 #include "uk/fusereq.h"
+#include "uk/fuse_node.h"
+#include "uk/fuse_dentry.h"
+#include "uk/fuse_pcache.h"
+#include "uk/fuse_wb.h"
 #include "uk/fusedev_trans.h"
 #include "uk/print.h"
 #include <stddef.h>
@@ -86,11 +90,16 @@
 #include <limits.h>
 #include <uk/arch/atomic.h>
 #include <uk/errptr.h>
+#include <uk/plat/spinlock.h>
+#include <uk/plat/time.h>
 #include <uk/process.h>
+#if CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#include <uk/thread.h>
+#endif
 #include <uk/essentials.h>
 #include <stdlib.h>
 /* TODOFS: remove */
-#include <uk/vf_vnops.h>
 
 
 /**
@@ -147,9 +156,7 @@ static inline int send_and_wait(struct uk_fuse_dev *dev,
 {
 	int rc;
 
-	UK_WRITE_ONCE(req->state, UK_FUSEREQ_READY);
-
-	if ((rc = uk_fusedev_request(dev, req)))
+	if ((rc = uk_fusedev_request_async(dev, req, NULL, NULL)))
 		return rc;
 
 	if ((rc = uk_fusereq_waitreply(req)))
@@ -158,6 +165,79 @@ static inline int send_and_wait(struct uk_fuse_dev *dev,
 	return 0;
 }
 
+/* The metadata requests on the hot path fit into the inline storage */
+UK_CTASSERT(sizeof(FUSE_LOOKUP_IN) <= UK_FUSEREQ_INLINE_IN_SIZE);
+UK_CTASSERT(sizeof(FUSE_LOOKUP_OUT) <= UK_FUSEREQ_INLINE_OUT_SIZE);
+UK_CTASSERT(sizeof(FUSE_GETATTR_OUT) <= UK_FUSEREQ_INLINE_OUT_SIZE);
+UK_CTASSERT(sizeof(FUSE_CREATE_OUT) <= UK_FUSEREQ_INLINE_OUT_SIZE);
+
+/**
+ * @brief creates a request, whose in and out buffers are owned by the request
+ *
+ * Used by asynchronous requests, as their buffers have to outlive the
+ * submitting stack frame. Both buffers are zeroed. Buffers, that fit into the
+ * inline storage of the request, do not require any allocation. Others are
+ * freed together with the request.
+ *
+ * @param dev
+ * @param in_size size of req->in_buffer
+ * @param out_size size of req->out_buffer
+ * @return struct uk_fuse_req*
+ */
+static struct uk_fuse_req *fuse_req_create_bufs(struct uk_fuse_dev *dev,
+						size_t in_size,
+						size_t out_size)
+{
+	struct uk_fuse_req *req;
+
+	req = uk_fusedev_req_create(dev);
+	if (PTRISERR(req))
+		return req;
+
+	if (likely(in_size <= UK_FUSEREQ_INLINE_IN_SIZE
+		   && out_size <= UK_FUSEREQ_INLINE_OUT_SIZE)) {
+		req->in_buffer = req->_inline_in;
+		req->out_buffer = out_size ? req->_inline_out : NULL;
+		memset(req->_inline_in, 0, in_size);
+		memset(req->_inline_out, 0, out_size);
+	} else {
+		req->_buf = uk_calloc(dev->a, 1, in_size + out_size);
+		if (!req->_buf) {
+			uk_fusedev_req_remove(dev, req);
+			return ERR2PTR(-ENOMEM);
+		}
+
+		req->in_buffer = req->_buf;
+		req->out_buffer = out_size ? (char *) req->_buf + in_size
+					   : NULL;
+	}
+	req->in_buffer_size = in_size;
+	req->out_buffer_size = out_size;
+
+	return req;
+}
+
+/**
+ * @brief submits a request, created by one of the *_async functions
+ *
+ * On failure the request is released.
+ *
+ * @return struct uk_fuse_req* @p req or an error pointer
+ */
+static struct uk_fuse_req *fuse_submit_async(struct uk_fuse_dev *dev,
+					     struct uk_fuse_req *req,
+					     uk_fusereq_done_t done,
+					     void *done_arg)
+{
+	int rc;
+
+	if ((rc = uk_fusedev_request_async(dev, req, done, done_arg))) {
+		uk_fusedev_req_remove(dev, req);
+		return ERR2PTR(rc);
+	}
+
+	return req;
+}
 
 /**
  * @brief
@@ -179,6 +259,9 @@ int uk_fuse_request_fsync(struct uk_fuse_dev *dev, bool is_dir,
 
 	UK_ASSERT(dev);
 
+	if (!is_dir && (rc = uk_fuse_wb_flush(dev, nodeid)))
+		return rc;
+
 	FUSE_HEADER_INIT(&fsync_in.hdr, is_dir ? FUSE_FSYNCDIR : FUSE_FSYNC,
 		nodeid, sizeof(struct fuse_fsync_in));
 
@@ -248,7 +331,7 @@ int uk_fuse_request_removemapping_multiple(struct uk_fuse_dev *dev,
 
 	req = uk_fusedev_req_create(dev);
 	if (PTRISERR(req))
-		rc = PTR2ERR(req);
+		return PTR2ERR(req);
 
 	req->in_buffer = removemapping_in;
 	req->in_buffer_size = sizeof(struct fuse_in_header) + datalen;
@@ -258,7 +341,6 @@ int uk_fuse_request_removemapping_multiple(struct uk_fuse_dev *dev,
 	if ((rc = send_and_wait(dev, req)))
 		goto free;
 
-
 	uk_fusedev_req_remove(dev, req);
 	return 0;
 
@@ -320,7 +402,11 @@ int uk_fuse_request_removemapping(struct uk_fuse_dev *dev, uint64_t moffset,
 				     uint64_t len)
 {
 	int rc = 0;
-	FUSE_REMOVEMAPPING_IN *removemapping_in;
+	struct {
+		struct fuse_in_header hdr;
+		struct fuse_removemapping_in removemapping_in;
+		struct fuse_removemapping_one removemapping_one;
+	} __packed __align(8) removemapping_in = {0};
 	FUSE_REMOVEMAPPING_OUT removemapping_out = {0};
 	struct uk_fuse_req *req;
 	uint64_t datalen;
@@ -329,42 +415,25 @@ int uk_fuse_request_removemapping(struct uk_fuse_dev *dev, uint64_t moffset,
 
 	datalen = sizeof(struct fuse_removemapping_in)
 			+ sizeof(struct fuse_removemapping_one);
-	removemapping_in = calloc(1, sizeof(struct fuse_in_header)
-			   + datalen);
-	if (!removemapping_in) {
-		uk_pr_err("calloc failed\n");
-		return -1;
-	}
-
-	FUSE_HEADER_INIT(&removemapping_in->hdr, FUSE_REMOVEMAPPING,
-			 0, datalen);
+	FUSE_HEADER_INIT(&removemapping_in.hdr, FUSE_REMOVEMAPPING, 0,
+			 datalen);
 
-	removemapping_in->removemapping_in.count = 1;
-	removemapping_in->removemapping_one[0].moffset = moffset;
-	removemapping_in->removemapping_one[0].len = len;
+	removemapping_in.removemapping_in.count = 1;
+	removemapping_in.removemapping_one.moffset = moffset;
+	removemapping_in.removemapping_one.len = len;
 
 	req = uk_fusedev_req_create(dev);
-	if (PTRISERR(req)) {
-		rc = PTR2ERR(req);
-		goto free_calloc;
-	}
+	if (PTRISERR(req))
+		return PTR2ERR(req);
 
-	req->in_buffer = removemapping_in;
+	req->in_buffer = &removemapping_in;
 	req->in_buffer_size = sizeof(struct fuse_in_header) + datalen;
 	req->out_buffer = &removemapping_out;
 	req->out_buffer_size = sizeof(removemapping_out);
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
-
-	uk_fusedev_req_remove(dev, req);
-	free(removemapping_in);
-	return 0;
+	rc = send_and_wait(dev, req);
 
-free:
 	uk_fusedev_req_remove(dev, req);
-free_calloc:
-	free(removemapping_in);
 	return rc;
 }
 
@@ -479,112 +548,269 @@ exit:
 	return rc;
 }
 
+static int fuse_node_lookup(struct uk_fuse_dev *dev, uint64_t parent,
+			    const struct fuse_entry_out *entry);
+static void fuse_node_evict(struct uk_fuse_dev *dev);
+
+/**
+ * @brief drops the cached attributes of @p nodeid in strict mode, after a
+ * request has changed them in a way, that is not exactly known
+ */
+static inline void fuse_attr_changed(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	if (dev->attr_cache == UK_FUSE_ATTR_CACHE_STRICT)
+		uk_fuse_node_invalidate_attr(dev, nodeid);
+}
+
 /**
- * @brief
+ * @brief caches the result of a lookup of @p name in @p parent, that the
+ * device has replied with
+ */
+static inline void fuse_dentry_entry(struct uk_fuse_dev *dev, uint64_t parent,
+				     const char *name,
+				     const struct fuse_entry_out *entry)
+{
+	uk_fuse_dentry_add(dev, parent, name, entry->nodeid,
+			   uk_fuse_timeout_nsec(entry->entry_valid,
+						entry->entry_valid_nsec));
+}
+
+static inline bool fuse_dirent_is_dot(const struct fuse_dirent *dirent)
+{
+	return (dirent->namelen == 1 && dirent->name[0] == '.')
+	       || (dirent->namelen == 2 && dirent->name[0] == '.'
+		   && dirent->name[1] == '.');
+}
+
+/**
+ * @brief requests the next buffer of entries of a directory
+ */
+static struct uk_fuse_req *
+fuse_readdirplus_submit(struct uk_fuse_readdirplus *rd)
+{
+	FUSE_READ_IN *read_in;
+	struct uk_fuse_req *req;
+
+	req = fuse_req_create_bufs(rd->dev, sizeof(*read_in),
+				   sizeof(struct fuse_out_header)
+				   + rd->buf_size);
+	if (PTRISERR(req))
+		return req;
+
+	read_in = req->in_buffer;
+	FUSE_HEADER_INIT(&read_in->hdr, FUSE_READDIRPLUS, rd->nodeid,
+			 sizeof(read_in->read));
+	read_in->read.fh = rd->fh;
+	read_in->read.offset = rd->offset;
+	read_in->read.size = rd->buf_size;
+
+	return fuse_submit_async(rd->dev, req, NULL, NULL);
+}
+
+/**
+ * @brief waits for a buffer of entries and records them in the caches
+ *
+ * The device counts a lookup for every entry but "." and "..", so all of them
+ * are recorded as soon as they are received, whether they are consumed by the
+ * caller or not. Their attributes need no FUSE_GETATTR afterwards. Nodes, that
+ * do not get held by a vnode, are forgotten once there are more of them than
+ * the lookup cache can use (see fuse_node_evict()).
+ *
+ * The whole buffer is checked before any entry is recorded, so that a
+ * malformed reply leaves no lookups behind.
+ *
+ * @param rd
+ * @param req request returned by fuse_readdirplus_submit()
+ * @param[out] len number of bytes of entries in the reply
+ * @return int
+ */
+static int fuse_readdirplus_receive(struct uk_fuse_readdirplus *rd,
+				    struct uk_fuse_req *req, uint32_t *len)
+{
+	FUSE_READ_OUT *read_out;
+	struct fuse_direntplus *direntplus;
+	uint32_t pos, size;
+	int rc;
+
+	if ((rc = uk_fusereq_waitreply(req)))
+		return rc;
+
+	read_out = req->out_buffer;
+	if (read_out->hdr.len < sizeof(struct fuse_out_header)
+	    || read_out->hdr.len - sizeof(struct fuse_out_header)
+	       > rd->buf_size)
+		return -EIO;
+	*len = read_out->hdr.len - sizeof(struct fuse_out_header);
+
+	for (pos = 0; pos < *len; pos += size) {
+		direntplus = (struct fuse_direntplus *) (read_out->buf + pos);
+		if (*len - pos < FUSE_NAME_OFFSET_DIRENTPLUS)
+			return -EIO;
+		size = FUSE_DIRENTPLUS_SIZE(direntplus);
+		if (*len - pos < size || direntplus->dirent.namelen > NAME_MAX)
+			return -EIO;
+	}
+
+	for (pos = 0; pos < *len; pos += size) {
+		direntplus = (struct fuse_direntplus *) (read_out->buf + pos);
+		size = FUSE_DIRENTPLUS_SIZE(direntplus);
+
+		rd->offset = direntplus->dirent.off;
+		if (!direntplus->entry_out.nodeid
+		    || fuse_dirent_is_dot(&direntplus->dirent))
+			continue;
+
+		memcpy(rd->name, direntplus->dirent.name,
+		       direntplus->dirent.namelen);
+		rd->name[direntplus->dirent.namelen] = '\0';
+		if (!fuse_node_lookup(rd->dev, rd->nodeid,
+				      &direntplus->entry_out))
+			fuse_dentry_entry(rd->dev, rd->nodeid, rd->name,
+					  &direntplus->entry_out);
+	}
+	fuse_node_evict(rd->dev);
+
+	return 0;
+}
+
+/**
+ * @brief starts iterating over the entries of an open directory
  *
- * READDIRPLUS = READDIR + LOOKUP in one.
+ * READDIRPLUS = READDIR + LOOKUP in one. The entries are fetched one buffer of
+ * @p buf_size bytes at a time with uk_fuse_readdirplus_next(), so that at most
+ * two buffers are allocated, however large the directory is. The nodes and
+ * attributes of the entries are added to the node table and the lookup cache.
  *
  * @param dev
- * @param buff_len Length of data to read.
  * @param nodeid
- * @param fh
- * TODOFS: define suitable output. I defined such output because I needed to
- * benchmark file listings
- * @param[out] dirents an array of dirents.
- * @param[out] num_dirents number of dirents that the function returns
- * in @p dirents
+ * @param fh file handle of the open directory
+ * @param buf_size size of a buffer of entries
+ * @param prefetch if true, the next buffer is requested, while the current
+ * one is consumed
+ * @param[out] rd
  * @return int
  */
-int uk_fuse_request_readdirplus(struct uk_fuse_dev *dev, uint64_t buff_len,
-				uint64_t nodeid, uint64_t fh,
-				struct fuse_dirent *dirents,
-				size_t *num_dirents)
+int uk_fuse_readdirplus_open(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t fh, uint32_t buf_size, bool prefetch,
+			     struct uk_fuse_readdirplus *rd)
 {
-	int rc = 0;
-	FUSE_READ_IN read_in = {0};
-	FUSE_READ_OUT *read_out;
-	uint64_t offset = 0;
-	uint32_t remains;
 	struct uk_fuse_req *req;
-	struct fuse_direntplus *direntplus;
-	*num_dirents = 0;
 
 	UK_ASSERT(dev);
-	UK_ASSERT(dirents);
-	UK_ASSERT(num_dirents);
+	UK_ASSERT(rd);
 
-	req = uk_fusedev_req_create(dev);
-	if (PTRISERR(req))
-		return PTR2ERR(req);
+	/* One entry with the longest name has to fit */
+	if (buf_size < sizeof(struct fuse_direntplus) + NAME_MAX + 1)
+		return -EINVAL;
 
-	read_out = uk_calloc(dev->a, 1, sizeof(struct fuse_out_header)
-		+ buff_len * 2);
+	*rd = (struct uk_fuse_readdirplus) {
+		.dev = dev, .nodeid = nodeid, .fh = fh,
+		.buf_size = buf_size, .prefetch = prefetch
+	};
 
-	if (!read_out) {
-		uk_pr_err("Could not allocate memory\n");
-		return -1;
+	if (prefetch) {
+		req = fuse_readdirplus_submit(rd);
+		if (PTRISERR(req))
+			return PTR2ERR(req);
+		rd->next = req;
 	}
 
-	while (1) {
-		FUSE_HEADER_INIT(&read_in.hdr, FUSE_READDIRPLUS,
-				 nodeid, sizeof(read_in.read));
+	return 0;
+}
+
+/**
+ * @brief retrieves the next entry of a directory
+ *
+ * @param rd
+ * @param[out] direntplus the entry, valid until the next call. Its name is
+ * also available NUL-terminated in rd->name.
+ * @return int 1, if an entry has been retrieved, 0 at the end of the
+ * directory or a negative error code
+ */
+int uk_fuse_readdirplus_next(struct uk_fuse_readdirplus *rd,
+			     const struct fuse_direntplus **direntplus)
+{
+	struct fuse_direntplus *d;
+	struct uk_fuse_req *req;
+	uint32_t len;
+	int rc;
 
-		read_in.read.fh = fh;
-		read_in.read.offset = offset;
-		read_in.read.size = buff_len * 2;
+	UK_ASSERT(rd);
+	UK_ASSERT(direntplus);
 
-		req->in_buffer = &read_in;
-		req->in_buffer_size = read_in.hdr.len;
-		req->out_buffer = read_out;
-		req->out_buffer_size = sizeof(struct fuse_out_header)
-			+ read_in.read.size;
+	while (rd->pos >= rd->len) {
+		if (rd->cur) {
+			uk_fusedev_req_remove(rd->dev, rd->cur);
+			rd->cur = NULL;
+		}
+		if (rd->eof)
+			return 0;
+
+		req = rd->next;
+		rd->next = NULL;
+		if (!req) {
+			req = fuse_readdirplus_submit(rd);
+			if (PTRISERR(req))
+				return PTR2ERR(req);
+		}
 
-		if ((rc = send_and_wait(dev, req)))
-			goto free;
+		if ((rc = fuse_readdirplus_receive(rd, req, &len))) {
+			uk_fusedev_req_remove(rd->dev, req);
+			return rc;
+		}
+		rd->cur = req;
+		rd->pos = 0;
+		rd->len = len;
 
-		remains = read_out->hdr.len - sizeof(struct fuse_out_header);
 		/* A successful request with no data means no more dirents */
-		if (!remains) {
-			uk_pr_debug("A successful request with no data."
-				    "I.e. no more dirents\n");
-			break;
+		if (!len) {
+			rd->eof = true;
+			continue;
 		}
 
-		direntplus = (struct fuse_direntplus *) read_out->buf;
+		/* A failed prefetch is retried by the next refill */
+		if (rd->prefetch) {
+			req = fuse_readdirplus_submit(rd);
+			if (!PTRISERR(req))
+				rd->next = req;
+		}
+	}
 
-		uk_pr_debug("Dirents in request %" __PRIu64 ":\n",
-			read_in.hdr.unique);
+	d = (struct fuse_direntplus *)
+	    (((FUSE_READ_OUT *) rd->cur->out_buffer)->buf + rd->pos);
+	rd->pos += FUSE_DIRENTPLUS_SIZE(d);
 
-		while (remains > sizeof(struct fuse_direntplus)) {
-		/* At least one dirent is left */
-			uk_pr_debug("    %" __PRIu64 "/%s -> %" __PRIu64 "\n",
-			nodeid, direntplus->dirent.name,
-			direntplus->entry_out.nodeid);
+	memcpy(rd->name, d->dirent.name, d->dirent.namelen);
+	rd->name[d->dirent.namelen] = '\0';
+	*direntplus = d;
+	return 1;
+}
 
-			dirents[*num_dirents] = direntplus->dirent;
-			(*num_dirents)++;
+/**
+ * @brief ends the iteration and releases its buffers
+ *
+ * @param rd
+ * @return int error of the prefetched request, which is waited for, so that
+ * the lookups of its entries are recorded. The buffers are released anyway.
+ */
+int uk_fuse_readdirplus_close(struct uk_fuse_readdirplus *rd)
+{
+	uint32_t len;
+	int rc = 0;
 
-			if (strcmp(direntplus->dirent.name, ".") &&
-			    strcmp(direntplus->dirent.name, "..")) {
-			/* TODOFS: increment nlookup if not "." or ".."
-			   for this I'll prolly need to store a hashmap in
-			   the uk_fuse_dev, which maps nodeids to nlookup
-			   numbers of each file/directory */
-			}
+	UK_ASSERT(rd);
 
-			offset = direntplus->dirent.off;
-			remains -= FUSE_DIRENTPLUS_SIZE(direntplus);
-			direntplus = (struct fuse_direntplus *)
-				     ((char *) direntplus +
-				     FUSE_DIRENTPLUS_SIZE(direntplus));
-		}
+	if (rd->next) {
+		/* Record the lookups of the prefetched entries */
+		rc = fuse_readdirplus_receive(rd, rd->next, &len);
+		uk_fusedev_req_remove(rd->dev, rd->next);
+		rd->next = NULL;
+	}
+	if (rd->cur) {
+		uk_fusedev_req_remove(rd->dev, rd->cur);
+		rd->cur = NULL;
 	}
 
-
-
-free:
-	uk_free(dev->a, read_out);
-	uk_fusedev_req_remove(dev, req);
 	return rc;
 }
 
@@ -596,7 +822,8 @@ free:
  * @param dir_name
  * @param mode type specification bits (e.g. S_IFDIR) may not be set (is set inside virtiofsd)
  * @param[out] nodeid
- * @param[out] nlookup
+ * @param[out] nlookup lookups of the new node, that have been recorded (0, if
+ * the lookup has been forgotten right away)
  * @return int
  */
 int uk_fuse_request_mkdir(struct uk_fuse_dev *dev, uint64_t parent_nodeid,
@@ -641,167 +868,868 @@ int uk_fuse_request_mkdir(struct uk_fuse_dev *dev, uint64_t parent_nodeid,
 		goto free;
 
 	*nodeid = mkdir_out.entry.nodeid;
+	fuse_attr_changed(dev, parent_nodeid);
+	/* A lookup, that could not be recorded, is forgotten already */
+	if (fuse_node_lookup(dev, parent_nodeid, &mkdir_out.entry)) {
+		*nlookup = 0;
+		goto free;
+	}
 	*nlookup = 1; // newly created directory has nlookup = 1
+	fuse_dentry_entry(dev, parent_nodeid, dir_name, &mkdir_out.entry);
+	fuse_node_evict(dev);
 
 free:
 	uk_fusedev_req_remove(dev, req);
 	return rc;
 }
 
-int uk_fuse_request_forget(struct uk_fuse_dev *dev, uint64_t nodeid,
-			   uint64_t nlookup)
+/**
+ * @brief releases the FUSE_BATCH_FORGET requests the device is done with
+ */
+static void fuse_forget_reap(struct uk_fuse_dev *dev)
 {
-	int rc = 0;
-	FUSE_FORGET_IN forget_in = {0};
-	struct uk_fuse_req *req;
-
-	UK_ASSERT(dev);
-
-	FUSE_HEADER_INIT(&forget_in.hdr, FUSE_FORGET,
-		nodeid, sizeof(forget_in.forget));
-
-	forget_in.forget.nlookup = nlookup;
-
-	req = uk_fusedev_req_create(dev);
-	if (PTRISERR(req))
-		return PTR2ERR(req);
-
-	req->in_buffer = &forget_in;
-	req->in_buffer_size = forget_in.hdr.len;
-	req->out_buffer = NULL;
-	req->out_buffer_size = 0; // we don't expect a reply;
+	struct uk_fuse_req *reqs[8];
+	unsigned int n;
+
+	while ((n = uk_fuse_cq_poll(&dev->_forgets.sent, reqs,
+				    ARRAY_SIZE(reqs)))) {
+		for (unsigned int i = 0; i < n; i++) {
+			if (reqs[i]->rc)
+				uk_pr_warn("FUSE_BATCH_FORGET failed: %d\n",
+					   reqs[i]->rc);
+			uk_fusedev_req_remove(dev, reqs[i]);
+			ukarch_dec(&dev->_forgets.inflight);
+		}
+	}
+}
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
+/**
+ * @brief sends a FUSE_BATCH_FORGET request
+ *
+ * A request, that can not be sent, is kept for the next flush, so that its
+ * forgets are not lost.
+ */
+static int fuse_forget_send(struct uk_fuse_dev *dev, struct uk_fuse_req *req)
+{
+	struct uk_fusedev_forget_queue *q = &dev->_forgets;
+	struct fuse_batch_forget_in *batch_in;
+	int rc;
 
-free:
-	uk_fusedev_req_remove(dev, req);
+	ukarch_inc(&q->inflight);
+	rc = uk_fusedev_request_async(dev, req, uk_fuse_cq_post, &q->sent);
+	if (rc) {
+		batch_in = (struct fuse_batch_forget_in *)
+			   ((struct fuse_in_header *) req->in_buffer + 1);
+		uk_pr_warn("Failed to send %"__PRIu32" forgets: %d\n",
+			   batch_in->count, rc);
+		ukarch_dec(&q->inflight);
+		ukarch_inc(&q->nunsent);
+		uk_fuse_cq_post(req, &q->unsent);
+	}
 	return rc;
-
 }
 
 /**
- * @brief delete a file
+ * @brief sends all collected forgets as one FUSE_BATCH_FORGET request
+ *
+ * The request goes to the high priority queue of the transport. It is not
+ * waited for, but released by a later flush once the device is done with it.
+ * Requests, that could not be sent before, are sent again first.
  *
  * @param dev
- * @param filename
- * @param nlookup
- * @return int
+ * @return int error of the first request, that could not be sent
  */
-int uk_fuse_request_unlink(struct uk_fuse_dev *dev, const char *filename,
-			   bool is_dir, uint64_t nodeid, uint64_t nlookup,
-			   uint64_t parent_nodeid)
+int uk_fuse_forget_flush(struct uk_fuse_dev *dev)
 {
-	int rc = 0;
-	FUSE_UNLINK_IN unlink_in = {0};
-	FUSE_UNLINK_OUT unlink_out = {0};
-	struct uk_fuse_req *req;
+	struct uk_fusedev_forget_queue *q;
+	struct fuse_batch_forget_in *batch_in;
+	struct fuse_in_header *hdr;
+	struct uk_fuse_req *req, *unsent[8];
+	unsigned long flags;
+	uint32_t count, n, i;
+	int rc = 0, ret;
 
 	UK_ASSERT(dev);
-	UK_ASSERT(filename);
+	q = &dev->_forgets;
 
-	if (strlen(filename) > NAME_MAX) {
-		uk_pr_err("Filename is larger than %d characters\n", NAME_MAX);
-		return -1;
+	fuse_forget_reap(dev);
+
+	/* Take them all at once, as failed ones are queued again */
+	n = uk_fuse_cq_poll(&q->unsent, unsent, ARRAY_SIZE(unsent));
+	for (i = 0; i < n; i++) {
+		ukarch_dec(&q->nunsent);
+		if ((ret = fuse_forget_send(dev, unsent[i])) && !rc)
+			rc = ret;
 	}
 
-	req = uk_fusedev_req_create(dev);
+	/* The lock can not be held while allocating. Forgets collected in
+	   the meantime are left for the next flush. */
+	count = UK_READ_ONCE(q->count);
+	if (!count)
+		return rc;
+
+	req = fuse_req_create_bufs(dev, sizeof(*hdr) + sizeof(*batch_in) +
+				   count * sizeof(q->entries[0]), 0);
 	if (PTRISERR(req))
-		return PTR2ERR(req);
+		return rc ? rc : PTR2ERR(req);
+
+	hdr = req->in_buffer;
+	batch_in = (struct fuse_batch_forget_in *) (hdr + 1);
+
+	/* The order of forgets does not matter, so take the newest ones */
+	ukplat_spin_lock_irqsave(&q->spinlock, flags);
+	count = MIN(count, q->count);
+	q->count -= count;
+	memcpy(batch_in + 1, &q->entries[q->count],
+	       count * sizeof(q->entries[0]));
+	ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+
+	/* Another thread has flushed in the meantime */
+	if (!count) {
+		uk_fusedev_req_remove(dev, req);
+		return rc;
+	}
 
-	FUSE_HEADER_INIT(&unlink_in.hdr, is_dir ? FUSE_RMDIR : FUSE_UNLINK,
-	parent_nodeid, strlen(filename) + 1);
+	FUSE_HEADER_INIT(hdr, FUSE_BATCH_FORGET, 0, sizeof(*batch_in) +
+			 count * sizeof(q->entries[0]));
+	batch_in->count = count;
+	req->in_buffer_size = hdr->len;
+	req->hiprio = true;
 
-	strcpy(unlink_in.name, filename);
+	if ((ret = fuse_forget_send(dev, req)) && !rc)
+		rc = ret;
+	return rc;
+}
 
-	req->in_buffer = &unlink_in;
-	req->in_buffer_size = unlink_in.hdr.len;
-	req->out_buffer = &unlink_out;
-	req->out_buffer_size = sizeof(unlink_out);
+#if CONFIG_LIBUKSCHED
+static void fuse_forget_flusher(void *arg)
+{
+	struct uk_fuse_dev *dev = arg;
+	struct uk_fusedev_forget_queue *q = &dev->_forgets;
+	unsigned long flags;
+	uint32_t delay;
+	bool expired;
+
+	while (!UK_READ_ONCE(q->stop)) {
+		delay = UK_READ_ONCE(dev->forget_delay_ms);
+		uk_sched_thread_sleep(ukarch_time_msec_to_nsec(
+					      delay ? MAX(delay / 2, 1U) : 1000));
+
+		ukplat_spin_lock_irqsave(&q->spinlock, flags);
+		expired = (q->count &&
+			   ukplat_monotonic_clock() - q->oldest >=
+			   ukarch_time_msec_to_nsec(delay))
+			  || q->nunsent;
+		ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+
+		if (expired)
+			uk_fuse_forget_flush(dev);
+		else if (UK_READ_ONCE(q->inflight))
+			fuse_forget_reap(dev);
+	}
+}
+#endif
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
+/**
+ * @brief starts the thread, that sends forgets after dev->forget_delay_ms,
+ * if no further forget is collected
+ *
+ * @param dev
+ * @return int
+ */
+int uk_fuse_forget_start(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
 
-	uk_fuse_request_forget(dev, nodeid, nlookup);
+#if CONFIG_LIBUKSCHED
+	if (dev->_forgets.flusher)
+		return 0;
 
-free:
-	uk_fusedev_req_remove(dev, req);
-	return rc;
+	dev->_forgets.stop = false;
+	dev->_forgets.flusher = uk_thread_create("fuse-forget",
+						 fuse_forget_flusher, dev);
+	if (!dev->_forgets.flusher)
+		return -ENOMEM;
+#endif
+	return 0;
 }
 
 /**
- * @brief
+ * @brief stops the flusher thread, sends the collected forgets and waits
+ * until the device is done with them
+ *
+ * Has to be called while the device is still connected.
  *
  * @param dev
- * @param fh
- * @param nodeid
- * @param file_off
- * @param length
- * @param[out] out_buf buffer, containing read data
- * @param[out] bytes_transferred how many bytes have been read
- * @return int
  */
-int uk_fuse_request_read(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
-			 uint64_t file_off, uint32_t length,
-			 void *out_buf, uint32_t *bytes_transferred)
+void uk_fuse_forget_fini(struct uk_fuse_dev *dev)
 {
-	int rc = 0;
-	uint32_t max_req_buf_size; /* buffer for one request */
-	*bytes_transferred = 0;
-	FUSE_READ_OUT *read_out;
-	struct uk_fuse_req *req;
+	struct uk_fusedev_forget_queue *q;
+	struct uk_fuse_req *reqs[8];
+	unsigned int n;
+	int rc;
 
 	UK_ASSERT(dev);
-	UK_ASSERT(out_buf);
-	UK_ASSERT(bytes_transferred);
+	q = &dev->_forgets;
+
+#if CONFIG_LIBUKSCHED
+	if (q->flusher) {
+		UK_WRITE_ONCE(q->stop, true);
+		uk_thread_wake(q->flusher);
+		uk_thread_wait(q->flusher);
+		q->flusher = NULL;
+	}
+#endif
+
+	/* Last try for the forgets, that could not be sent before */
+	while (UK_READ_ONCE(q->count) || UK_READ_ONCE(q->nunsent))
+		if ((rc = uk_fuse_forget_flush(dev))) {
+			uk_pr_err("Lost %"__PRIu32" forgets and %"__PRIu32
+				  " FUSE_BATCH_FORGET requests: %d\n",
+				  q->count, q->nunsent, rc);
+			break;
+		}
 
-	if (out_buf == NULL) {
-		uk_pr_err("%s: Provided buffer is invalid", __func__);
-		return -1;
+	while ((n = uk_fuse_cq_poll(&q->unsent, reqs, ARRAY_SIZE(reqs)))) {
+		for (unsigned int i = 0; i < n; i++) {
+			uk_fusedev_req_remove(dev, reqs[i]);
+			ukarch_dec(&q->nunsent);
+		}
 	}
+	q->count = 0;
 
-	req = uk_fusedev_req_create(dev);
-	if (PTRISERR(req))
-		return PTR2ERR(req);
+	while (UK_READ_ONCE(q->inflight)) {
+		n = uk_fuse_cq_wait(&q->sent, reqs, ARRAY_SIZE(reqs));
+		for (unsigned int i = 0; i < n; i++) {
+			uk_fusedev_req_remove(dev, reqs[i]);
+			ukarch_dec(&q->inflight);
+		}
+	}
+}
 
-	/* Maximum size of a buffer for one request.
-	   (Host page size is unknown, but it can't be less than 4KiB. */
-	max_req_buf_size = MIN(dev->max_pages * PAGE_SIZE_4k, length);
+/**
+ * @brief collects a forget, bypassing the node table
+ *
+ * The forget is not sent right away, but together with others as one
+ * FUSE_BATCH_FORGET request, once dev->forget_batch forgets have been
+ * collected or the oldest of them has waited for dev->forget_delay_ms.
+ * With LIBUKSCHED, the flusher thread sends them once the delay is over,
+ * even if no further forget is collected.
+ */
+static int fuse_forget_queue(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t nlookup)
+{
+	struct uk_fusedev_forget_queue *q;
+	unsigned long flags;
+	uint32_t batch;
+	__nsec now;
+	bool flush;
+	int rc;
 
-	read_out = uk_calloc(dev->a, 1, sizeof(*read_out)
-						 + max_req_buf_size);
-	if (read_out == NULL) {
-		rc = -1;
-		goto req_remove;
+	UK_ASSERT(dev);
+	q = &dev->_forgets;
+
+	batch = MAX(1U, MIN(UK_READ_ONCE(dev->forget_batch),
+			    (uint32_t) UK_FUSE_FORGET_BATCH_MAX));
+	now = ukplat_monotonic_clock();
+
+	ukplat_spin_lock_irqsave(&q->spinlock, flags);
+	while (q->count >= batch) {
+		/* Make room, if other threads have not flushed yet. Forgets,
+		   that could not be sent, are kept for later on, so only a
+		   failure to take them out of the queue matters here. */
+		ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+		if ((rc = uk_fuse_forget_flush(dev))
+		    && UK_READ_ONCE(q->count) >= batch)
+			return rc;
+		ukplat_spin_lock_irqsave(&q->spinlock, flags);
 	}
 
-	while (length)
-	{
-		uint32_t req_buf_size = MIN(length, max_req_buf_size);
-		FUSE_READ_IN read_in;
-		uint32_t req_out_size; /* how many bytes of data a single
-					  request has returned */
+	if (q->count == 0)
+		q->oldest = now;
+	q->entries[q->count].nodeid = nodeid;
+	q->entries[q->count].nlookup = nlookup;
+	q->count++;
 
-		read_in.read.fh = fh;
-		read_in.read.offset = file_off;
-		read_in.read.size = req_buf_size;
+	flush = q->count >= batch ||
+		now - q->oldest >=
+		ukarch_time_msec_to_nsec(UK_READ_ONCE(dev->forget_delay_ms));
+	ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
 
-		FUSE_HEADER_INIT(&read_in.hdr, FUSE_READ, nodeid,
-			sizeof(read_in.read));
+	if (flush)
+		return uk_fuse_forget_flush(dev);
 
-		req->in_buffer = &read_in;
-		req->in_buffer_size = sizeof(read_in);
-		/* TODOFS: when substituting this for a MACRO, beware of
-		   read_out and not &read_out. */
-		req->out_buffer = read_out;
-		req->out_buffer_size = sizeof(*read_out) + req_buf_size;
+	return 0;
+}
 
-		if ((rc = send_and_wait(dev, req)))
-			goto free;
+/**
+ * @brief tells the device, that @p nlookup lookups of @p nodeid are dropped
+ *
+ * At most as many lookups as recorded in the node table are forgotten. The
+ * forget is collected and sent later on (see fuse_forget_queue()).
+ * FUSE_FORGET has no reply, so nothing is waited for.
+ *
+ * @param dev
+ * @param nodeid
+ * @param nlookup
+ * @return int
+ */
+int uk_fuse_request_forget(struct uk_fuse_dev *dev, uint64_t nodeid,
+			   uint64_t nlookup)
+{
+	struct uk_fuse_node node;
+
+	UK_ASSERT(dev);
+
+	nlookup = uk_fuse_node_forget(dev, nodeid, nlookup);
+	if (!nlookup)
+		return 0;
+
+	/* The device may reuse the nodeid for another file */
+	if (uk_fuse_node_get(dev, nodeid, &node))
+		uk_fuse_pcache_invalidate(dev, nodeid, 0, UINT64_MAX);
+
+	return fuse_forget_queue(dev, nodeid, nlookup);
+}
+
+/**
+ * @brief records a lookup, the device has replied with, in the node table
+ *
+ * A lookup, that can not be recorded, is forgotten right away, as it could
+ * not be forgotten later on.
+ *
+ * @param dev
+ * @param parent directory, the node has been looked up in
+ * @param entry
+ * @return int
+ */
+static int fuse_node_lookup(struct uk_fuse_dev *dev, uint64_t parent,
+			    const struct fuse_entry_out *entry)
+{
+	int rc;
+
+	rc = uk_fuse_node_lookup_add(dev, parent, entry);
+	if (rc < 0) {
+		uk_pr_err("Failed to record the lookup of %" __PRIu64 ": %d\n",
+			  entry->nodeid, rc);
+		fuse_forget_queue(dev, entry->nodeid, 1);
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Nodes are evicted this many at a time */
+#define FUSE_NODE_EVICT_BATCH	32
+
+/**
+ * @brief forgets nodes, that are not held, beyond the size of the lookup
+ * cache
+ *
+ * Such nodes only back cached lookups (e.g., of FUSE_READDIRPLUS entries,
+ * which have not been opened), so more of them are of no use. Their forgets
+ * are collected like any other and sent in FUSE_BATCH_FORGET requests.
+ *
+ * @param dev
+ */
+static void fuse_node_evict(struct uk_fuse_dev *dev)
+{
+	struct fuse_forget_one forgets[FUSE_NODE_EVICT_BATCH];
+	uint32_t max = UK_READ_ONCE(dev->dentry_max);
+	uint32_t n, i;
+
+	do {
+		if (UK_READ_ONCE(dev->_nodes.unheld) <= max)
+			return;
+
+		n = uk_fuse_node_evict(dev, max, forgets,
+				       ARRAY_SIZE(forgets));
+		for (i = 0; i < n; i++) {
+			/* The device may reuse the nodeid for another file */
+			uk_fuse_pcache_invalidate(dev, forgets[i].nodeid, 0,
+						  UINT64_MAX);
+			fuse_forget_queue(dev, forgets[i].nodeid,
+					  forgets[i].nlookup);
+		}
+	} while (n == ARRAY_SIZE(forgets));
+}
+
+/**
+ * @brief delete a file
+ *
+ * @param dev
+ * @param filename
+ * @param nlookup
+ * @return int
+ */
+int uk_fuse_request_unlink(struct uk_fuse_dev *dev, const char *filename,
+			   bool is_dir, uint64_t nodeid, uint64_t nlookup,
+			   uint64_t parent_nodeid)
+{
+	int rc = 0;
+	FUSE_UNLINK_IN unlink_in = {0};
+	FUSE_UNLINK_OUT unlink_out = {0};
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(filename);
+
+	if (strlen(filename) > NAME_MAX) {
+		uk_pr_err("Filename is larger than %d characters\n", NAME_MAX);
+		return -1;
+	}
+
+	req = uk_fusedev_req_create(dev);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
+
+	FUSE_HEADER_INIT(&unlink_in.hdr, is_dir ? FUSE_RMDIR : FUSE_UNLINK,
+	parent_nodeid, strlen(filename) + 1);
+
+	strcpy(unlink_in.name, filename);
+
+	req->in_buffer = &unlink_in;
+	req->in_buffer_size = unlink_in.hdr.len;
+	req->out_buffer = &unlink_out;
+	req->out_buffer_size = sizeof(unlink_out);
+
+	if ((rc = send_and_wait(dev, req)))
+		goto free;
+
+	/* The link count of the node and its parent have changed */
+	fuse_attr_changed(dev, nodeid);
+	fuse_attr_changed(dev, parent_nodeid);
+	uk_fuse_dentry_remove(dev, parent_nodeid, filename);
+	uk_fuse_request_forget(dev, nodeid, nlookup);
+
+free:
+	uk_fusedev_req_remove(dev, req);
+	return rc;
+}
+
+/**
+ * @brief creates, but does not submit, the request of
+ * uk_fuse_request_read_async()
+ */
+static struct uk_fuse_req *fuse_read_req_create(struct uk_fuse_dev *dev,
+						uint64_t nodeid, uint64_t fh,
+						uint64_t file_off,
+						uint32_t length, void *out_buf)
+{
+	FUSE_READ_IN *read_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(out_buf);
+
+	if (length > dev->max_pages * PAGE_SIZE_4k)
+		return ERR2PTR(-EINVAL);
+
+	req = fuse_req_create_bufs(dev, sizeof(*read_in),
+				   sizeof(FUSE_READ_OUT));
+	if (PTRISERR(req))
+		return req;
+
+	read_in = req->in_buffer;
+	FUSE_HEADER_INIT(&read_in->hdr, FUSE_READ, nodeid,
+		sizeof(read_in->read));
+
+	read_in->read.fh = fh;
+	read_in->read.offset = file_off;
+	read_in->read.size = length;
+
+	req->zc_dir = UK_FUSEREQ_ZCDIR_READ;
+	req->zc_buf = out_buf;
+	req->zc_size = length;
+
+	return req;
+}
+
+/**
+ * @brief asynchronous FUSE_READ of at most one request's worth of data
+ *
+ * Reads up to @p length bytes, where @p length may not exceed
+ * dev->max_pages pages. The device writes the data directly into @p out_buf
+ * (zero-copy), which therefore has to stay valid until the request has been
+ * received.
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh
+ * @param file_off
+ * @param length
+ * @param out_buf
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_read_async(struct uk_fuse_dev *dev,
+					       uint64_t nodeid, uint64_t fh,
+					       uint64_t file_off,
+					       uint32_t length, void *out_buf,
+					       uk_fusereq_done_t done,
+					       void *done_arg)
+{
+	struct uk_fuse_req *req;
+
+	req = fuse_read_req_create(dev, nodeid, fh, file_off, length, out_buf);
+	if (PTRISERR(req))
+		return req;
+
+	return fuse_submit_async(dev, req, done, done_arg);
+}
+
+/**
+ * @brief retrieves the result of a completed FUSE_READ request
+ *
+ * Fewer bytes than requested mean that the end of file has been reached.
+ *
+ * @param req request returned by uk_fuse_request_read_async()
+ * @param[out] bytes_transferred how many bytes have been read
+ * @return int
+ */
+int uk_fuse_reply_read(struct uk_fuse_req *req, uint32_t *bytes_transferred)
+{
+	FUSE_READ_OUT *read_out;
+
+	UK_ASSERT(req);
+	UK_ASSERT(bytes_transferred);
+	UK_ASSERT(UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED);
+
+	if (req->rc)
+		return req->rc;
+
+	read_out = req->out_buffer;
+	*bytes_transferred = MIN(read_out->hdr.len
+				 - sizeof(struct fuse_out_header),
+				 req->zc_size);
+
+	return 0;
+}
+
+/**
+ * @brief updates the caches after @p len bytes at @p off of a file have
+ * been written on the device
+ */
+static void fuse_data_written(struct uk_fuse_dev *dev, uint64_t nodeid,
+			      uint64_t off, uint64_t len)
+{
+	uk_fuse_pcache_invalidate(dev, nodeid, off, len);
+	if (dev->attr_cache == UK_FUSE_ATTR_CACHE_RELAXED)
+		uk_fuse_node_extend_size(dev, nodeid, off + len);
+	else
+		uk_fuse_node_invalidate_attr(dev, nodeid);
+}
+
+/**
+ * @brief creates, but does not submit, the request of
+ * uk_fuse_request_write_async()
+ */
+static struct uk_fuse_req *fuse_write_req_create(struct uk_fuse_dev *dev,
+						 uint64_t nodeid, uint64_t fh,
+						 const void *in_buf,
+						 uint32_t length, uint64_t off)
+{
+	FUSE_WRITE_IN *write_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(in_buf);
+
+	if (length > dev->max_write)
+		return ERR2PTR(-EINVAL);
+
+	req = fuse_req_create_bufs(dev, sizeof(*write_in),
+				   sizeof(FUSE_WRITE_OUT));
+	if (PTRISERR(req))
+		return req;
+
+	write_in = req->in_buffer;
+	FUSE_HEADER_INIT(&write_in->hdr, FUSE_WRITE, nodeid,
+			 sizeof(struct fuse_write_in) + length);
+
+	write_in->write.fh = fh;
+	write_in->write.offset = off;
+	write_in->write.size = length;
+
+	req->zc_dir = UK_FUSEREQ_ZCDIR_WRITE;
+	req->zc_buf = (void *) in_buf;
+	req->zc_size = length;
+
+	return req;
+}
+
+/**
+ * @brief asynchronous FUSE_WRITE of at most one request's worth of data
+ *
+ * Writes up to @p length bytes, where @p length may not exceed dev->max_write.
+ * The device reads the data directly from @p in_buf (zero-copy), which
+ * therefore has to stay valid until the request has been received. The number
+ * of bytes written is retrieved with uk_fuse_reply_write().
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh
+ * @param in_buf
+ * @param length
+ * @param off
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_write_async(struct uk_fuse_dev *dev,
+						uint64_t nodeid, uint64_t fh,
+						const void *in_buf,
+						uint32_t length, uint64_t off,
+						uk_fusereq_done_t done,
+						void *done_arg)
+{
+	struct uk_fuse_req *req;
+
+	req = fuse_write_req_create(dev, nodeid, fh, in_buf, length, off);
+	if (PTRISERR(req))
+		return req;
+
+	return fuse_submit_async(dev, req, done, done_arg);
+}
+
+/**
+ * @brief retrieves the result of a completed FUSE_WRITE request
+ *
+ * @param req request returned by uk_fuse_request_write_async()
+ * @param[out] bytes_transferred how many bytes have been written
+ * @return int
+ */
+int uk_fuse_reply_write(struct uk_fuse_req *req, uint32_t *bytes_transferred)
+{
+	FUSE_WRITE_IN *write_in;
+
+	UK_ASSERT(req);
+	UK_ASSERT(bytes_transferred);
+	UK_ASSERT(UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED);
+
+	if (req->rc)
+		return req->rc;
+
+	*bytes_transferred = ((FUSE_WRITE_OUT *) req->out_buffer)->write.size;
+
+	if (req->_dev) {
+		write_in = req->in_buffer;
+		fuse_data_written(req->_dev, write_in->hdr.nodeid,
+				  write_in->write.offset, *bytes_transferred);
+	}
+	return 0;
+}
+
+/**
+ * @brief chunk requests of a pipelined read or write, oldest first
+ */
+struct fuse_io_window {
+	struct uk_fuse_req *reqs[UK_FUSE_IO_WINDOW_MAX];
+	/* Number of bytes requested by each chunk. */
+	uint32_t sizes[UK_FUSE_IO_WINDOW_MAX];
+	unsigned int head;
+	unsigned int count;
+};
+
+static inline unsigned int fuse_io_window_size(struct uk_fuse_dev *dev)
+{
+	return MAX(1U, MIN(dev->io_window, (uint32_t) UK_FUSE_IO_WINDOW_MAX));
+}
+
+static inline void fuse_io_window_push(struct fuse_io_window *w,
+				       struct uk_fuse_req *req, uint32_t size)
+{
+	unsigned int i = (w->head + w->count) % UK_FUSE_IO_WINDOW_MAX;
+
+	w->reqs[i] = req;
+	w->sizes[i] = size;
+	w->count++;
+}
+
+/**
+ * @brief releases the @p pending newest chunk requests, which have not been
+ * submitted, and removes them from the window
+ */
+static void fuse_io_window_discard(struct uk_fuse_dev *dev,
+				   struct fuse_io_window *w,
+				   unsigned int pending)
+{
+	UK_ASSERT(pending <= w->count);
+
+	while (pending--) {
+		w->count--;
+		uk_fusedev_req_remove(dev,
+			w->reqs[(w->head + w->count) % UK_FUSE_IO_WINDOW_MAX]);
+	}
+}
+
+/**
+ * @brief submits the @p pending newest chunk requests of the window as one
+ * batch, so that the device is notified once for all of them
+ *
+ * Requests, that could not be submitted, are discarded.
+ */
+static int fuse_io_window_submit(struct uk_fuse_dev *dev,
+				 struct fuse_io_window *w,
+				 unsigned int pending)
+{
+	struct uk_fuse_req *batch[UK_FUSE_IO_WINDOW_MAX];
+	unsigned int first, submitted, i;
+	int rc;
+
+	UK_ASSERT(pending <= w->count);
+
+	first = w->head + w->count - pending;
+	for (i = 0; i < pending; i++) {
+		batch[i] = w->reqs[(first + i) % UK_FUSE_IO_WINDOW_MAX];
+		uk_fusedev_req_prepare(batch[i], NULL, NULL);
+	}
+
+	rc = uk_fusedev_request_batch(dev, batch, pending, &submitted);
+	if (rc)
+		fuse_io_window_discard(dev, w, pending - submitted);
+	return rc;
+}
+
+/**
+ * @brief waits for the oldest chunk request and removes it from the window
+ *
+ * @param[out] size number of bytes the chunk has requested
+ * @return struct uk_fuse_req* the received request, which the caller has to
+ * release
+ */
+static struct uk_fuse_req *fuse_io_window_pop(struct fuse_io_window *w,
+					      uint32_t *size)
+{
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(w->count > 0);
+
+	req = w->reqs[w->head];
+	*size = w->sizes[w->head];
+	w->head = (w->head + 1) % UK_FUSE_IO_WINDOW_MAX;
+	w->count--;
+
+	uk_fusereq_waitreply(req);
+	return req;
+}
+
+/**
+ * @brief waits for and discards all chunk requests still in flight
+ *
+ * Their buffers belong to the caller, so they must not be returned from
+ * before the device is done with them.
+ */
+static void fuse_io_window_drain(struct uk_fuse_dev *dev,
+				 struct fuse_io_window *w)
+{
+	uint32_t size;
+
+	while (w->count)
+		uk_fusedev_req_remove(dev, fuse_io_window_pop(w, &size));
+}
+
+/**
+ * @brief fuse_io_window_drain() for the chunk requests of a write
+ *
+ * Chunks, whose replies are not used, may still have written data on the
+ * device, so the caches are updated for every one, that has succeeded.
+ */
+static void fuse_io_window_drain_write(struct uk_fuse_dev *dev,
+				       struct fuse_io_window *w)
+{
+	struct uk_fuse_req *req;
+	uint32_t size, written;
+
+	while (w->count) {
+		req = fuse_io_window_pop(w, &size);
+		uk_fuse_reply_write(req, &written);
+		uk_fusedev_req_remove(dev, req);
+	}
+}
+
+/**
+ * @brief
+ *
+ * The data is read directly into @p out_buf, split into requests of at most
+ * dev->max_pages pages. Up to dev->io_window of them are in flight at once.
+ *
+ * @param dev
+ * @param fh
+ * @param nodeid
+ * @param file_off
+ * @param length
+ * @param[out] out_buf buffer, containing read data
+ * @param[out] bytes_transferred how many bytes have been read
+ * @return int
+ */
+int uk_fuse_request_read(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
+			 uint64_t file_off, uint32_t length,
+			 void *out_buf, uint32_t *bytes_transferred)
+{
+	int rc = 0;
+	uint32_t max_req_buf_size; /* buffer for one request */
+	uint32_t issued = 0; /* bytes covered by submitted requests */
+	unsigned int window, pending;
+	struct fuse_io_window w = { .head = 0, .count = 0 };
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(out_buf);
+	UK_ASSERT(bytes_transferred);
+
+	*bytes_transferred = 0;
+
+	if (out_buf == NULL) {
+		uk_pr_err("%s: Provided buffer is invalid", __func__);
+		return -1;
+	}
+
+	/* Maximum size of a buffer for one request.
+	   (Host page size is unknown, but it can't be less than 4KiB. */
+	max_req_buf_size = dev->max_pages * PAGE_SIZE_4k;
+	window = fuse_io_window_size(dev);
+
+	while (issued < length || w.count) {
+		uint32_t req_buf_size;
+		uint32_t req_out_size; /* how many bytes of data a single
+					  request has returned */
+
+		/* Keep the window filled, submitting the new chunk requests
+		   at once */
+		if (issued < length && w.count < window) {
+			for (pending = 0; issued < length && w.count < window;
+			     pending++) {
+				req_buf_size = MIN(length - issued,
+						   max_req_buf_size);
+				req = fuse_read_req_create(dev, nodeid, fh,
+						file_off + issued, req_buf_size,
+						(char *) out_buf + issued);
+				if (PTRISERR(req)) {
+					fuse_io_window_discard(dev, &w,
+							       pending);
+					rc = PTR2ERR(req);
+					goto drain;
+				}
+
+				fuse_io_window_push(&w, req, req_buf_size);
+				issued += req_buf_size;
+			}
+
+			if ((rc = fuse_io_window_submit(dev, &w, pending)))
+				goto drain;
+			continue;
+		}
+
+		req = fuse_io_window_pop(&w, &req_buf_size);
+		rc = uk_fuse_reply_read(req, &req_out_size);
+		uk_fusedev_req_remove(dev, req);
+		if (rc)
+			goto drain;
 
-		req_out_size = read_out->hdr.len
-					- sizeof(struct fuse_out_header);
-		memcpy((char *) out_buf, read_out->buf, req_out_size);
 		*bytes_transferred += req_out_size;
 
 		/* A successful read with no bytes read means file offset
@@ -809,30 +1737,31 @@ int uk_fuse_request_read(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
 		if (req_out_size == 0) {
 			uk_pr_err("End of file reached\n");
 			rc = EOF;
-			goto free;
+			goto drain;
 		}
 
+		/* A short read means end of file as well. Data, that later
+		   requests may have read, is not contiguous with it. */
 		if (req_out_size < req_buf_size)
-			break;
-
-		out_buf = (char *) out_buf + req_out_size;
-		file_off += req_out_size;
-		length -= req_out_size;
+			goto drain;
 	}
 
 	uk_pr_debug("%s: Bytes transfered %" __PRIu32 "\n", __func__,
 							*bytes_transferred);
 
-free:
-	uk_free(dev->a, read_out);
-req_remove:
-	uk_fusedev_req_remove(dev, req);
+drain:
+	fuse_io_window_drain(dev, &w);
 	return rc;
 }
 
 /**
  * @brief
  *
+ * The data is sent directly from @p in_buf, split into requests of at most
+ * dev->max_write bytes. Up to dev->io_window of them are in flight at once.
+ * After a partial write, the remaining data is sent again starting right
+ * after the bytes that have been written.
+ *
  * @param dev
  * @param fh
  * @param nodeid
@@ -847,58 +1776,283 @@ int uk_fuse_request_write(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
 			  uint32_t *bytes_transferred)
 {
 	int rc = 0;
-	FUSE_WRITE_IN *write_in;
-	FUSE_WRITE_OUT write_out = {0};
 	struct uk_fuse_req *req;
-	uint32_t write_size;
-	*bytes_transferred = 0;
+	uint32_t write_size, written;
+	uint32_t issued = 0; /* bytes covered by submitted requests */
+	unsigned int window, pending;
+	struct fuse_io_window w = { .head = 0, .count = 0 };
 
 	UK_ASSERT(dev);
 	UK_ASSERT(in_buf);
 	UK_ASSERT(bytes_transferred);
 
+	*bytes_transferred = 0;
+	window = fuse_io_window_size(dev);
+
+	do {
+		/* Keep the window filled, submitting the new chunk requests
+		   at once */
+		if ((issued < length || length == 0) && w.count < window) {
+			pending = 0;
+			do {
+				write_size = MIN(length - issued,
+						 dev->max_write);
+				req = fuse_write_req_create(dev, nodeid, fh,
+						(const char *) in_buf + issued,
+						write_size, off + issued);
+				if (PTRISERR(req)) {
+					fuse_io_window_discard(dev, &w,
+							       pending);
+					rc = PTR2ERR(req);
+					goto drain;
+				}
+
+				fuse_io_window_push(&w, req, write_size);
+				issued += write_size;
+				pending++;
+			} while (issued < length && w.count < window);
+
+			if ((rc = fuse_io_window_submit(dev, &w, pending)))
+				goto drain;
+			if (length)
+				continue;
+		}
+
+		req = fuse_io_window_pop(&w, &write_size);
+		rc = uk_fuse_reply_write(req, &written);
+		uk_fusedev_req_remove(dev, req);
+		if (rc)
+			goto drain;
+
+		*bytes_transferred += written;
+
+		if (written < write_size) {
+			/* Guard against looping forever on a stalled device. */
+			if (written == 0) {
+				rc = -EIO;
+				goto drain;
+			}
+
+			/* Requests sent after the partial one do not
+			   continue it. Resend everything from there on. */
+			fuse_io_window_drain_write(dev, &w);
+			issued = *bytes_transferred;
+		}
+	} while (*bytes_transferred < length);
+
+drain:
+	fuse_io_window_drain_write(dev, &w);
+	return rc;
+}
+
+/**
+ * @brief copies data between two files on the device (server-side copy)
+ *
+ * The data does not pass through the guest. Dirty data of both files in
+ * the writeback cache is written first. The device may copy less than
+ * @p length bytes, e.g., at the end of the source file. At most
+ * UINT32_MAX bytes (rounded down to a page) are copied per call.
+ *
+ * @param dev
+ * @param nodeid_in
+ * @param fh_in
+ * @param off_in
+ * @param nodeid_out
+ * @param fh_out
+ * @param off_out
+ * @param length
+ * @param[out] bytes_copied
+ * @return int -EOPNOTSUPP, if the device does not support
+ * FUSE_COPY_FILE_RANGE
+ */
+int uk_fuse_request_copy_file_range(struct uk_fuse_dev *dev,
+				    uint64_t nodeid_in, uint64_t fh_in,
+				    uint64_t off_in, uint64_t nodeid_out,
+				    uint64_t fh_out, uint64_t off_out,
+				    uint64_t length, uint64_t *bytes_copied)
+{
+	int rc = 0;
+	FUSE_COPY_FILE_RANGE_IN copy_in = {0};
+	FUSE_COPY_FILE_RANGE_OUT copy_out = {0};
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(bytes_copied);
+
+	*bytes_copied = 0;
+	if (UK_READ_ONCE(dev->no_copy_file_range))
+		return -EOPNOTSUPP;
+
+	if ((rc = uk_fuse_wb_flush(dev, nodeid_in)))
+		return rc;
+	if (nodeid_out != nodeid_in && (rc = uk_fuse_wb_flush(dev, nodeid_out)))
+		return rc;
+
+	FUSE_HEADER_INIT(&copy_in.hdr, FUSE_COPY_FILE_RANGE, nodeid_in,
+			 sizeof(copy_in.copy_file_range));
+
+	copy_in.copy_file_range.fh_in = fh_in;
+	copy_in.copy_file_range.off_in = off_in;
+	copy_in.copy_file_range.nodeid_out = nodeid_out;
+	copy_in.copy_file_range.fh_out = fh_out;
+	copy_in.copy_file_range.off_out = off_out;
+	/* The number of bytes copied is replied as 32-bit value */
+	copy_in.copy_file_range.len = MIN(length, (uint64_t) UINT32_MAX
+					  & ~((uint64_t) PAGE_SIZE_4k - 1));
+
 	req = uk_fusedev_req_create(dev);
 	if (PTRISERR(req))
 		return PTR2ERR(req);
 
-	write_size = MIN(length, dev->max_write);
-	write_in = uk_calloc(dev->a, 1, sizeof(*write_in) + write_size);
-	if (write_in == NULL) {
-		rc = -1;
-		goto req_remove;
+	req->in_buffer = &copy_in;
+	req->in_buffer_size = sizeof(copy_in);
+	req->out_buffer = &copy_out;
+	req->out_buffer_size = sizeof(copy_out);
+
+	if ((rc = send_and_wait(dev, req))) {
+		if (rc == -ENOSYS) {
+			UK_WRITE_ONCE(dev->no_copy_file_range, true);
+			rc = -EOPNOTSUPP;
+		}
+		goto exit;
 	}
 
-	do {
-		FUSE_HEADER_INIT(&write_in->hdr, FUSE_WRITE, nodeid,
-				 sizeof(struct fuse_write_in) + write_size);
+	*bytes_copied = copy_out.write.size;
+	fuse_data_written(dev, nodeid_out, off_out, *bytes_copied);
 
-		write_in->write.fh = fh;
-		write_in->write.offset = off + *bytes_transferred;
-		write_in->write.size = write_size;
-		memcpy(write_in->buf, (char *) in_buf + *bytes_transferred,
-		       write_size);
+exit:
+	uk_fusedev_req_remove(dev, req);
+	return rc;
+}
 
-		req->in_buffer = write_in;
-		req->in_buffer_size = write_in->hdr.len;
-		req->out_buffer = &write_out;
-		req->out_buffer_size = sizeof(write_out);
+/**
+ * @brief allocates, deallocates or zeroes space of a file on the device
+ *
+ * Without flags, the range is allocated and the file is extended, if it ends
+ * within the range. Dirty data of the file in the writeback cache is written
+ * first.
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh file handle, opened for writing
+ * @param off
+ * @param length
+ * @param mode UK_FUSE_FALLOC_* flags. UK_FUSE_FALLOC_PUNCH_HOLE deallocates
+ * the range and requires UK_FUSE_FALLOC_KEEP_SIZE. UK_FUSE_FALLOC_ZERO_RANGE
+ * zeroes the range. UK_FUSE_FALLOC_KEEP_SIZE keeps the size of the file.
+ * @return int -EOPNOTSUPP, if the device does not support FUSE_FALLOCATE or
+ * the mode
+ */
+int uk_fuse_request_fallocate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			      uint64_t fh, uint64_t off, uint64_t length,
+			      uint32_t mode)
+{
+	int rc = 0;
+	FUSE_FALLOCATE_IN fallocate_in = {0};
+	FUSE_FALLOCATE_OUT fallocate_out = {0};
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+
+	if (mode & ~(UK_FUSE_FALLOC_KEEP_SIZE | UK_FUSE_FALLOC_PUNCH_HOLE
+		     | UK_FUSE_FALLOC_ZERO_RANGE))
+		return -EOPNOTSUPP;
+	if ((mode & UK_FUSE_FALLOC_PUNCH_HOLE)
+	    && (mode & UK_FUSE_FALLOC_ZERO_RANGE))
+		return -EINVAL;
+	if ((mode & UK_FUSE_FALLOC_PUNCH_HOLE)
+	    && !(mode & UK_FUSE_FALLOC_KEEP_SIZE))
+		return -EOPNOTSUPP;
+	if (!length || off + length < off)
+		return -EINVAL;
+	if (UK_READ_ONCE(dev->no_fallocate))
+		return -EOPNOTSUPP;
+
+	/* Dirty data would otherwise be written over a hole or zeroes */
+	if ((rc = uk_fuse_wb_flush(dev, nodeid)))
+		return rc;
+
+	FUSE_HEADER_INIT(&fallocate_in.hdr, FUSE_FALLOCATE, nodeid,
+			 sizeof(fallocate_in.fallocate));
+
+	fallocate_in.fallocate.fh = fh;
+	fallocate_in.fallocate.offset = off;
+	fallocate_in.fallocate.length = length;
+	fallocate_in.fallocate.mode = mode;
+
+	req = uk_fusedev_req_create(dev);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
+
+	req->in_buffer = &fallocate_in;
+	req->in_buffer_size = sizeof(fallocate_in);
+	req->out_buffer = &fallocate_out;
+	req->out_buffer_size = sizeof(fallocate_out);
+
+	if ((rc = send_and_wait(dev, req))) {
+		if (rc == -ENOSYS) {
+			UK_WRITE_ONCE(dev->no_fallocate, true);
+			rc = -EOPNOTSUPP;
+		}
+		goto exit;
+	}
+
+	if (mode & UK_FUSE_FALLOC_KEEP_SIZE) {
+		uk_fuse_pcache_invalidate(dev, nodeid, off, length);
+		/* The number of blocks has changed */
+		uk_fuse_node_invalidate_attr(dev, nodeid);
+	} else {
+		fuse_data_written(dev, nodeid, off, length);
+	}
+
+exit:
+	uk_fusedev_req_remove(dev, req);
+	return rc;
+}
+
+/**
+ * @brief asynchronous version of uk_fuse_request_release()
+ *
+ * @param dev
+ * @param is_dir
+ * @param nodeid
+ * @param fh
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_release_async(struct uk_fuse_dev *dev,
+						  bool is_dir,
+						  uint64_t nodeid, uint64_t fh,
+						  uk_fusereq_done_t done,
+						  void *done_arg)
+{
+	FUSE_RELEASE_IN *release_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
 
-		if ((rc = send_and_wait(dev, req)))
-			goto free;
+	uk_pr_debug("Release request issued: fh %" __PRIu64 ", nodeid %" __PRIu64
+		    "\n", fh, nodeid);
 
-		*bytes_transferred += write_out.write.size;
-		length -= write_out.write.size;
-		write_size = MIN(length, dev->max_write);
+	/* Dirty ranges are written with the file handle. Failures have
+	   been reported by uk_fuse_request_flush() already. */
+	if (!is_dir)
+		uk_fuse_wb_flush(dev, nodeid);
 
+	req = fuse_req_create_bufs(dev, sizeof(*release_in),
+				   sizeof(FUSE_RELEASE_OUT));
+	if (PTRISERR(req))
+		return req;
 
-	} while (length > 0);
+	release_in = req->in_buffer;
+	FUSE_HEADER_INIT(&release_in->hdr, is_dir ? FUSE_RELEASEDIR :
+		FUSE_RELEASE, nodeid, sizeof(release_in->release));
 
-free:
-	uk_free(dev->a, write_in);
-req_remove:
-	uk_fusedev_req_remove(dev, req);
-	return rc;
+	release_in->release.fh = fh;
 
+	return fuse_submit_async(dev, req, done, done_arg);
 }
 
 /**
@@ -921,36 +2075,15 @@ int uk_fuse_request_release(struct uk_fuse_dev *dev, bool is_dir,
 			    uint64_t nodeid, uint64_t fh)
 {
 	int rc = 0;
-	FUSE_RELEASE_IN release_in = {0};
-	FUSE_RELEASE_OUT release_out = {0};
 	struct uk_fuse_req *req;
 
-	UK_ASSERT(dev);
-
-	uk_pr_debug("Release request issued: fh %" __PRIu64 ", nodeid %" __PRIu64
-		    "\n", fh, nodeid);
-
-	FUSE_HEADER_INIT(&release_in.hdr, is_dir ? FUSE_RELEASEDIR :
-		FUSE_RELEASE, nodeid, sizeof(release_in.release));
-
-	release_in.release.fh = fh;
-
-	req = uk_fusedev_req_create(dev);
+	req = uk_fuse_request_release_async(dev, is_dir, nodeid, fh,
+					    NULL, NULL);
 	if (PTRISERR(req))
 		return PTR2ERR(req);
 
-	req->in_buffer = &release_in;
-	req->in_buffer_size = sizeof(release_in);
-	req->out_buffer = &release_out;
-	req->out_buffer_size = sizeof(release_out);
-
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
-
-	uk_fusedev_req_remove(dev, req);
-	return 0;
+	rc = uk_fusereq_waitreply(req);
 
-free:
 	uk_fusedev_req_remove(dev, req);
 	return rc;
 }
@@ -968,6 +2101,9 @@ int uk_fuse_request_setattr(struct uk_fuse_dev *dev, uint64_t nodeid,
 	struct uk_fuse_req *req;
 
 
+	if (!is_dir && (rc = uk_fuse_wb_flush(dev, nodeid)))
+		return rc;
+
 	FUSE_HEADER_INIT(&setattr_in.hdr, FUSE_SETATTR,
 		nodeid, sizeof(setattr_in.setattr));
 
@@ -1019,6 +2155,10 @@ int uk_fuse_request_setattr(struct uk_fuse_dev *dev, uint64_t nodeid,
 	if ((rc = send_and_wait(dev, req)))
 		goto free;
 
+	uk_fuse_node_set_attr(dev, nodeid, &setattr_out.attr.attr,
+			      setattr_out.attr.attr_valid,
+			      setattr_out.attr.attr_valid_nsec);
+
 	uk_fusedev_req_remove(dev, req);
 	return 0;
 
@@ -1028,6 +2168,100 @@ free:
 
 }
 
+/**
+ * @brief truncates or extends a file to @p size bytes with FUSE_SETATTR
+ *
+ * Dirty data is written first, so that it does not reappear beyond the new
+ * end of the file. Cached pages from @p size on are dropped.
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh file handle opened for writing, or INVALID_FILE_HANDLE
+ * @param size
+ * @return int -EOPNOTSUPP, if the device cannot change the size
+ */
+int uk_fuse_request_truncate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t fh, uint64_t size)
+{
+	FUSE_SETATTR_IN setattr_in = {0};
+	FUSE_SETATTR_OUT setattr_out = {0};
+	struct uk_fuse_req *req;
+	int rc;
+
+	UK_ASSERT(dev);
+
+	if ((rc = uk_fuse_wb_flush(dev, nodeid)))
+		return rc;
+
+	FUSE_HEADER_INIT(&setattr_in.hdr, FUSE_SETATTR, nodeid,
+			 sizeof(setattr_in.setattr));
+	setattr_in.setattr.valid = FATTR_SIZE;
+	setattr_in.setattr.size = size;
+	if (fh != INVALID_FILE_HANDLE) {
+		setattr_in.setattr.valid |= FATTR_FH;
+		setattr_in.setattr.fh = fh;
+	}
+
+	req = uk_fusedev_req_create(dev);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
+
+	req->in_buffer = &setattr_in;
+	req->in_buffer_size = sizeof(setattr_in);
+	req->out_buffer = &setattr_out;
+	req->out_buffer_size = sizeof(setattr_out);
+
+	if ((rc = send_and_wait(dev, req))) {
+		if (rc == -ENOSYS)
+			rc = -EOPNOTSUPP;
+		goto exit;
+	}
+
+	uk_fuse_pcache_invalidate(dev, nodeid, size, UINT64_MAX);
+	uk_fuse_node_set_attr(dev, nodeid, &setattr_out.attr.attr,
+			      setattr_out.attr.attr_valid,
+			      setattr_out.attr.attr_valid_nsec);
+
+exit:
+	uk_fusedev_req_remove(dev, req);
+	return rc;
+}
+
+/**
+ * @brief asynchronous version of uk_fuse_request_flush()
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_flush_async(struct uk_fuse_dev *dev,
+						uint64_t nodeid, uint64_t fh,
+						uk_fusereq_done_t done,
+						void *done_arg)
+{
+	FUSE_FLUSH_IN *flush_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+
+	req = fuse_req_create_bufs(dev, sizeof(*flush_in),
+				   sizeof(FUSE_FLUSH_OUT));
+	if (PTRISERR(req))
+		return req;
+
+	flush_in = req->in_buffer;
+	FUSE_HEADER_INIT(&flush_in->hdr, FUSE_FLUSH, nodeid,
+		sizeof(flush_in->flush));
+
+	flush_in->flush.fh = fh;
+
+	return fuse_submit_async(dev, req, done, done_arg);
+}
+
 /**
  * @brief flush any pending changes to the indicated file handle
  *
@@ -1036,6 +2270,8 @@ free:
  * However, an empty reply message still needs to be issued
  * once the flush operation is complete.
  *
+ * Dirty ranges of the file in the writeback cache are written first.
+ *
  * @param dev
  * @param fh
  * @param nodeid
@@ -1043,37 +2279,19 @@ free:
  */
 int uk_fuse_request_flush(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh)
 {
-	int rc = 0;
-	FUSE_FLUSH_IN flush_in = {0};
-	FUSE_FLUSH_OUT flush_out = {0};
+	int rc = 0, wb_rc;
 	struct uk_fuse_req *req;
 
+	wb_rc = uk_fuse_wb_flush(dev, nodeid);
 
-	UK_ASSERT(dev);
-
-	FUSE_HEADER_INIT(&flush_in.hdr, FUSE_FLUSH, nodeid,
-		sizeof(flush_in.flush));
-
-	flush_in.flush.fh = fh;
-
-	req = uk_fusedev_req_create(dev);
+	req = uk_fuse_request_flush_async(dev, nodeid, fh, NULL, NULL);
 	if (PTRISERR(req))
 		return PTR2ERR(req);
 
-	req->in_buffer = &flush_in;
-	req->in_buffer_size = sizeof(flush_in);
-	req->out_buffer = &flush_out;
-	req->out_buffer_size = sizeof(flush_out);
-
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
-
-	uk_fusedev_req_remove(dev, req);
-	return 0;
+	rc = uk_fusereq_waitreply(req);
 
-free:
 	uk_fusedev_req_remove(dev, req);
-	return rc;
+	return wb_rc ? wb_rc : rc;
 }
 
 
@@ -1095,7 +2313,8 @@ free:
  * https://man7.org/linux/man-pages/man7/inode.7.html
  * @param[out] nodeid
  * @param[out] fh
- * @param[out] nlookup
+ * @param[out] nlookup lookups of the new node, that have been recorded (0, if
+ * the lookup has been forgotten right away)
  * @return int
  */
 int uk_fuse_request_create(struct uk_fuse_dev *dev, uint64_t parent,
@@ -1154,7 +2373,15 @@ int uk_fuse_request_create(struct uk_fuse_dev *dev, uint64_t parent,
 
 	*nodeid = create_out.entry.nodeid;
 	*fh     = create_out.open.fh;
-	*nlookup = 1; // newly created file has nloookup = 1
+	fuse_attr_changed(dev, parent);
+	/* A lookup, that could not be recorded, is forgotten already */
+	if (fuse_node_lookup(dev, parent, &create_out.entry)) {
+		*nlookup = 0;
+	} else {
+		*nlookup = 1; // newly created file has nloookup = 1
+		fuse_dentry_entry(dev, parent, file_name, &create_out.entry);
+		fuse_node_evict(dev);
+	}
 
 	uk_fusedev_req_remove(dev, req);
 	return 0;
@@ -1163,6 +2390,78 @@ free:
 	return rc;
 }
 
+/**
+ * @brief asynchronous version of uk_fuse_request_open()
+ *
+ * The file handle is retrieved from the reply with uk_fuse_reply_open().
+ *
+ * @param dev
+ * @param is_dir
+ * @param nodeid nodeid of the object (file/dir) to open
+ * @param flags flags as in open(2)
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_open_async(struct uk_fuse_dev *dev,
+					       bool is_dir, uint64_t nodeid,
+					       uint32_t flags,
+					       uk_fusereq_done_t done,
+					       void *done_arg)
+{
+	FUSE_OPEN_IN *open_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+
+	req = fuse_req_create_bufs(dev, sizeof(*open_in),
+				   sizeof(FUSE_OPEN_OUT));
+	if (PTRISERR(req))
+		return req;
+
+	open_in = req->in_buffer;
+	FUSE_HEADER_INIT(&open_in->hdr, is_dir ? FUSE_OPENDIR : FUSE_OPEN,
+		nodeid, sizeof(open_in->open));
+
+	/* TODOFS: think of flags */
+	open_in->open.flags = is_dir ? (O_RDONLY | O_DIRECTORY)
+		: flags;
+
+	return fuse_submit_async(dev, req, done, done_arg);
+}
+
+/**
+ * @brief retrieves the result of a completed FUSE_OPEN/FUSE_OPENDIR request
+ *
+ * @param req request returned by uk_fuse_request_open_async()
+ * @param[out] fh file handle
+ * @return int
+ */
+int uk_fuse_reply_open(struct uk_fuse_req *req, uint64_t *fh)
+{
+	FUSE_OPEN_IN *open_in;
+	FUSE_OPEN_OUT *open_out;
+
+	UK_ASSERT(req);
+	UK_ASSERT(fh);
+	UK_ASSERT(UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED);
+
+	if (req->rc)
+		return req->rc;
+
+	open_out = req->out_buffer;
+	*fh = open_out->open.fh;
+
+	/* Close-to-open consistency, unless the device knows better */
+	open_in = req->in_buffer;
+	if (req->_dev && open_in->hdr.opcode == FUSE_OPEN
+	    && !(open_out->open.open_flags & FOPEN_KEEP_CACHE))
+		uk_fuse_pcache_invalidate(req->_dev, open_in->hdr.nodeid, 0,
+					  UINT64_MAX);
+	return 0;
+}
+
 /**
  * @brief
  *
@@ -1180,88 +2479,246 @@ int uk_fuse_request_open(struct uk_fuse_dev *dev, bool is_dir,
 			 uint64_t nodeid, uint32_t flags, uint64_t *fh)
 {
 	int rc = 0;
-	FUSE_OPEN_IN open_in = {0};
-	FUSE_OPEN_OUT open_out = {0};
 	struct uk_fuse_req *req;
 
-	UK_ASSERT(dev);
 	UK_ASSERT(fh);
 
-	FUSE_HEADER_INIT(&open_in.hdr, is_dir ? FUSE_OPENDIR : FUSE_OPEN,
-		nodeid, sizeof(open_in.open));
+	req = uk_fuse_request_open_async(dev, is_dir, nodeid, flags,
+					 NULL, NULL);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
 
-	/* TODOFS: think of flags */
-	open_in.open.flags = is_dir ? (O_RDONLY | O_DIRECTORY)
-		: flags;
+	if (!(rc = uk_fusereq_waitreply(req)))
+		rc = uk_fuse_reply_open(req, fh);
 
-	req = uk_fusedev_req_create(dev);
+	uk_fusedev_req_remove(dev, req);
+	return rc;
+}
+
+/**
+ * @brief asynchronous version of uk_fuse_request_lookup()
+ *
+ * The nodeid is retrieved from the reply with uk_fuse_reply_lookup().
+ *
+ * @param dev
+ * @param dir_nodeid
+ * @param filename
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_lookup_async(struct uk_fuse_dev *dev,
+						 uint64_t dir_nodeid,
+						 const char *filename,
+						 uk_fusereq_done_t done,
+						 void *done_arg)
+{
+	FUSE_LOOKUP_IN *lookup_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(filename);
+
+	if (strlen(filename) > NAME_MAX) {
+		uk_pr_err("Filename is larger than %d characters\n", NAME_MAX);
+		return ERR2PTR(-ENAMETOOLONG);
+	}
+
+	req = fuse_req_create_bufs(dev, sizeof(*lookup_in),
+				   sizeof(FUSE_LOOKUP_OUT));
 	if (PTRISERR(req))
-		return PTR2ERR(req);
+		return req;
 
-	req->in_buffer = &open_in;
-	req->in_buffer_size = sizeof(open_in);
-	req->out_buffer = &open_out;
-	req->out_buffer_size = sizeof(open_out);
+	lookup_in = req->in_buffer;
+	FUSE_HEADER_INIT(&lookup_in->hdr, FUSE_LOOKUP,
+		 dir_nodeid, strlen(filename) + 1);
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
+	strcpy(lookup_in->name, filename);
 
-	*fh = open_out.open.fh;
+	return fuse_submit_async(dev, req, done, done_arg);
+}
 
-	uk_fusedev_req_remove(dev, req);
-	return 0;
+/**
+ * @brief retrieves the result of a completed FUSE_LOOKUP request
+ *
+ * The result is added to the lookup cache, including names, that do not
+ * exist.
+ *
+ * @param req request returned by uk_fuse_request_lookup_async()
+ * @param[out] nodeid
+ * @return int -ENOENT, if the name does not exist
+ */
+int uk_fuse_reply_lookup(struct uk_fuse_req *req, uint64_t *nodeid)
+{
+	FUSE_LOOKUP_IN *lookup_in;
+	FUSE_LOOKUP_OUT *lookup_out;
+	struct fuse_attr *attr;
+	struct uk_fuse_dev *dev;
+	int rc;
 
-free:
-	uk_fusedev_req_remove(dev, req);
-	return rc;
+	UK_ASSERT(req);
+	UK_ASSERT(nodeid);
+	UK_ASSERT(UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED);
+
+	dev = req->_dev;
+	lookup_in = req->in_buffer;
+
+	if (req->rc) {
+		if (req->rc == -ENOENT && dev)
+			uk_fuse_dentry_add(dev, lookup_in->hdr.nodeid,
+					   lookup_in->name, 0,
+					   ukarch_time_msec_to_nsec(
+						   dev->neg_entry_ms));
+		return req->rc;
+	}
+
+	lookup_out = req->out_buffer;
+	attr = &lookup_out->entry.attr;
+	uk_pr_debug("FUSE_LOOKUP: attr = {nodeid=%" __PRIu64 " ino=%" __PRIu64
+		" size=%" __PRIu64 "}\n",
+		lookup_out->entry.nodeid, attr->ino, attr->size);
+
+	*nodeid = lookup_out->entry.nodeid;
+
+	if (!dev)
+		return *nodeid ? 0 : -ENOENT;
+
+	/* Negative entry (nodeid 0), which is not a lookup */
+	if (!*nodeid) {
+		fuse_dentry_entry(dev, lookup_in->hdr.nodeid, lookup_in->name,
+				  &lookup_out->entry);
+		return -ENOENT;
+	}
+
+	if ((rc = fuse_node_lookup(dev, lookup_in->hdr.nodeid,
+				   &lookup_out->entry)))
+		return rc;
+
+	fuse_dentry_entry(dev, lookup_in->hdr.nodeid, lookup_in->name,
+			  &lookup_out->entry);
+	return 0;
 }
 
+/**
+ * @brief looks up @p filename in the directory @p dir_nodeid
+ *
+ * Unless dev->dentry_max is 0, cached results are used without a request.
+ * Such a lookup does not add to the lookup count of the node on the device.
+ * Either way, the node is held (see uk_fuse_node_hold()) and its lookups have
+ * to be forgotten by the caller with uk_fuse_request_forget().
+ *
+ * @param dev
+ * @param dir_nodeid
+ * @param filename
+ * @param[out] nodeid
+ * @return int -ENOENT, if the name does not exist
+ */
+
 int uk_fuse_request_lookup(struct uk_fuse_dev *dev, uint64_t dir_nodeid,
 		   const char *filename, uint64_t *nodeid)
 {
 	int rc = 0;
-	FUSE_LOOKUP_IN lookup_in = {0};
-	FUSE_LOOKUP_OUT lookup_out = {0};
 	struct uk_fuse_req *req;
-	struct fuse_attr *attr;
 
 	UK_ASSERT(dev);
 	UK_ASSERT(filename);
+	UK_ASSERT(nodeid);
 
-	FUSE_HEADER_INIT(&lookup_in.hdr, FUSE_LOOKUP,
-		 dir_nodeid, strlen(filename) + 1);
+	if (dev->dentry_max
+	    && !uk_fuse_dentry_lookup(dev, dir_nodeid, filename, nodeid)) {
+		if (!*nodeid)
+			return -ENOENT;
+		if (!uk_fuse_node_hold(dev, *nodeid))
+			return 0;
+		/* The node has been evicted meanwhile */
+		uk_fuse_dentry_remove(dev, dir_nodeid, filename);
+	}
+
+	do {
+		req = uk_fuse_request_lookup_async(dev, dir_nodeid, filename,
+						   NULL, NULL);
+		if (PTRISERR(req))
+			return PTR2ERR(req);
 
-	strcpy(lookup_in.name, filename);
+		rc = uk_fusereq_waitreply(req);
+		if (!rc || rc == -ENOENT)
+			rc = uk_fuse_reply_lookup(req, nodeid);
 
-	req = uk_fusedev_req_create(dev);
+		uk_fusedev_req_remove(dev, req);
+		/* Retry, if the node has been evicted meanwhile */
+	} while (!rc && uk_fuse_node_hold(dev, *nodeid));
+
+	return rc;
+}
+
+/**
+ * @brief asynchronous version of uk_fuse_request_get_attr()
+ *
+ * The attributes are retrieved from the reply with uk_fuse_reply_get_attr().
+ *
+ * @param dev
+ * @param nodeid
+ * @param file_handle
+ * @param done completion callback. If NULL, wait for the reply with
+ * uk_fusereq_waitreply().
+ * @param done_arg
+ * @return struct uk_fuse_req* the submitted request or an error pointer
+ */
+struct uk_fuse_req *uk_fuse_request_get_attr_async(struct uk_fuse_dev *dev,
+						   uint64_t nodeid,
+						   uint64_t file_handle,
+						   uk_fusereq_done_t done,
+						   void *done_arg)
+{
+	FUSE_GETATTR_IN *getattr_in;
+	struct uk_fuse_req *req;
+
+	UK_ASSERT(dev);
+
+	req = fuse_req_create_bufs(dev, sizeof(*getattr_in),
+				   sizeof(FUSE_GETATTR_OUT));
 	if (PTRISERR(req))
-		return PTR2ERR(req);
+		return req;
 
-	/* TODOFS: macro this */
-	req->in_buffer = &lookup_in;
-	req->in_buffer_size = sizeof(lookup_in);
-	req->out_buffer = &lookup_out;
-	req->out_buffer_size = sizeof(lookup_out);
+	getattr_in = req->in_buffer;
+	FUSE_HEADER_INIT(&getattr_in->hdr, FUSE_GETATTR, nodeid,
+			  sizeof(getattr_in->getattr));
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
+	if (file_handle != INVALID_FILE_HANDLE) {
+		getattr_in->getattr.fh = file_handle;
+		getattr_in->getattr.getattr_flags |= FUSE_GETATTR_FH;
+	}
 
+	return fuse_submit_async(dev, req, done, done_arg);
+}
 
-	attr = &lookup_out.entry.attr;
-	uk_pr_debug("FUSE_LOOKUP: attr = {nodeid=%" __PRIu64 " ino=%" __PRIu64
-		" size=%" __PRIu64 "}\n",
-		lookup_out.entry.nodeid, attr->ino, attr->size);
+/**
+ * @brief retrieves the result of a completed FUSE_GETATTR request
+ *
+ * @param req request returned by uk_fuse_request_get_attr_async()
+ * @param[out] attr
+ * @return int
+ */
+int uk_fuse_reply_get_attr(struct uk_fuse_req *req, struct fuse_attr *attr)
+{
+	struct fuse_attr_out *attr_out;
 
-	*nodeid = lookup_out.entry.nodeid;
+	UK_ASSERT(req);
+	UK_ASSERT(attr);
+	UK_ASSERT(UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED);
 
-	// TODOFS: increment nlookup
+	if (req->rc)
+		return req->rc;
 
-	uk_fusedev_req_remove(dev, req);
-	return 0;
+	attr_out = &((FUSE_GETATTR_OUT *) req->out_buffer)->attr;
+	*attr = attr_out->attr;
 
-free:
-	uk_fusedev_req_remove(dev, req);
-	return rc;
+	if (req->_dev)
+		uk_fuse_node_set_attr(req->_dev,
+			((FUSE_GETATTR_IN *) req->in_buffer)->hdr.nodeid,
+			attr, attr_out->attr_valid, attr_out->attr_valid_nsec);
+	return 0;
 }
 
 /**
@@ -1276,6 +2733,9 @@ free:
  * or, if the FUSE_GETATTR_FH flag is set, by the file handle fh.
  * The latter case of operation is analogous to fstat(2).
  *
+ * Unless dev->attr_cache is UK_FUSE_ATTR_CACHE_OFF, attributes, that are
+ * still valid, are served from the attribute cache without a request.
+ *
  * @param dev
  * @param nodeid
  * @param file_handle
@@ -1286,42 +2746,29 @@ int uk_fuse_request_get_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
 		     uint64_t file_handle, struct fuse_attr *attr)
 {
 	int rc = 0;
-	FUSE_GETATTR_IN getattr_in = {0};
-	FUSE_GETATTR_OUT getattr_out = {0};
 	struct uk_fuse_req *req;
 
 	UK_ASSERT(dev);
 	UK_ASSERT(attr);
 
-	FUSE_HEADER_INIT(&getattr_in.hdr, FUSE_GETATTR, nodeid,
-			  sizeof(getattr_in.getattr));
-
-	if (file_handle != INVALID_FILE_HANDLE) {
-		getattr_in.getattr.fh = file_handle;
-		getattr_in.getattr.getattr_flags |= FUSE_GETATTR_FH;
-	}
-
-	/* TODOFS: macro this request creation */
-	req = uk_fusedev_req_create(dev);
-	if (PTRISERR(req))
-		return PTR2ERR(req);
-
-	req->in_buffer = &getattr_in;
-	req->in_buffer_size = sizeof(getattr_in);
-	req->out_buffer = &getattr_out;
-	req->out_buffer_size = sizeof(getattr_out);
+	if (dev->attr_cache == UK_FUSE_ATTR_CACHE_OFF
+	    || uk_fuse_node_get_attr(dev, nodeid, attr)) {
+		req = uk_fuse_request_get_attr_async(dev, nodeid, file_handle,
+						     NULL, NULL);
+		if (PTRISERR(req))
+			return PTR2ERR(req);
 
-	if ((rc = send_and_wait(dev, req)))
-		goto free;
+		if (!(rc = uk_fusereq_waitreply(req)))
+			rc = uk_fuse_reply_get_attr(req, attr);
 
-	*attr = getattr_out.attr.attr;
+		uk_fusedev_req_remove(dev, req);
+		if (rc)
+			return rc;
+	}
 
-	uk_fusedev_req_remove(dev, req);
+	/* The device does not know about dirty data yet */
+	attr->size = MAX(attr->size, uk_fuse_wb_size(dev, nodeid));
 	return 0;
-
-free:
-	uk_fusedev_req_remove(dev, req);
-	return rc;
 }
 
 int uk_fuse_request_init(struct uk_fuse_dev *dev)
@@ -1338,9 +2785,11 @@ sizeof(init_in.init));
 
 	init_in.init.major = FUSE_KERNEL_VERSION;
 	init_in.init.minor = FUSE_KERNEL_MINOR_VERSION;
-	init_in.init.max_readahead = 0;
+	init_in.init.max_readahead = dev->ra_max_pages * PAGE_SIZE_4k;
 	init_in.init.flags = FUSE_DO_READDIRPLUS | FUSE_MAX_PAGES
 		| FUSE_MAP_ALIGNMENT;
+	if (dev->wb_max_bytes)
+		init_in.init.flags |= FUSE_WRITEBACK_CACHE;
 
 	req = uk_fusedev_req_create(dev);
 	if (PTRISERR(req))
@@ -1355,6 +2804,8 @@ sizeof(init_in.init));
 		goto free;
 
 	dev->max_write = init_out.init.max_write;
+	dev->ra_max_pages = MIN(dev->ra_max_pages,
+				init_out.init.max_readahead / PAGE_SIZE_4k);
 	dev->max_pages = init_out.init.max_pages ?
 		init_out.init.max_pages : FUSE_DEFAULT_MAX_PAGES_PER_REQ;
 	if (init_out.init.flags & FUSE_MAP_ALIGNMENT)
@@ -1363,7 +2814,17 @@ sizeof(init_in.init));
 		dev->map_alignment = 4096; /*TODOFS: what would be the correct
 					     value here? */
 
+	/* The root is valid without a lookup */
+	if ((rc = uk_fuse_node_pin(dev, FUSE_ROOT_ID)))
+		goto free;
 
+	if (!(init_out.init.flags & FUSE_WRITEBACK_CACHE))
+		dev->wb_max_bytes = 0;
+	if (dev->wb_max_bytes && (rc = uk_fuse_wb_start(dev))) {
+		uk_pr_warn("Writeback cache disabled: %d\n", rc);
+		dev->wb_max_bytes = 0;
+		rc = 0;
+	}
 
 	uk_fusedev_req_remove(dev, req);
 	return 0;
@@ -1487,8 +2948,6 @@ int test_method() {
 	uk_pr_debug("Read %" __PRIu32 " bytes: '%s'\n", bytes_transferred,
 		    read_message);
 
-	add_fusedev(dev);
-
 	// if ((rc = uk_fuse_request_lseek(dev, fc.nodeid, fc.fh,
 	// 		3, SEEK_SET, &lseek_off))) {
 	// 	uk_pr_err("uk_fuse_request_read has failed \n");
@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Per-device cache of lookup results (dentries), keyed by the nodeid of the
+ * directory and the name looked up in it. Names, that do not exist, are
+ * cached as well (negative entries), so that repeated searches (e.g., along
+ * $PATH) do not go to the device.
+ *
+ * Positive entries do not hold a lookup of their node: they are only used as
+ * long as the node table still knows the node. As the device may hand out the
+ * nodeid of a forgotten node again, an entry also remembers the generations of
+ * its directory and node and is dropped, once either of them has changed.
+ */
+
+#include "uk/fuse_dentry.h"
+#include "uk/fuse_node.h"
+#include "uk/fusedev_core.h"
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/plat/spinlock.h>
+#include <uk/plat/time.h>
+#include <errno.h>
+#include <string.h>
+
+/* Minimum number of hash buckets */
+#define FUSE_DENTRY_MIN_BUCKETS	16
+
+static uint32_t fuse_dentry_hash(uint64_t parent, const char *name)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+
+	for (; *name; name++) {
+		h ^= (uint8_t) *name;
+		h *= 16777619u;
+	}
+	return h ^ (uint32_t) ((parent * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/* Generation of @p nodeid in the node table, 0 if it is not known */
+static uint64_t fuse_dentry_gen(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_node node;
+
+	if (uk_fuse_node_get(dev, nodeid, &node))
+		return 0;
+	return node.gen;
+}
+
+static struct uk_fuse_dentry *
+fuse_dentry_find_locked(struct uk_fuse_dentry_cache *c, uint64_t parent,
+			const char *name, uint32_t hashval)
+{
+	struct uk_fuse_dentry *d;
+
+	if (!c->buckets)
+		return NULL;
+
+	uk_hlist_for_each_entry(d, &c->buckets[hashval & (c->nbuckets - 1)],
+				hash) {
+		if (d->hashval == hashval && d->parent == parent
+		    && !strcmp(d->name, name))
+			return d;
+	}
+	return NULL;
+}
+
+static void fuse_dentry_unlink_locked(struct uk_fuse_dentry_cache *c,
+				      struct uk_fuse_dentry *d)
+{
+	uk_hlist_del(&d->hash);
+	uk_list_del(&d->lru);
+	c->count--;
+}
+
+void uk_fuse_dentry_cache_init(struct uk_fuse_dentry_cache *c)
+{
+	UK_ASSERT(c);
+
+	ukarch_spin_init(&c->spinlock);
+	c->buckets = NULL;
+	c->nbuckets = 0;
+	c->count = 0;
+	UK_INIT_LIST_HEAD(&c->lru);
+}
+
+void uk_fuse_dentry_cache_fini(struct uk_fuse_dev *dev)
+{
+	struct uk_fuse_dentry_cache *c;
+	struct uk_fuse_dentry *d, *tmp;
+
+	UK_ASSERT(dev);
+	c = &dev->_dentries;
+
+	uk_list_for_each_entry_safe(d, tmp, &c->lru, lru)
+		uk_free(dev->a, d);
+	if (c->buckets)
+		uk_free(dev->a, c->buckets);
+	uk_fuse_dentry_cache_init(c);
+}
+
+/**
+ * @brief looks up @p name in the directory @p parent in the cache
+ *
+ * Counts a hit or a miss of the cache (dev->dentry_hits,
+ * dev->dentry_misses).
+ *
+ * @param dev
+ * @param parent
+ * @param name
+ * @param[out] nodeid the node @p name refers to, 0 if it does not exist
+ * @return int 0 or -ENOENT, if no valid entry is cached
+ */
+int uk_fuse_dentry_lookup(struct uk_fuse_dev *dev, uint64_t parent,
+			  const char *name, uint64_t *nodeid)
+{
+	struct uk_fuse_dentry_cache *c;
+	struct uk_fuse_dentry *d;
+	uint64_t parent_gen, gen;
+	unsigned long flags;
+	uint32_t hashval;
+	__nsec now;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(name);
+	UK_ASSERT(nodeid);
+	c = &dev->_dentries;
+
+	hashval = fuse_dentry_hash(parent, name);
+	now = ukplat_monotonic_clock();
+
+	ukplat_spin_lock_irqsave(&c->spinlock, flags);
+	d = fuse_dentry_find_locked(c, parent, name, hashval);
+	if (!d || d->expiry <= now) {
+		ukplat_spin_unlock_irqrestore(&c->spinlock, flags);
+		goto miss;
+	}
+	uk_list_del(&d->lru);
+	uk_list_add(&d->lru, &c->lru);
+	*nodeid = d->nodeid;
+	parent_gen = d->parent_gen;
+	gen = d->gen;
+	ukplat_spin_unlock_irqrestore(&c->spinlock, flags);
+
+	/* The nodes may have been forgotten and their nodeids reused since */
+	if (fuse_dentry_gen(dev, parent) != parent_gen
+	    || (*nodeid && fuse_dentry_gen(dev, *nodeid) != gen)) {
+		uk_fuse_dentry_remove(dev, parent, name);
+		goto miss;
+	}
+
+	ukarch_inc(&dev->dentry_hits);
+	return 0;
+
+miss:
+	ukarch_inc(&dev->dentry_misses);
+	return -ENOENT;
+}
+
+/**
+ * @brief caches the result of a lookup of @p name in the directory @p parent
+ *
+ * An entry cached for the name before is replaced. Nothing is cached, if
+ * @p ttl is 0, the cache is disabled (dev->dentry_max is 0) or @p parent or
+ * @p nodeid are not in the node table. Once
+ * dev->dentry_max entries are cached, the least recently used one is evicted.
+ *
+ * @param dev
+ * @param parent
+ * @param name
+ * @param nodeid the node @p name refers to, 0 if it does not exist
+ * @param ttl validity of the entry in nanoseconds
+ */
+void uk_fuse_dentry_add(struct uk_fuse_dev *dev, uint64_t parent,
+			const char *name, uint64_t nodeid, __nsec ttl)
+{
+	struct uk_fuse_dentry_cache *c;
+	struct uk_fuse_dentry *d, *old, *evicted = NULL;
+	struct uk_hlist_head *buckets = NULL;
+	uint32_t max, nbuckets = 0;
+	uint64_t parent_gen, gen;
+	unsigned long flags;
+	size_t len;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(name);
+	c = &dev->_dentries;
+
+	max = UK_READ_ONCE(dev->dentry_max);
+	if (!max || !ttl) {
+		uk_fuse_dentry_remove(dev, parent, name);
+		return;
+	}
+
+	/* Only nodes in the node table can be told apart from later ones */
+	parent_gen = fuse_dentry_gen(dev, parent);
+	gen = nodeid ? fuse_dentry_gen(dev, nodeid) : 0;
+	if (!parent_gen || (nodeid && !gen)) {
+		uk_fuse_dentry_remove(dev, parent, name);
+		return;
+	}
+
+	/* Allocate outside of the lock */
+	if (!UK_READ_ONCE(c->buckets)) {
+		nbuckets = FUSE_DENTRY_MIN_BUCKETS;
+		while (nbuckets < max)
+			nbuckets *= 2;
+		buckets = uk_calloc(dev->a, nbuckets, sizeof(*buckets));
+		if (!buckets)
+			return;
+	}
+
+	len = strlen(name);
+	d = uk_malloc(dev->a, sizeof(*d) + len + 1);
+	if (!d) {
+		/* Do not keep a stale entry */
+		uk_fuse_dentry_remove(dev, parent, name);
+		goto out;
+	}
+
+	memcpy(d->name, name, len + 1);
+	d->parent = parent;
+	d->nodeid = nodeid;
+	d->parent_gen = parent_gen;
+	d->gen = gen;
+	d->hashval = fuse_dentry_hash(parent, name);
+	if (ttl == UINT64_MAX)
+		d->expiry = UINT64_MAX;
+	else
+		d->expiry = ukplat_monotonic_clock() + ttl;
+
+	ukplat_spin_lock_irqsave(&c->spinlock, flags);
+	if (!c->buckets) {
+		c->buckets = buckets;
+		c->nbuckets = nbuckets;
+		buckets = NULL;
+	}
+
+	old = fuse_dentry_find_locked(c, parent, name, d->hashval);
+	if (old) {
+		fuse_dentry_unlink_locked(c, old);
+	} else if (c->count >= max) {
+		old = uk_list_last_entry(&c->lru, struct uk_fuse_dentry, lru);
+		fuse_dentry_unlink_locked(c, old);
+	}
+	evicted = old;
+
+	uk_hlist_add_head(&d->hash,
+			  &c->buckets[d->hashval & (c->nbuckets - 1)]);
+	uk_list_add(&d->lru, &c->lru);
+	c->count++;
+	ukplat_spin_unlock_irqrestore(&c->spinlock, flags);
+
+	if (evicted)
+		uk_free(dev->a, evicted);
+out:
+	if (buckets)
+		uk_free(dev->a, buckets);
+}
+
+/**
+ * @brief drops the cached result of a lookup of @p name in @p parent
+ *
+ * @param dev
+ * @param parent
+ * @param name
+ */
+void uk_fuse_dentry_remove(struct uk_fuse_dev *dev, uint64_t parent,
+			   const char *name)
+{
+	struct uk_fuse_dentry_cache *c;
+	struct uk_fuse_dentry *d;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(name);
+	c = &dev->_dentries;
+
+	ukplat_spin_lock_irqsave(&c->spinlock, flags);
+	d = fuse_dentry_find_locked(c, parent, name,
+				    fuse_dentry_hash(parent, name));
+	if (d)
+		fuse_dentry_unlink_locked(c, d);
+	ukplat_spin_unlock_irqrestore(&c->spinlock, flags);
+
+	if (d)
+		uk_free(dev->a, d);
+}
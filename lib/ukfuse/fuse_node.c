@@ -0,0 +1,617 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Per-device table of nodeids: the lookup count the device holds for every
+ * nodeid (see FUSE_FORGET), the directory it has been looked up in and its
+ * cached attributes.
+ *
+ * Slots are kept in one array (open addressing with linear probing), so that
+ * a lookup usually touches a single cache line. Nodes are copied in and out
+ * of the table, as the array moves when it grows.
+ */
+
+#include "uk/fuse_node.h"
+#include "uk/fuse_pcache.h"
+#include "uk/fusedev_core.h"
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/errptr.h>
+#include <uk/plat/spinlock.h>
+#include <uk/plat/time.h>
+#include <uk/arch/time.h>
+#include <errno.h>
+#include <string.h>
+
+/* Initial number of slots */
+#define FUSE_NODE_TABLE_MIN_SIZE	64
+/* Marks a free slot. FUSE does not use nodeid 0. */
+#define FUSE_NODE_EMPTY			0
+/* Marks the slot of a removed node */
+#define FUSE_NODE_TOMBSTONE		((uint64_t) -1)
+
+static inline uint32_t fuse_node_hash(uint64_t nodeid, uint32_t size)
+{
+	/* Nodeids are often pointers on the host (e.g., virtiofsd), so the
+	   low bits alone do not spread well. */
+	return (uint32_t) ((nodeid * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+static struct uk_fuse_node *fuse_node_find_locked(struct uk_fuse_node_table *t,
+						  uint64_t nodeid)
+{
+	uint32_t i;
+
+	if (!t->size)
+		return NULL;
+
+	for (i = fuse_node_hash(nodeid, t->size);
+	     t->slots[i].nodeid != FUSE_NODE_EMPTY;
+	     i = (i + 1) & (t->size - 1)) {
+		if (t->slots[i].nodeid == nodeid)
+			return &t->slots[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief takes a slot for @p nodeid, which is not in the table yet
+ *
+ * There has to be room for it (see fuse_node_has_room_locked()).
+ */
+static struct uk_fuse_node *
+fuse_node_insert_locked(struct uk_fuse_node_table *t, uint64_t nodeid)
+{
+	struct uk_fuse_node *n;
+	uint32_t i;
+
+	for (i = fuse_node_hash(nodeid, t->size);
+	     t->slots[i].nodeid != FUSE_NODE_EMPTY
+	     && t->slots[i].nodeid != FUSE_NODE_TOMBSTONE;
+	     i = (i + 1) & (t->size - 1))
+		;
+
+	n = &t->slots[i];
+	if (n->nodeid == FUSE_NODE_TOMBSTONE)
+		t->tombstones--;
+	t->count++;
+
+	memset(n, 0, sizeof(*n));
+	n->nodeid = nodeid;
+	return n;
+}
+
+static void fuse_node_remove_locked(struct uk_fuse_node_table *t,
+				    struct uk_fuse_node *n)
+{
+	if (!n->held)
+		t->unheld--;
+	n->nodeid = FUSE_NODE_TOMBSTONE;
+	t->count--;
+	t->tombstones++;
+}
+
+/* Keeps probe sequences short: at most 3/4 of the slots are in use */
+static inline int fuse_node_has_room_locked(struct uk_fuse_node_table *t)
+{
+	return (t->count + t->tombstones + 1) * 4 <= t->size * 3;
+}
+
+/**
+ * @brief makes room in the table, if it still has @p old_size slots
+ *
+ * The slots are allocated without holding the lock. A table, that is full
+ * mostly of tombstones, is rehashed at the same size.
+ */
+static int fuse_node_grow(struct uk_fuse_dev *dev, uint32_t old_size)
+{
+	struct uk_fuse_node_table *t = &dev->_nodes;
+	struct uk_fuse_node *slots, *old, *n;
+	uint32_t size, i;
+	unsigned long flags;
+
+	if (!old_size)
+		size = FUSE_NODE_TABLE_MIN_SIZE;
+	else if ((UK_READ_ONCE(t->count) + 1) * 2 > old_size)
+		size = old_size * 2;
+	else
+		size = old_size;
+
+	slots = uk_calloc(dev->a, size, sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	if (t->size != old_size) {
+		/* Another thread has been faster */
+		ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+		uk_free(dev->a, slots);
+		return 0;
+	}
+
+	old = t->slots;
+	t->slots = slots;
+	t->size = size;
+	t->count = 0;
+	t->tombstones = 0;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].nodeid == FUSE_NODE_EMPTY
+		    || old[i].nodeid == FUSE_NODE_TOMBSTONE)
+			continue;
+		n = fuse_node_insert_locked(t, old[i].nodeid);
+		*n = old[i];
+	}
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	if (old)
+		uk_free(dev->a, old);
+	return 0;
+}
+
+/**
+ * @brief looks up @p nodeid and inserts it, if it is not in the table yet
+ *
+ * On success, the table lock is held and has to be released by the caller.
+ */
+static struct uk_fuse_node *fuse_node_get_locked(struct uk_fuse_dev *dev,
+						 uint64_t nodeid,
+						 unsigned long *flags)
+{
+	struct uk_fuse_node_table *t = &dev->_nodes;
+	struct uk_fuse_node *n;
+	uint32_t size;
+	int rc;
+
+	UK_ASSERT(nodeid != FUSE_NODE_EMPTY && nodeid != FUSE_NODE_TOMBSTONE);
+
+	for (;;) {
+		ukplat_spin_lock_irqsave(&t->spinlock, *flags);
+		n = fuse_node_find_locked(t, nodeid);
+		if (n)
+			return n;
+		if (t->size && fuse_node_has_room_locked(t)) {
+			t->unheld++;
+			n = fuse_node_insert_locked(t, nodeid);
+			n->gen = ++t->gen;
+			return n;
+		}
+
+		size = t->size;
+		ukplat_spin_unlock_irqrestore(&t->spinlock, *flags);
+		if ((rc = fuse_node_grow(dev, size)))
+			return ERR2PTR(rc);
+	}
+}
+
+/**
+ * @brief updates the cached attributes of @p n
+ *
+ * @return bool true, if the contents of the file have changed according to
+ * the new attributes (size or modification time), so that its cached pages
+ * are stale
+ */
+static bool fuse_node_attr_locked(struct uk_fuse_dev *dev,
+				  struct uk_fuse_node *n,
+				  const struct fuse_attr *attr,
+				  uint64_t valid, uint32_t valid_nsec)
+{
+	bool changed;
+	__nsec ttl;
+
+	ttl = uk_fuse_timeout_nsec(valid, valid_nsec);
+	if (dev->attr_cache == UK_FUSE_ATTR_CACHE_RELAXED)
+		ttl = MAX(ttl, ukarch_time_msec_to_nsec(dev->attr_min_ms));
+
+	/* No attributes have been cached before, if ino is 0 */
+	changed = n->attr.ino
+		  && (n->attr.size != attr->size
+		      || n->attr.mtime != attr->mtime
+		      || n->attr.mtimensec != attr->mtimensec);
+
+	n->attr = *attr;
+	if (ttl == UINT64_MAX)
+		n->attr_expiry = UINT64_MAX;
+	else
+		n->attr_expiry = ukplat_monotonic_clock() + ttl;
+	return changed;
+}
+
+void uk_fuse_node_table_init(struct uk_fuse_node_table *t)
+{
+	UK_ASSERT(t);
+
+	ukarch_spin_init(&t->spinlock);
+	t->slots = NULL;
+	t->size = 0;
+	t->count = 0;
+	t->tombstones = 0;
+	t->unheld = 0;
+	t->evict_pos = 0;
+	t->gen = 0;
+}
+
+void uk_fuse_node_table_fini(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+	if (dev->_nodes.slots)
+		uk_free(dev->a, dev->_nodes.slots);
+	uk_fuse_node_table_init(&dev->_nodes);
+}
+
+/**
+ * @brief records a lookup of a node, that the device has replied with
+ *
+ * Called for every reply, which increments the lookup count on the device
+ * (FUSE_LOOKUP, FUSE_CREATE, FUSE_MKDIR, FUSE_READDIRPLUS, ...).
+ *
+ * @param dev
+ * @param parent directory, the node has been looked up in
+ * @param entry
+ * @return int the lookup count of the node or a negative error code, in
+ * which case the lookup has not been recorded. 0 for negative entries
+ * (nodeid 0), which do not count as lookup.
+ */
+int uk_fuse_node_lookup_add(struct uk_fuse_dev *dev, uint64_t parent,
+			    const struct fuse_entry_out *entry)
+{
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	uint64_t nlookup;
+	bool changed;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(entry);
+
+	if (entry->nodeid == FUSE_NODE_EMPTY)
+		return 0;
+
+	n = fuse_node_get_locked(dev, entry->nodeid, &flags);
+	if (PTRISERR(n))
+		return PTR2ERR(n);
+
+	n->nlookup++;
+	n->parent = parent;
+	changed = fuse_node_attr_locked(dev, n, &entry->attr,
+					entry->attr_valid,
+					entry->attr_valid_nsec);
+	nlookup = n->nlookup;
+	ukplat_spin_unlock_irqrestore(&dev->_nodes.spinlock, flags);
+
+	if (changed)
+		uk_fuse_pcache_invalidate(dev, entry->nodeid, 0, UINT64_MAX);
+
+	return (int) MIN(nlookup, (uint64_t) INT32_MAX);
+}
+
+/**
+ * @brief records @p nodeid without a lookup
+ *
+ * Used for the root directory, which is valid without a lookup and never
+ * removed from the table.
+ *
+ * @param dev
+ * @param nodeid
+ * @return int
+ */
+int uk_fuse_node_pin(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_node *n;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+
+	n = fuse_node_get_locked(dev, nodeid, &flags);
+	if (PTRISERR(n))
+		return PTR2ERR(n);
+	if (!n->held) {
+		n->held = true;
+		dev->_nodes.unheld--;
+	}
+	ukplat_spin_unlock_irqrestore(&dev->_nodes.spinlock, flags);
+
+	return 0;
+}
+
+/**
+ * @brief marks @p nodeid as held by a user, which forgets its lookups later
+ * on (e.g., a vnode)
+ *
+ * Nodes, that are not held, have been looked up without a user asking for
+ * them (e.g., the entries of FUSE_READDIRPLUS). They are evicted by
+ * uk_fuse_node_evict().
+ *
+ * @param dev
+ * @param nodeid
+ * @return int 0 or -ENOENT, if the node is not in the table (anymore)
+ */
+int uk_fuse_node_hold(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	int rc = 0;
+
+	UK_ASSERT(dev);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (!n)
+		rc = -ENOENT;
+	else if (!n->held) {
+		n->held = true;
+		t->unheld--;
+	}
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	return rc;
+}
+
+/**
+ * @brief removes nodes, that are not held, until at most @p max of them are
+ * left
+ *
+ * The slots are visited round-robin, starting where the last eviction has
+ * stopped, so that recently recorded nodes are likely to stay a while.
+ *
+ * @param dev
+ * @param max
+ * @param[out] forgets nodeids and lookup counts of the removed nodes, which
+ * have to be forgotten on the device
+ * @param cnt capacity of @p forgets
+ * @return uint32_t number of removed nodes
+ */
+uint32_t uk_fuse_node_evict(struct uk_fuse_dev *dev, uint32_t max,
+			    struct fuse_forget_one *forgets, uint32_t cnt)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	uint32_t i, evicted = 0;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(forgets || !cnt);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	for (i = 0; i < t->size && t->unheld > max && evicted < cnt; i++) {
+		n = &t->slots[t->evict_pos];
+		t->evict_pos = (t->evict_pos + 1) & (t->size - 1);
+		if (n->nodeid == FUSE_NODE_EMPTY
+		    || n->nodeid == FUSE_NODE_TOMBSTONE || n->held)
+			continue;
+
+		forgets[evicted].nodeid = n->nodeid;
+		forgets[evicted].nlookup = n->nlookup;
+		evicted++;
+		fuse_node_remove_locked(t, n);
+	}
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	return evicted;
+}
+
+/**
+ * @brief drops up to @p nlookup lookups of @p nodeid
+ *
+ * A node, whose lookup count drops to 0, is removed from the table. More
+ * lookups than recorded are never dropped, so that a node is not forgotten
+ * twice.
+ *
+ * @param dev
+ * @param nodeid
+ * @param nlookup
+ * @return uint64_t number of lookups to be forgotten on the device
+ */
+uint64_t uk_fuse_node_forget(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t nlookup)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (!n) {
+		nlookup = 0;
+		goto out;
+	}
+
+	nlookup = MIN(nlookup, n->nlookup);
+	n->nlookup -= nlookup;
+	if (!n->nlookup && nodeid != FUSE_ROOT_ID)
+		fuse_node_remove_locked(t, n);
+out:
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+	return nlookup;
+}
+
+/**
+ * @brief caches the attributes of a node in the table
+ *
+ * Nodes, that are not in the table, are ignored, as their nodeid may be
+ * reused by the device anytime. The cached pages of the node are dropped, if
+ * its size or modification time have changed.
+ *
+ * @param dev
+ * @param nodeid
+ * @param attr
+ * @param valid validity of @p attr in seconds...
+ * @param valid_nsec ...plus nanoseconds
+ */
+void uk_fuse_node_set_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
+			   const struct fuse_attr *attr, uint64_t valid,
+			   uint32_t valid_nsec)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	bool changed = false;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(attr);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (n)
+		changed = fuse_node_attr_locked(dev, n, attr, valid,
+						valid_nsec);
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	if (changed)
+		uk_fuse_pcache_invalidate(dev, nodeid, 0, UINT64_MAX);
+}
+
+/**
+ * @brief copies the entry of @p nodeid out of the table
+ *
+ * @param dev
+ * @param nodeid
+ * @param[out] node
+ * @return int 0 or -ENOENT, if the node is not in the table
+ */
+int uk_fuse_node_get(struct uk_fuse_dev *dev, uint64_t nodeid,
+		     struct uk_fuse_node *node)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	int rc = 0;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(node);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (n)
+		*node = *n;
+	else
+		rc = -ENOENT;
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	return rc;
+}
+
+/**
+ * @brief copies the cached attributes of @p nodeid, if they are still valid
+ *
+ * Counts a hit or a miss of the attribute cache (dev->attr_hits,
+ * dev->attr_misses).
+ *
+ * @param dev
+ * @param nodeid
+ * @param[out] attr
+ * @return int 0 or -ENOENT, if no valid attributes are cached
+ */
+int uk_fuse_node_get_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
+			  struct fuse_attr *attr)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+	__nsec now;
+	int rc = 0;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(attr);
+	t = &dev->_nodes;
+
+	now = ukplat_monotonic_clock();
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (n && n->attr_expiry > now) {
+		*attr = n->attr;
+		dev->attr_hits++;
+	} else {
+		dev->attr_misses++;
+		rc = -ENOENT;
+	}
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+
+	return rc;
+}
+
+/**
+ * @brief drops the cached attributes of @p nodeid
+ *
+ * @param dev
+ * @param nodeid
+ */
+void uk_fuse_node_invalidate_attr(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (n)
+		n->attr_expiry = 0;
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+}
+
+/**
+ * @brief grows the cached size of @p nodeid to at least @p size
+ *
+ * Used for writes in relaxed mode. The timestamps are left as they are, as
+ * the device sets them with its own clock.
+ *
+ * @param dev
+ * @param nodeid
+ * @param size
+ */
+void uk_fuse_node_extend_size(struct uk_fuse_dev *dev, uint64_t nodeid,
+			      uint64_t size)
+{
+	struct uk_fuse_node_table *t;
+	struct uk_fuse_node *n;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+	t = &dev->_nodes;
+
+	ukplat_spin_lock_irqsave(&t->spinlock, flags);
+	n = fuse_node_find_locked(t, nodeid);
+	if (n && n->attr_expiry && n->attr.size < size) {
+		n->attr.size = size;
+		n->attr.blocks = DIV_ROUND_UP(size, 512);
+	}
+	ukplat_spin_unlock_irqrestore(&t->spinlock, flags);
+}
@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Notifications sent by the device (FUSE_NOTIFY_*).
+ *
+ * The device pushes notifications on a transport channel of their own
+ * (the notification virtqueue of virtio-fs), whenever files change on the
+ * host. They keep the caches coherent without short validity times:
+ *  - FUSE_NOTIFY_INVAL_INODE drops the attributes and a range of the pages
+ *    of a file,
+ *  - FUSE_NOTIFY_INVAL_ENTRY and FUSE_NOTIFY_DELETE drop a lookup,
+ *  - FUSE_NOTIFY_STORE puts data into the page cache.
+ *
+ * The transport calls uk_fuse_notify_wakeup() when notifications have
+ * arrived, which may be from interrupt context. They are then retrieved
+ * with the notify_poll operation of the transport, which hands each one to
+ * uk_fuse_notify(), by a worker thread (or by the next request without
+ * LIBUKSCHED), since dropping cached data frees memory.
+ */
+
+#include "uk/fuse_notify.h"
+#include "uk/fuse.h"
+#include "uk/fuse_dentry.h"
+#include "uk/fuse_node.h"
+#include "uk/fuse_pcache.h"
+#include "uk/fusedev.h"
+#include "uk/fusedev_core.h"
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/arch/atomic.h>
+#if CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/wait.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#if CONFIG_LIBUKSCHED
+static void fuse_notify_worker(void *arg)
+{
+	struct uk_fuse_dev *dev = arg;
+	struct uk_fuse_notify *n = &dev->_notify;
+
+	for (;;) {
+		uk_waitq_wait_event(&n->wq, UK_READ_ONCE(n->pending)
+					    || UK_READ_ONCE(n->stop));
+		if (UK_READ_ONCE(n->stop))
+			break;
+
+		uk_fuse_notify_process(dev);
+	}
+}
+#endif
+
+void uk_fuse_notify_init(struct uk_fuse_notify *n)
+{
+	UK_ASSERT(n);
+
+	n->pending = false;
+#if CONFIG_LIBUKSCHED
+	uk_waitq_init(&n->wq);
+	n->worker = NULL;
+	n->stop = false;
+#endif
+}
+
+/**
+ * @brief starts the worker thread of @p dev
+ *
+ * Called once the device is connected, if the transport delivers
+ * notifications.
+ *
+ * @param dev
+ * @return int
+ */
+int uk_fuse_notify_start(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+	if (!dev->ops->notify_poll)
+		return 0;
+
+#if CONFIG_LIBUKSCHED
+	if (dev->_notify.worker)
+		return 0;
+
+	dev->_notify.stop = false;
+	dev->_notify.worker = uk_thread_create("fuse-notify",
+					       fuse_notify_worker, dev);
+	if (!dev->_notify.worker)
+		return -ENOMEM;
+#endif
+	/* Notifications received before are retrieved right away */
+	uk_fuse_notify_wakeup(dev);
+	return 0;
+}
+
+/**
+ * @brief stops the worker thread
+ *
+ * Has to be called before the transport is disconnected.
+ *
+ * @param dev
+ */
+void uk_fuse_notify_fini(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+#if CONFIG_LIBUKSCHED
+	if (dev->_notify.worker) {
+		UK_WRITE_ONCE(dev->_notify.stop, true);
+		uk_waitq_wake_up(&dev->_notify.wq);
+		uk_thread_wait(dev->_notify.worker);
+		dev->_notify.worker = NULL;
+	}
+#endif
+	UK_WRITE_ONCE(dev->_notify.pending, false);
+}
+
+/**
+ * @brief tells, that notifications have arrived
+ *
+ * Called by the transport, also from interrupt context.
+ *
+ * @param dev
+ */
+void uk_fuse_notify_wakeup(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+	UK_WRITE_ONCE(dev->_notify.pending, true);
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&dev->_notify.wq);
+#endif
+}
+
+/**
+ * @brief retrieves and processes the pending notifications
+ *
+ * @param dev
+ */
+void uk_fuse_notify_process(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+	if (!UK_READ_ONCE(dev->_notify.pending))
+		return;
+
+	/* Notifications arriving meanwhile set it again */
+	UK_WRITE_ONCE(dev->_notify.pending, false);
+	dev->ops->notify_poll(dev);
+}
+
+/**
+ * @brief returns the NUL-terminated name following the notification @p out
+ * of @p size bytes, or NULL if it is malformed
+ */
+static const char *fuse_notify_name(const void *buf, uint32_t len,
+				    uint32_t size, uint32_t namelen)
+{
+	const char *name = (const char *) buf + sizeof(struct fuse_out_header)
+			   + size;
+
+	if (namelen > NAME_MAX
+	    || len < sizeof(struct fuse_out_header) + size + namelen + 1
+	    || name[namelen] != '\0')
+		return NULL;
+	return name;
+}
+
+static int fuse_notify_inval_inode(struct uk_fuse_dev *dev,
+				   const struct fuse_notify_inval_inode_out *in)
+{
+	uk_fuse_node_invalidate_attr(dev, in->ino);
+
+	/* A negative offset only invalidates the attributes */
+	if (in->off >= 0)
+		uk_fuse_pcache_invalidate(dev, in->ino, in->off,
+					  in->len > 0 ? (uint64_t) in->len
+						      : UINT64_MAX);
+	return 0;
+}
+
+/**
+ * @brief processes one notification
+ *
+ * Called by the notify_poll operation of the transport for every
+ * notification retrieved.
+ *
+ * @param dev
+ * @param buf notification, starting with its struct fuse_out_header
+ * @param len number of bytes received
+ * @return int -EINVAL, if the notification is malformed, -ENOSYS if it is
+ * not supported
+ */
+int uk_fuse_notify(struct uk_fuse_dev *dev, const void *buf, uint32_t len)
+{
+	const struct fuse_out_header *hdr = buf;
+	const void *arg = hdr + 1;
+	const struct fuse_notify_inval_entry_out *entry;
+	const struct fuse_notify_delete_out *del;
+	const struct fuse_notify_store_out *store;
+	const char *name;
+	uint32_t size;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(buf);
+
+	/* Notifications have no unique and the code in the error field */
+	if (len < sizeof(*hdr) || hdr->unique != 0 || len < hdr->len
+	    || hdr->len < sizeof(*hdr))
+		return -EINVAL;
+
+	len = hdr->len;
+	size = len - sizeof(*hdr);
+	ukarch_inc(&dev->notifies);
+
+	switch (hdr->error) {
+	case FUSE_NOTIFY_INVAL_INODE:
+		if (size < sizeof(struct fuse_notify_inval_inode_out))
+			return -EINVAL;
+		return fuse_notify_inval_inode(dev, arg);
+
+	case FUSE_NOTIFY_INVAL_ENTRY:
+		if (size < sizeof(*entry))
+			return -EINVAL;
+		entry = arg;
+		name = fuse_notify_name(buf, len, sizeof(*entry),
+					entry->namelen);
+		if (!name)
+			return -EINVAL;
+
+		uk_fuse_dentry_remove(dev, entry->parent, name);
+		uk_fuse_node_invalidate_attr(dev, entry->parent);
+		return 0;
+
+	case FUSE_NOTIFY_DELETE:
+		if (size < sizeof(*del))
+			return -EINVAL;
+		del = arg;
+		name = fuse_notify_name(buf, len, sizeof(*del), del->namelen);
+		if (!name)
+			return -EINVAL;
+
+		uk_fuse_dentry_remove(dev, del->parent, name);
+		uk_fuse_node_invalidate_attr(dev, del->parent);
+		/* The number of links of the child has changed */
+		uk_fuse_node_invalidate_attr(dev, del->child);
+		return 0;
+
+	case FUSE_NOTIFY_STORE:
+		if (size < sizeof(*store))
+			return -EINVAL;
+		store = arg;
+		if (size - sizeof(*store) < store->size)
+			return -EINVAL;
+
+		uk_fuse_node_extend_size(dev, store->nodeid,
+					 store->offset + store->size);
+		return uk_fuse_pcache_store(dev, store->nodeid, store->offset,
+					    store->size, store + 1);
+
+	default:
+		/* FUSE_NOTIFY_RETRIEVE would have to be replied to */
+		uk_pr_debug("Ignoring notification %d\n", (int) hdr->error);
+		return -ENOSYS;
+	}
+}
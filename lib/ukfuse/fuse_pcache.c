@@ -0,0 +1,817 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Per-device page cache of FUSE files.
+ *
+ * Pages are read in extents of consecutive pages, one FUSE_READ request
+ * each, directly into the buffer of the extent (zero-copy). Pages are looked
+ * up in one hash table keyed by nodeid and page index, like the node table
+ * and the lookup cache, and evicted least recently used first, once
+ * dev->pcache_max_pages are cached.
+ *
+ * Reads are not waited for when they are submitted: a page stays not up to
+ * date, until a reader needs it or the reply is reaped by a later call.
+ * Sequential reads are detected per open file (struct uk_fuse_ra_state) and
+ * read ahead in windows, which double up to dev->ra_max_pages.
+ */
+
+#include "uk/fuse_pcache.h"
+#include "uk/fuse.h"
+#include "uk/fuse_node.h"
+#include "uk/fuse_wb.h"
+#include "uk/fusedev.h"
+#include "uk/fusedev_core.h"
+#include "uk/fusereq.h"
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/errptr.h>
+#include <uk/arch/atomic.h>
+#include <uk/plat/spinlock.h>
+#include <errno.h>
+#include <string.h>
+
+#define FUSE_PCACHE_PAGE_SIZE		((uint32_t) PAGE_SIZE_4k)
+/* Minimum number of hash buckets */
+#define FUSE_PCACHE_MIN_BUCKETS		64
+/* Minimum size of the first readahead window (pages) */
+#define FUSE_RA_INIT_PAGES		4ULL
+/* Number of read requests released at once outside of the lock */
+#define FUSE_PCACHE_REAP_BATCH		8
+
+static inline uint32_t fuse_page_hash(uint64_t nodeid, uint64_t index)
+{
+	/* Consecutive pages of a file go to consecutive buckets */
+	return (uint32_t) ((nodeid * 0x9E3779B97F4A7C15ULL) >> 32)
+	       + (uint32_t) index;
+}
+
+static struct uk_fuse_page *fuse_page_find_locked(struct uk_fuse_pcache *pc,
+						  uint64_t nodeid,
+						  uint64_t index)
+{
+	struct uk_fuse_page *p;
+
+	if (!pc->buckets)
+		return NULL;
+
+	uk_hlist_for_each_entry(p, &pc->buckets[fuse_page_hash(nodeid, index)
+						& (pc->nbuckets - 1)], hash) {
+		if (p->nodeid == nodeid && p->index == index)
+			return p;
+	}
+	return NULL;
+}
+
+static inline char *fuse_page_data(struct uk_fuse_page *p)
+{
+	return p->ext->buf + (p - p->ext->pages) * FUSE_PCACHE_PAGE_SIZE;
+}
+
+/**
+ * @brief drops a reference to @p ext
+ *
+ * Extents without references, which are not being read anymore, are put on
+ * @p gc to be freed outside of the lock.
+ */
+static void fuse_extent_put_locked(struct uk_fuse_extent *ext,
+				   struct uk_list_head *gc)
+{
+	UK_ASSERT(ext->refs);
+
+	if (!--ext->refs && !ext->req)
+		uk_list_add(&ext->list, gc);
+}
+
+static void fuse_page_remove_locked(struct uk_fuse_pcache *pc,
+				    struct uk_fuse_page *p,
+				    struct uk_list_head *gc)
+{
+	struct uk_fuse_extent *ext = p->ext;
+
+	uk_hlist_del(&p->hash);
+	uk_list_del(&p->lru);
+	pc->count--;
+	p->ext = NULL;
+	fuse_extent_put_locked(ext, gc);
+}
+
+static void fuse_pcache_gc(struct uk_fuse_dev *dev, struct uk_list_head *gc)
+{
+	struct uk_fuse_extent *ext, *tmp;
+
+	uk_list_for_each_entry_safe(ext, tmp, gc, list) {
+		uk_list_del(&ext->list);
+		uk_free(dev->a, ext->buf);
+		uk_free(dev->a, ext);
+	}
+}
+
+/**
+ * @brief processes the reply to the read request of @p ext
+ *
+ * Pages beyond the end of the file and pages of a failed read are removed.
+ *
+ * @return struct uk_fuse_req* the request, to be released by the caller
+ * outside of the lock
+ */
+static struct uk_fuse_req *
+fuse_extent_settle_locked(struct uk_fuse_pcache *pc, struct uk_fuse_extent *ext,
+			  struct uk_list_head *gc)
+{
+	struct uk_fuse_req *req = ext->req;
+	struct uk_fuse_page *p;
+	uint32_t off, i;
+	int rc;
+
+	rc = uk_fuse_reply_read(req, &ext->bytes);
+	if (rc)
+		ext->bytes = 0;
+
+	uk_list_del(&ext->list);
+	for (i = 0; i < ext->npages; i++) {
+		p = &ext->pages[i];
+		if (!p->ext)
+			continue; /* Not cached */
+
+		off = i * FUSE_PCACHE_PAGE_SIZE;
+		if (ext->bytes <= off) {
+			fuse_page_remove_locked(pc, p, gc);
+			continue;
+		}
+		p->len = MIN(ext->bytes - off, FUSE_PCACHE_PAGE_SIZE);
+		p->uptodate = true;
+	}
+
+	ext->req = NULL;
+	if (!ext->refs)
+		uk_list_add(&ext->list, gc);
+	return req;
+}
+
+/**
+ * @brief processes the replies of extents, that have been read meanwhile
+ */
+static void fuse_pcache_reap(struct uk_fuse_dev *dev)
+{
+	struct uk_fuse_pcache *pc = &dev->_pcache;
+	struct uk_fuse_req *reqs[FUSE_PCACHE_REAP_BATCH];
+	struct uk_fuse_extent *ext, *tmp;
+	unsigned long flags;
+	unsigned int n, i;
+	UK_LIST_HEAD(gc);
+
+	do {
+		n = 0;
+		ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+		uk_list_for_each_entry_safe(ext, tmp, &pc->inflight, list) {
+			if (UK_READ_ONCE(ext->req->state)
+			    != UK_FUSEREQ_RECEIVED)
+				continue;
+			reqs[n++] = fuse_extent_settle_locked(pc, ext, &gc);
+			if (n == ARRAY_SIZE(reqs))
+				break;
+		}
+		ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+		for (i = 0; i < n; i++)
+			uk_fusedev_req_remove(dev, reqs[i]);
+		fuse_pcache_gc(dev, &gc);
+	} while (n == ARRAY_SIZE(reqs));
+}
+
+/**
+ * @brief evicts least recently used pages, until @p npages more fit
+ *
+ * Pages being read are not evicted, so the cache may exceed its budget for
+ * a while.
+ */
+static void fuse_pcache_evict_locked(struct uk_fuse_dev *dev, uint32_t npages,
+				     struct uk_list_head *gc)
+{
+	struct uk_fuse_pcache *pc = &dev->_pcache;
+	struct uk_fuse_page *p, *tmp;
+
+	uk_list_for_each_entry_safe_reverse(p, tmp, &pc->lru, lru) {
+		if (pc->count + npages <= dev->pcache_max_pages)
+			break;
+		if (p->uptodate)
+			fuse_page_remove_locked(pc, p, gc);
+	}
+}
+
+/**
+ * @brief allocates the hash buckets, unless they have been allocated already
+ *
+ * @param[out] buckets NULL, if the buckets exist
+ * @param[out] nbuckets
+ * @return int 0 or -ENOMEM
+ */
+static int fuse_pcache_buckets_alloc(struct uk_fuse_dev *dev,
+				     struct uk_hlist_head **buckets,
+				     uint32_t *nbuckets)
+{
+	*buckets = NULL;
+	*nbuckets = 0;
+	if (UK_READ_ONCE(dev->_pcache.buckets))
+		return 0;
+
+	*nbuckets = FUSE_PCACHE_MIN_BUCKETS;
+	while (*nbuckets < dev->pcache_max_pages)
+		*nbuckets *= 2;
+	*buckets = uk_calloc(dev->a, *nbuckets, sizeof(**buckets));
+	return *buckets ? 0 : -ENOMEM;
+}
+
+/**
+ * @brief installs @p buckets, unless another thread has been faster
+ *
+ * @p buckets is set to NULL, if it has been installed. Otherwise, it has to
+ * be freed by the caller.
+ */
+static void fuse_pcache_buckets_install_locked(struct uk_fuse_pcache *pc,
+					       struct uk_hlist_head **buckets,
+					       uint32_t nbuckets)
+{
+	if (pc->buckets || !*buckets)
+		return;
+
+	pc->buckets = *buckets;
+	pc->nbuckets = nbuckets;
+	*buckets = NULL;
+}
+
+static struct uk_fuse_extent *fuse_extent_alloc(struct uk_fuse_dev *dev,
+						uint64_t index,
+						uint32_t npages)
+{
+	struct uk_fuse_extent *ext;
+
+	ext = uk_calloc(dev->a, 1,
+			sizeof(*ext) + npages * sizeof(struct uk_fuse_page));
+	if (!ext)
+		return NULL;
+	ext->buf = uk_memalign(dev->a, FUSE_PCACHE_PAGE_SIZE,
+			       npages * FUSE_PCACHE_PAGE_SIZE);
+	if (!ext->buf) {
+		uk_free(dev->a, ext);
+		return NULL;
+	}
+	ext->index = index;
+	ext->npages = npages;
+	return ext;
+}
+
+/**
+ * @brief caches page @p i of @p ext, which must not be cached yet
+ */
+static struct uk_fuse_page *fuse_page_insert_locked(struct uk_fuse_pcache *pc,
+						    struct uk_fuse_extent *ext,
+						    uint32_t i, uint64_t nodeid)
+{
+	struct uk_fuse_page *p = &ext->pages[i];
+
+	p->nodeid = nodeid;
+	p->index = ext->index + i;
+	p->ext = ext;
+	uk_hlist_add_head(&p->hash,
+			  &pc->buckets[fuse_page_hash(nodeid, p->index)
+				       & (pc->nbuckets - 1)]);
+	uk_list_add(&p->lru, &pc->lru);
+	pc->count++;
+	ext->refs++;
+	return p;
+}
+
+/**
+ * @brief submits the read of @p npages pages starting at @p index
+ *
+ * The pages are cached right away, but are not up to date before the reply
+ * has been processed. Pages, that have been cached in the meantime, are
+ * kept.
+ *
+ * @return int 0 or a negative error code
+ */
+static int fuse_extent_read(struct uk_fuse_dev *dev, uint64_t nodeid,
+			    uint64_t fh, uint64_t index, uint32_t npages)
+{
+	struct uk_fuse_pcache *pc = &dev->_pcache;
+	struct uk_hlist_head *buckets = NULL;
+	struct uk_fuse_extent *ext;
+	struct uk_fuse_req *req;
+	uint32_t nbuckets = 0, i;
+	unsigned long flags;
+	int rc = -ENOMEM;
+	UK_LIST_HEAD(gc);
+
+	/* Allocate outside of the lock */
+	if (fuse_pcache_buckets_alloc(dev, &buckets, &nbuckets))
+		return -ENOMEM;
+
+	ext = fuse_extent_alloc(dev, index, npages);
+	if (!ext)
+		goto err_free_buckets;
+
+	req = uk_fuse_request_read_async(dev, nodeid, fh,
+					 index * FUSE_PCACHE_PAGE_SIZE,
+					 npages * FUSE_PCACHE_PAGE_SIZE,
+					 ext->buf, NULL, NULL);
+	if (PTRISERR(req)) {
+		rc = PTR2ERR(req);
+		goto err_free_buf;
+	}
+
+	ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+	fuse_pcache_buckets_install_locked(pc, &buckets, nbuckets);
+
+	/* The device writes into the buffer until the reply is processed */
+	ext->req = req;
+	uk_list_add_tail(&ext->list, &pc->inflight);
+
+	fuse_pcache_evict_locked(dev, npages, &gc);
+	for (i = 0; i < npages; i++) {
+		if (!fuse_page_find_locked(pc, nodeid, index + i))
+			fuse_page_insert_locked(pc, ext, i, nodeid);
+	}
+	ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+	fuse_pcache_gc(dev, &gc);
+	if (buckets)
+		uk_free(dev->a, buckets);
+	return 0;
+
+err_free_buf:
+	uk_free(dev->a, ext->buf);
+	uk_free(dev->a, ext);
+err_free_buckets:
+	if (buckets)
+		uk_free(dev->a, buckets);
+	return rc;
+}
+
+/**
+ * @brief submits the reads of the pages of [@p index, @p index + @p npages),
+ * that are not cached, one extent per run of at most dev->max_pages pages
+ *
+ * @return int number of pages submitted or a negative error code
+ */
+static int fuse_pcache_fill(struct uk_fuse_dev *dev, uint64_t nodeid,
+			    uint64_t fh, uint64_t index, uint64_t npages)
+{
+	struct uk_fuse_pcache *pc = &dev->_pcache;
+	uint64_t end = index + npages, start;
+	uint32_t chunk = MAX(dev->max_pages, 1U);
+	unsigned long flags;
+	int rc, submitted = 0;
+
+	while (index < end) {
+		ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+		while (index < end && fuse_page_find_locked(pc, nodeid, index))
+			index++;
+		start = index;
+		while (index < end && index - start < chunk
+		       && !fuse_page_find_locked(pc, nodeid, index))
+			index++;
+		ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+		if (index == start)
+			break;
+		rc = fuse_extent_read(dev, nodeid, fh, start, index - start);
+		if (rc < 0)
+			return rc;
+		submitted += index - start;
+	}
+
+	return submitted;
+}
+
+/**
+ * @brief reads ahead, if @p ra shows, that the file is read sequentially
+ *
+ * A window of pages starting at the first sequential read is read ahead.
+ * Once a read reaches the middle of it (the marker), the next window of
+ * twice the size (up to dev->ra_max_pages) is read ahead, so that the
+ * following reads find their pages cached.
+ */
+static void fuse_pcache_readahead(struct uk_fuse_dev *dev, uint64_t nodeid,
+				  uint64_t fh, struct uk_fuse_ra_state *ra,
+				  uint64_t first, uint64_t npages)
+{
+	uint32_t max = UK_READ_ONCE(dev->ra_max_pages);
+	uint64_t last = first + npages - 1, end;
+	struct uk_fuse_node node;
+	int rc;
+
+	if (!max)
+		return;
+
+	if (first != ra->next
+	    && (first < ra->start || first >= ra->start + ra->size)) {
+		/* Random access, only the pages requested are read */
+		ra->size = 0;
+		return;
+	}
+
+	if (!ra->size || first >= ra->start + ra->size) {
+		ra->start = first;
+		ra->size = MAX(MIN(MAX(npages * 2, FUSE_RA_INIT_PAGES), max),
+			       npages);
+		ra->marker = ra->start + ra->size / 2;
+	} else if (last >= ra->marker) {
+		ra->start += ra->size;
+		ra->size = MIN(ra->size * 2, max);
+		ra->marker = ra->start;
+	} else {
+		return;
+	}
+
+	/* Do not read beyond the end of the file, if it is known */
+	end = ra->start + ra->size;
+	if (!uk_fuse_node_get(dev, nodeid, &node) && node.attr_expiry)
+		end = MIN(end, DIV_ROUND_UP(node.attr.size,
+					    FUSE_PCACHE_PAGE_SIZE));
+	if (end <= ra->start)
+		return;
+
+	rc = fuse_pcache_fill(dev, nodeid, fh, ra->start, end - ra->start);
+	if (rc > 0)
+		ukarch_fetch_add(&dev->ra_pages, rc);
+}
+
+void uk_fuse_pcache_init(struct uk_fuse_pcache *pc)
+{
+	UK_ASSERT(pc);
+
+	ukarch_spin_init(&pc->spinlock);
+	pc->buckets = NULL;
+	pc->nbuckets = 0;
+	pc->count = 0;
+	UK_INIT_LIST_HEAD(&pc->lru);
+	UK_INIT_LIST_HEAD(&pc->inflight);
+}
+
+/**
+ * @brief waits for the reads in flight and frees all pages
+ *
+ * Has to be called while the device is still connected.
+ *
+ * @param dev
+ */
+void uk_fuse_pcache_fini(struct uk_fuse_dev *dev)
+{
+	struct uk_fuse_pcache *pc;
+	struct uk_fuse_extent *ext;
+	struct uk_fuse_page *p, *tmp;
+	struct uk_fuse_req *req;
+	struct uk_hlist_head *buckets;
+	unsigned long flags;
+	UK_LIST_HEAD(gc);
+
+	UK_ASSERT(dev);
+	pc = &dev->_pcache;
+
+	for (;;) {
+		ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+		ext = uk_list_first_entry_or_null(&pc->inflight,
+						  struct uk_fuse_extent, list);
+		req = ext ? ext->req : NULL;
+		if (req)
+			uk_fusereq_get(req);
+		ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+		if (!req)
+			break;
+
+		uk_fusereq_waitreply(req);
+		uk_fusedev_req_remove(dev, req);
+		fuse_pcache_reap(dev);
+	}
+
+	ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+	uk_list_for_each_entry_safe(p, tmp, &pc->lru, lru)
+		fuse_page_remove_locked(pc, p, &gc);
+	buckets = pc->buckets;
+	uk_fuse_pcache_init(pc);
+	ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+	fuse_pcache_gc(dev, &gc);
+	if (buckets)
+		uk_free(dev->a, buckets);
+}
+
+/**
+ * @brief reads from a file through the page cache
+ *
+ * Pages, that are not cached, are read in extents of up to dev->max_pages
+ * pages. If @p ra is given, sequential reads are detected and read ahead.
+ * If the cache is disabled (dev->pcache_max_pages is 0), this is
+ * uk_fuse_request_read(). Dirty data of the writeback cache is read as
+ * well.
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh
+ * @param file_off
+ * @param length
+ * @param out_buf
+ * @param[out] bytes_transferred less than @p length at the end of the file
+ * @param ra readahead state of the open file. May be NULL.
+ * @return int
+ */
+int uk_fuse_pcache_read(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
+			uint64_t file_off, uint32_t length, void *out_buf,
+			uint32_t *bytes_transferred,
+			struct uk_fuse_ra_state *ra)
+{
+	struct uk_fuse_pcache *pc;
+	struct uk_fuse_extent *ext;
+	struct uk_fuse_req *req, *done;
+	struct uk_fuse_page *p;
+	uint64_t first, last, index;
+	uint32_t copied = 0, from, n;
+	unsigned long flags;
+	bool waited = false, eof = false;
+	int rc = 0;
+	UK_LIST_HEAD(gc);
+
+	UK_ASSERT(dev);
+	UK_ASSERT(out_buf);
+	UK_ASSERT(bytes_transferred);
+	pc = &dev->_pcache;
+
+	*bytes_transferred = 0;
+	if (!length)
+		return 0;
+	if (!UK_READ_ONCE(dev->pcache_max_pages)) {
+		rc = uk_fuse_request_read(dev, nodeid, fh, file_off, length,
+					  out_buf, bytes_transferred);
+		if (!rc)
+			uk_fuse_wb_overlay(dev, nodeid, file_off, length,
+					   out_buf, bytes_transferred);
+		return rc;
+	}
+
+	first = file_off / FUSE_PCACHE_PAGE_SIZE;
+	last = (file_off + length - 1) / FUSE_PCACHE_PAGE_SIZE;
+
+	fuse_pcache_reap(dev);
+	if (ra)
+		fuse_pcache_readahead(dev, nodeid, fh, ra, first,
+				      last - first + 1);
+	if ((rc = fuse_pcache_fill(dev, nodeid, fh, first,
+				   last - first + 1)) < 0)
+		return rc;
+	rc = 0;
+
+	index = first;
+	while (index <= last && !eof) {
+		ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+		p = fuse_page_find_locked(pc, nodeid, index);
+		if (!p) {
+			/* Evicted or invalidated in the meantime */
+			ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+			if ((rc = fuse_pcache_fill(dev, nodeid, fh, index,
+						   last - index + 1)) < 0)
+				break;
+			rc = 0;
+			continue;
+		}
+
+		if (!p->uptodate) {
+			ext = p->ext;
+			req = ext->req;
+			ext->refs++;
+			uk_fusereq_get(req);
+			ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+			rc = uk_fusereq_waitreply(req);
+
+			ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+			done = NULL;
+			if (ext->req == req)
+				done = fuse_extent_settle_locked(pc, ext, &gc);
+			/* Beyond the end of the file */
+			if (!rc && (index - ext->index) * FUSE_PCACHE_PAGE_SIZE
+				   >= ext->bytes)
+				eof = true;
+			fuse_extent_put_locked(ext, &gc);
+			ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+			uk_fusedev_req_remove(dev, req);
+			if (done)
+				uk_fusedev_req_remove(dev, done);
+			fuse_pcache_gc(dev, &gc);
+
+			if (!waited)
+				ukarch_inc(&dev->pcache_misses);
+			waited = true;
+			if (rc)
+				break;
+			continue;
+		}
+
+		from = (index == first) ? file_off % FUSE_PCACHE_PAGE_SIZE : 0;
+		if (p->len > from) {
+			n = MIN(p->len - from, length - copied);
+			memcpy((char *) out_buf + copied, fuse_page_data(p) + from,
+			       n);
+			copied += n;
+		}
+		eof = p->len < FUSE_PCACHE_PAGE_SIZE;
+
+		uk_list_del(&p->lru);
+		uk_list_add(&p->lru, &pc->lru);
+		ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+		if (!waited)
+			ukarch_inc(&dev->pcache_hits);
+		waited = false;
+		index++;
+	}
+
+	if (ra)
+		ra->next = index;
+	*bytes_transferred = copied;
+	if (!copied && rc)
+		return rc;
+
+	uk_fuse_wb_overlay(dev, nodeid, file_off, length, out_buf,
+			   bytes_transferred);
+	return 0;
+}
+
+/**
+ * @brief drops the cached pages of [@p file_off, @p file_off + @p length)
+ * of a file
+ *
+ * Pass UINT64_MAX as @p length to drop all pages of the file, e.g., when it
+ * has been changed by someone else.
+ *
+ * @param dev
+ * @param nodeid
+ * @param file_off
+ * @param length
+ */
+void uk_fuse_pcache_invalidate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			       uint64_t file_off, uint64_t length)
+{
+	struct uk_fuse_pcache *pc;
+	struct uk_fuse_page *p, *tmp;
+	uint64_t first, last, index;
+	unsigned long flags;
+	UK_LIST_HEAD(gc);
+
+	UK_ASSERT(dev);
+	pc = &dev->_pcache;
+
+	if (!length || !UK_READ_ONCE(pc->count))
+		return;
+
+	first = file_off / FUSE_PCACHE_PAGE_SIZE;
+	if (length > UINT64_MAX - file_off)
+		last = UINT64_MAX;
+	else
+		last = (file_off + length - 1) / FUSE_PCACHE_PAGE_SIZE;
+
+	ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+	if (last - first >= pc->count) {
+		uk_list_for_each_entry_safe(p, tmp, &pc->lru, lru) {
+			if (p->nodeid == nodeid && p->index >= first
+			    && p->index <= last)
+				fuse_page_remove_locked(pc, p, &gc);
+		}
+	} else {
+		for (index = first; index <= last; index++) {
+			p = fuse_page_find_locked(pc, nodeid, index);
+			if (p)
+				fuse_page_remove_locked(pc, p, &gc);
+		}
+	}
+	ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+	fuse_pcache_gc(dev, &gc);
+}
+
+/**
+ * @brief stores data pushed by the device (FUSE_NOTIFY_STORE) in the cache
+ *
+ * Cached pages overlapping [@p file_off, @p file_off + @p length) are
+ * updated, pages which are still being read are dropped. Pages not cached
+ * yet are only added, if the data covers them entirely.
+ *
+ * @param dev
+ * @param nodeid
+ * @param file_off
+ * @param length
+ * @param buf data of the range
+ * @return int 0 or -ENOMEM
+ */
+int uk_fuse_pcache_store(struct uk_fuse_dev *dev, uint64_t nodeid,
+			 uint64_t file_off, uint32_t length, const void *buf)
+{
+	struct uk_fuse_pcache *pc;
+	struct uk_hlist_head *buckets = NULL;
+	struct uk_fuse_extent *ext = NULL;
+	struct uk_fuse_page *p;
+	uint64_t first, last, full, nfull, index, end = file_off + length;
+	uint32_t nbuckets = 0, from, to;
+	unsigned long flags;
+	UK_LIST_HEAD(gc);
+
+	UK_ASSERT(dev);
+	UK_ASSERT(buf || !length);
+	pc = &dev->_pcache;
+
+	if (!length || !UK_READ_ONCE(dev->pcache_max_pages))
+		return 0;
+
+	first = file_off / FUSE_PCACHE_PAGE_SIZE;
+	last = (end - 1) / FUSE_PCACHE_PAGE_SIZE;
+	/* Pages covered entirely, at most as many as the cache holds */
+	full = DIV_ROUND_UP(file_off, FUSE_PCACHE_PAGE_SIZE);
+	nfull = end / FUSE_PCACHE_PAGE_SIZE > full
+		? end / FUSE_PCACHE_PAGE_SIZE - full : 0;
+	nfull = MIN(nfull, (uint64_t) dev->pcache_max_pages);
+
+	if (nfull) {
+		if (fuse_pcache_buckets_alloc(dev, &buckets, &nbuckets))
+			return -ENOMEM;
+		ext = fuse_extent_alloc(dev, full, nfull);
+		if (!ext) {
+			if (buckets)
+				uk_free(dev->a, buckets);
+			return -ENOMEM;
+		}
+	}
+
+	ukplat_spin_lock_irqsave(&pc->spinlock, flags);
+	fuse_pcache_buckets_install_locked(pc, &buckets, nbuckets);
+	if (ext)
+		fuse_pcache_evict_locked(dev, nfull, &gc);
+
+	for (index = first; index <= last; index++) {
+		from = index == first ? file_off % FUSE_PCACHE_PAGE_SIZE : 0;
+		to = MIN(end - index * FUSE_PCACHE_PAGE_SIZE,
+			 (uint64_t) FUSE_PCACHE_PAGE_SIZE);
+
+		p = fuse_page_find_locked(pc, nodeid, index);
+		if (p && !p->uptodate) {
+			/* The read in flight might return older data */
+			fuse_page_remove_locked(pc, p, &gc);
+			p = NULL;
+		}
+		if (!p) {
+			if (!ext || index < full || index >= full + nfull)
+				continue;
+			p = fuse_page_insert_locked(pc, ext, index - full,
+						    nodeid);
+			p->uptodate = true;
+		} else if (from > p->len) {
+			/* The file has grown, the gap reads as zeroes */
+			memset(fuse_page_data(p) + p->len, 0, from - p->len);
+		}
+
+		memcpy(fuse_page_data(p) + from,
+		       (const char *) buf + (index * FUSE_PCACHE_PAGE_SIZE
+					     + from - file_off),
+		       to - from);
+		p->len = MAX(p->len, to);
+	}
+
+	/* None of the pages of the extent has been cached */
+	if (ext && !ext->refs)
+		uk_list_add(&ext->list, &gc);
+	ukplat_spin_unlock_irqrestore(&pc->spinlock, flags);
+
+	fuse_pcache_gc(dev, &gc);
+	if (buckets)
+		uk_free(dev->a, buckets);
+	return 0;
+}
@@ -0,0 +1,552 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Per-device writeback cache of FUSE files (FUSE_WRITEBACK_CACHE).
+ *
+ * Writes smaller than dev->max_write are copied into dirty ranges instead
+ * of being sent right away. Writes adjacent to or overlapping a dirty range
+ * of the same file are merged into it, as long as it stays within
+ * dev->max_write bytes, so that e.g. appending lines to a log results in
+ * few FUSE_WRITE requests of dev->max_write bytes each.
+ *
+ * Dirty ranges are written
+ *  - by uk_fuse_wb_flush(), e.g., on fsync, flush and release,
+ *  - oldest first, once they use more than dev->wb_max_bytes of memory,
+ *  - once they have been dirty for dev->wb_delay_ms, by a flusher thread
+ *    (or by the next write without LIBUKSCHED).
+ *
+ * Overlapping ranges are never written concurrently, so the device sees the
+ * writes of a byte in order. uk_fuse_pcache_read() overlays the dirty data
+ * onto the data read from the device.
+ */
+
+#include "uk/fuse_wb.h"
+#include "uk/fuse.h"
+#include "uk/fuse_node.h"
+#include "uk/fusedev.h"
+#include "uk/fusedev_core.h"
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/plat/spinlock.h>
+#include <uk/plat/time.h>
+#if CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/wait.h>
+#endif
+#include <errno.h>
+#include <string.h>
+
+static inline bool fuse_wb_range_overlaps(const struct uk_fuse_wb_range *r,
+					  uint64_t off, uint64_t end)
+{
+	return r->off < end && off < r->off + r->len;
+}
+
+/**
+ * @brief waits, until a range has been written since @p gen was read
+ */
+static void fuse_wb_wait(struct uk_fuse_wb *wb, uint32_t gen)
+{
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wait_event(&wb->wq, UK_READ_ONCE(wb->gen) != gen);
+#else
+	while (UK_READ_ONCE(wb->gen) == gen)
+		;
+#endif
+}
+
+/**
+ * @brief writes @p r, which has been marked flushing, and drops it
+ *
+ * Short writes are continued, until the whole range has been written. A write,
+ * that makes no progress, fails with -EIO.
+ */
+static int fuse_wb_range_write(struct uk_fuse_dev *dev,
+			       struct uk_fuse_wb_range *r)
+{
+	struct uk_fuse_wb *wb = &dev->_wb;
+	uint32_t done = 0, written;
+	unsigned long flags;
+	int rc;
+
+	do {
+		rc = uk_fuse_request_write(dev, r->nodeid, r->fh,
+					   r->buf + done, r->len - done,
+					   r->off + done, &written);
+		ukarch_inc(&dev->wb_flushes);
+		if (!rc && !written)
+			rc = -EIO;
+		if (rc)
+			break;
+		done += MIN(written, r->len - done);
+	} while (done < r->len);
+	if (rc)
+		uk_pr_warn("Failed to write back %"__PRIu32" bytes of nodeid %"
+			   __PRIu64": %d\n", r->len - done, r->nodeid, rc);
+
+	ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+	uk_list_del(&r->list);
+	wb->bytes -= r->cap;
+	wb->gen++;
+	if (rc && !wb->err) {
+		wb->err_nodeid = r->nodeid;
+		wb->err = rc;
+	}
+	ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&wb->wq);
+#endif
+	uk_free(dev->a, r);
+	return rc;
+}
+
+/**
+ * @brief writes dirty ranges, oldest first
+ *
+ * Writes the ranges of @p nodeid (all files, if 0) overlapping
+ * [@p off, @p end), that have been dirtied no later than @p before, until
+ * at most @p keep bytes are used by dirty ranges. Ranges being written by
+ * other threads are waited for.
+ *
+ * @return int 0 or the error of the first failed write
+ */
+static int fuse_wb_writeout(struct uk_fuse_dev *dev, uint64_t nodeid,
+			    uint64_t off, uint64_t end, __nsec before,
+			    uint64_t keep)
+{
+	struct uk_fuse_wb *wb = &dev->_wb;
+	struct uk_fuse_wb_range *r, *found;
+	unsigned long flags;
+	bool busy;
+	uint32_t gen;
+	int rc = 0, ret;
+
+	for (;;) {
+		found = NULL;
+		busy = false;
+
+		ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+		if (wb->bytes <= keep) {
+			ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+			break;
+		}
+		uk_list_for_each_entry(r, &wb->dirty, list) {
+			if ((nodeid && r->nodeid != nodeid)
+			    || !fuse_wb_range_overlaps(r, off, end)
+			    || r->dirtied > before)
+				continue;
+			if (r->flushing) {
+				busy = true;
+				continue;
+			}
+			found = r;
+			found->flushing = true;
+			break;
+		}
+		gen = wb->gen;
+		ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+
+		if (found) {
+			ret = fuse_wb_range_write(dev, found);
+			if (!rc)
+				rc = ret;
+		} else if (busy) {
+			fuse_wb_wait(wb, gen);
+		} else {
+			break;
+		}
+	}
+
+	return rc;
+}
+
+static inline uint32_t fuse_wb_delay_ms(struct uk_fuse_dev *dev)
+{
+	return UK_READ_ONCE(dev->wb_delay_ms);
+}
+
+/**
+ * @brief returns the time, before which ranges have been dirty for too long
+ */
+static inline __nsec fuse_wb_expired(struct uk_fuse_dev *dev)
+{
+	__nsec now = ukplat_monotonic_clock();
+	__nsec delay = ukarch_time_msec_to_nsec(fuse_wb_delay_ms(dev));
+
+	return now > delay ? now - delay : 0;
+}
+
+#if CONFIG_LIBUKSCHED
+static void fuse_wb_flusher(void *arg)
+{
+	struct uk_fuse_dev *dev = arg;
+	struct uk_fuse_wb *wb = &dev->_wb;
+	uint32_t delay;
+
+	while (!UK_READ_ONCE(wb->stop)) {
+		delay = fuse_wb_delay_ms(dev);
+		uk_sched_thread_sleep(ukarch_time_msec_to_nsec(
+					      delay ? MAX(delay / 2, 1U) : 1000));
+		if (!delay || !UK_READ_ONCE(wb->bytes))
+			continue;
+
+		fuse_wb_writeout(dev, 0, 0, UINT64_MAX,
+				 fuse_wb_expired(dev), 0);
+	}
+}
+#endif
+
+void uk_fuse_wb_init(struct uk_fuse_wb *wb)
+{
+	UK_ASSERT(wb);
+
+	ukarch_spin_init(&wb->spinlock);
+	UK_INIT_LIST_HEAD(&wb->dirty);
+	wb->bytes = 0;
+	wb->gen = 0;
+	wb->err_nodeid = 0;
+	wb->err = 0;
+#if CONFIG_LIBUKSCHED
+	uk_waitq_init(&wb->wq);
+	wb->flusher = NULL;
+	wb->stop = false;
+#endif
+}
+
+/**
+ * @brief starts the flusher thread of @p dev
+ *
+ * Called once FUSE_WRITEBACK_CACHE has been negotiated.
+ *
+ * @param dev
+ * @return int
+ */
+int uk_fuse_wb_start(struct uk_fuse_dev *dev)
+{
+	UK_ASSERT(dev);
+
+#if CONFIG_LIBUKSCHED
+	if (dev->_wb.flusher)
+		return 0;
+
+	dev->_wb.stop = false;
+	dev->_wb.flusher = uk_thread_create("fuse-wb", fuse_wb_flusher, dev);
+	if (!dev->_wb.flusher)
+		return -ENOMEM;
+#endif
+	return 0;
+}
+
+/**
+ * @brief stops the flusher thread and writes all dirty ranges
+ *
+ * Has to be called while the device is still connected.
+ *
+ * @param dev
+ */
+void uk_fuse_wb_fini(struct uk_fuse_dev *dev)
+{
+	int rc;
+
+	UK_ASSERT(dev);
+
+#if CONFIG_LIBUKSCHED
+	if (dev->_wb.flusher) {
+		UK_WRITE_ONCE(dev->_wb.stop, true);
+		uk_thread_wake(dev->_wb.flusher);
+		uk_thread_wait(dev->_wb.flusher);
+		dev->_wb.flusher = NULL;
+	}
+#endif
+
+	if ((rc = fuse_wb_writeout(dev, 0, 0, UINT64_MAX, UINT64_MAX, 0)))
+		uk_pr_err("Lost dirty data: %d\n", rc);
+}
+
+/**
+ * @brief writes to a file through the writeback cache
+ *
+ * Writes of at least dev->max_write bytes, and all writes, if the cache is
+ * disabled (dev->wb_max_bytes is 0), are uk_fuse_request_write(). Smaller
+ * writes are merged into a dirty range and complete without a request.
+ * Errors of writing the range are reported by uk_fuse_wb_flush().
+ *
+ * @param dev
+ * @param nodeid
+ * @param fh
+ * @param in_buf
+ * @param length
+ * @param off
+ * @param[out] bytes_transferred
+ * @return int
+ */
+int uk_fuse_wb_write(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
+		     const void *in_buf, uint32_t length, uint64_t off,
+		     uint32_t *bytes_transferred)
+{
+	struct uk_fuse_wb *wb;
+	struct uk_fuse_wb_range *r, *into, *conflict, *new = NULL;
+	uint64_t end = off + length, max_bytes, start;
+	uint32_t cap, gen;
+	unsigned long flags;
+	bool busy;
+	int rc;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(in_buf);
+	UK_ASSERT(bytes_transferred);
+	wb = &dev->_wb;
+
+	*bytes_transferred = 0;
+	max_bytes = UK_READ_ONCE(dev->wb_max_bytes);
+	cap = dev->max_write;
+	if (!max_bytes || length >= cap || !length) {
+		/* Older dirty data must not overwrite this one */
+		if ((rc = fuse_wb_writeout(dev, nodeid, off, end, UINT64_MAX,
+					   0)))
+			return rc;
+		return uk_fuse_request_write(dev, nodeid, fh, in_buf, length,
+					     off, bytes_transferred);
+	}
+
+	for (;;) {
+		into = NULL;
+		conflict = NULL;
+
+		ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+		uk_list_for_each_entry(r, &wb->dirty, list) {
+			if (r->nodeid != nodeid || off > r->off + r->len
+			    || end < r->off)
+				continue;
+			if (!into && !r->flushing
+			    && MAX(end, r->off + r->len) - MIN(off, r->off)
+			       <= r->cap) {
+				into = r;
+				continue;
+			}
+			/* Data of other ranges it overlaps would be written
+			   after the merged one */
+			if (fuse_wb_range_overlaps(r, off, end)) {
+				conflict = r;
+				break;
+			}
+		}
+
+		if (!conflict && into) {
+			start = MIN(off, into->off);
+			if (start < into->off)
+				memmove(into->buf + (into->off - start),
+					into->buf, into->len);
+			memcpy(into->buf + (off - start), in_buf, length);
+			into->len = MAX(end, into->off + into->len) - start;
+			into->off = start;
+			ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+			break;
+		}
+
+		if (!conflict && new) {
+			new->nodeid = nodeid;
+			new->fh = fh;
+			new->off = off;
+			new->len = length;
+			new->dirtied = ukplat_monotonic_clock();
+			new->flushing = false;
+			memcpy(new->buf, in_buf, length);
+			uk_list_add_tail(&new->list, &wb->dirty);
+			wb->bytes += new->cap;
+			new = NULL;
+			ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+			break;
+		}
+
+		busy = conflict && conflict->flushing;
+		if (busy)
+			conflict = NULL;
+		else if (conflict)
+			conflict->flushing = true;
+		gen = wb->gen;
+		ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+
+		if (conflict) {
+			fuse_wb_range_write(dev, conflict);
+		} else if (busy) {
+			/* A range it overlaps is being written */
+			fuse_wb_wait(wb, gen);
+		} else {
+			/* Allocate outside of the lock and look again */
+			new = uk_malloc(dev->a, sizeof(*new) + cap);
+			if (!new)
+				return -ENOMEM;
+			new->cap = cap;
+		}
+	}
+
+	if (new)
+		uk_free(dev->a, new);
+
+	*bytes_transferred = length;
+	ukarch_inc(&dev->wb_writes);
+	if (dev->attr_cache == UK_FUSE_ATTR_CACHE_RELAXED)
+		uk_fuse_node_extend_size(dev, nodeid, end);
+
+	/* Memory pressure */
+	if (UK_READ_ONCE(wb->bytes) > max_bytes)
+		fuse_wb_writeout(dev, 0, 0, UINT64_MAX, UINT64_MAX,
+				 max_bytes);
+#if !CONFIG_LIBUKSCHED
+	if (fuse_wb_delay_ms(dev))
+		fuse_wb_writeout(dev, 0, 0, UINT64_MAX,
+				 fuse_wb_expired(dev), 0);
+#endif
+	return 0;
+}
+
+/**
+ * @brief writes the dirty ranges of a file and waits for them
+ *
+ * @param dev
+ * @param nodeid the file, or 0 for all files
+ * @return int 0, or the error of a failed write of the file since the last
+ * call, including writes by the flusher thread
+ */
+int uk_fuse_wb_flush(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_wb *wb;
+	unsigned long flags;
+	int rc;
+
+	UK_ASSERT(dev);
+	wb = &dev->_wb;
+
+	if (!UK_READ_ONCE(wb->bytes) && !UK_READ_ONCE(wb->err))
+		return 0;
+
+	rc = fuse_wb_writeout(dev, nodeid, 0, UINT64_MAX, UINT64_MAX, 0);
+
+	ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+	if (wb->err && (!nodeid || wb->err_nodeid == nodeid)) {
+		if (!rc)
+			rc = wb->err;
+		wb->err = 0;
+	}
+	ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+
+	return rc;
+}
+
+/**
+ * @internal
+ * @brief copies the dirty data of [@p file_off, @p file_off + @p length) of
+ * a file over the data read from the device
+ *
+ * If dirty data extends the data read, @p bytes_transferred is increased
+ * and the gap in between is zeroed.
+ *
+ * @param dev
+ * @param nodeid
+ * @param file_off
+ * @param length
+ * @param buf data read
+ * @param[in,out] bytes_transferred number of bytes read
+ */
+void uk_fuse_wb_overlay(struct uk_fuse_dev *dev, uint64_t nodeid,
+			uint64_t file_off, uint32_t length, void *buf,
+			uint32_t *bytes_transferred)
+{
+	struct uk_fuse_wb *wb;
+	struct uk_fuse_wb_range *r;
+	uint64_t end = file_off + length, s, e;
+	unsigned long flags;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(bytes_transferred);
+	wb = &dev->_wb;
+
+	if (!UK_READ_ONCE(wb->bytes))
+		return;
+
+	/* Oldest first, so that newer data wins */
+	ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+	uk_list_for_each_entry(r, &wb->dirty, list) {
+		if (r->nodeid != nodeid
+		    || !fuse_wb_range_overlaps(r, file_off, end))
+			continue;
+
+		s = MAX(r->off, file_off);
+		e = MIN(r->off + r->len, end);
+		if (s - file_off > *bytes_transferred)
+			memset((char *) buf + *bytes_transferred, 0,
+			       s - file_off - *bytes_transferred);
+		memcpy((char *) buf + (s - file_off), r->buf + (s - r->off),
+		       e - s);
+		*bytes_transferred = MAX(*bytes_transferred,
+					 (uint32_t) (e - file_off));
+	}
+	ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+}
+
+/**
+ * @internal
+ * @brief returns the end of the dirty data of a file
+ *
+ * The size of the file is at least this, even though the device does not
+ * know yet.
+ *
+ * @param dev
+ * @param nodeid
+ * @return uint64_t 0, if the file has no dirty data
+ */
+uint64_t uk_fuse_wb_size(struct uk_fuse_dev *dev, uint64_t nodeid)
+{
+	struct uk_fuse_wb *wb;
+	struct uk_fuse_wb_range *r;
+	unsigned long flags;
+	uint64_t size = 0;
+
+	UK_ASSERT(dev);
+	wb = &dev->_wb;
+
+	if (!UK_READ_ONCE(wb->bytes))
+		return 0;
+
+	ukplat_spin_lock_irqsave(&wb->spinlock, flags);
+	uk_list_for_each_entry(r, &wb->dirty, list) {
+		if (r->nodeid == nodeid)
+			size = MAX(size, r->off + r->len);
+	}
+	ukplat_spin_unlock_irqrestore(&wb->spinlock, flags);
+
+	return size;
+}
@@ -37,6 +37,7 @@
  * unikraft/lib/uk9p/9pdev.c
  */
 
+#include "uk/fuse.h"
 #include "uk/fusedev.h"
 #include "uk/fusedev_core.h"
 #include "uk/fusedev_trans.h"
@@ -44,16 +45,42 @@
 #include "uk/fusereq.h"
 #include <uk/plat/spinlock.h>
 #include <uk/alloc.h>
+#include <uk/arch/atomic.h>
+#include <uk/allocpool.h>
 #include <uk/errptr.h>
+#include <uk/print.h>
 #ifdef CONFIG_LIBUKSCHED
 #include <uk/wait.h>
 #endif
 
-static void _req_mgmt_init(struct uk_fusedev_req_mgmt *req_mgmt)
+static int _req_mgmt_init(struct uk_fusedev_req_mgmt *req_mgmt,
+			  struct uk_alloc *a)
 {
 	ukarch_spin_init(&req_mgmt->spinlock);
 	UK_INIT_LIST_HEAD(&req_mgmt->req_list);
 	UK_INIT_LIST_HEAD(&req_mgmt->req_free_list);
+	req_mgmt->req_pool = NULL;
+
+#if CONFIG_LIBUKFUSE_REQ_POOL_SIZE > 0
+	req_mgmt->req_pool = uk_allocpool_alloc(a,
+					CONFIG_LIBUKFUSE_REQ_POOL_SIZE,
+					sizeof(struct uk_fuse_req),
+					__alignof__(struct uk_fuse_req));
+	if (!req_mgmt->req_pool)
+		return -ENOMEM;
+#else
+	(void) a;
+#endif
+
+	return 0;
+}
+
+static void _req_mgmt_req_free(struct uk_fuse_req *req)
+{
+	if (req->_pool)
+		uk_allocpool_return(req->_pool, req);
+	else
+		uk_free(req->_a, req);
 }
 
 static void _req_mgmt_req_to_freelist_locked(struct uk_fusedev_req_mgmt *req_mgmt,
@@ -129,7 +156,19 @@ static void _req_mgmt_cleanup(struct uk_fusedev_req_mgmt *req_mgmt)
 	uk_list_for_each_entry_safe(req, reqn, &req_mgmt->req_free_list,
 			_list) {
 		uk_list_del(&req->_list);
-		uk_free(req->_a, req);
+		_req_mgmt_req_free(req);
+	}
+
+	/* Requests, that are still referenced, live in the pool. Rather leak
+	   it than free their memory underneath them. */
+	if (req_mgmt->req_pool) {
+		if (uk_allocpool_availcount(req_mgmt->req_pool)
+		    == CONFIG_LIBUKFUSE_REQ_POOL_SIZE)
+			uk_allocpool_free(req_mgmt->req_pool);
+		else
+			uk_pr_warn("Requests still in use, leaking the "
+				   "request pool\n");
+		req_mgmt->req_pool = NULL;
 	}
 	ukplat_spin_unlock_irqrestore(&req_mgmt->spinlock, flags);
 }
@@ -143,10 +182,19 @@ struct uk_fuse_req *uk_fusedev_req_create(struct uk_fuse_dev *dev)
 	UK_ASSERT(dev);
 
 	ukplat_spin_lock_irqsave(&dev->_req_mgmt.spinlock, flags);
-	if (!(req = _req_mgmt_from_freelist_locked(&dev->_req_mgmt))) {
+	if (!(req = _req_mgmt_from_freelist_locked(&dev->_req_mgmt))
+	    && dev->_req_mgmt.req_pool
+	    && (req = uk_allocpool_take(dev->_req_mgmt.req_pool))) {
+		req->_dev = dev;
+		req->_a = dev->a;
+		req->_pool = dev->_req_mgmt.req_pool;
+	}
+
+	if (!req) {
 		/* Don't allocate with the spinlock held. */
 		ukplat_spin_unlock_irqrestore(&dev->_req_mgmt.spinlock, flags);
-		req = uk_calloc(dev->a, 1, sizeof(*req));
+		req = uk_memalign(dev->a, __alignof__(struct uk_fuse_req),
+				  sizeof(*req));
 		if (req == NULL) {
 			rc = -ENOMEM;
 			goto out;
@@ -158,6 +206,7 @@ struct uk_fuse_req *uk_fusedev_req_create(struct uk_fuse_dev *dev)
 		 * _req_mgmt_cleanup.
 		 */
 		req->_a = dev->a;
+		req->_pool = NULL;
 		ukplat_spin_lock_irqsave(&dev->_req_mgmt.spinlock, flags);
 	}
 
@@ -202,6 +251,11 @@ int uk_fusedev_request(struct uk_fuse_dev *dev, struct uk_fuse_req *req)
 		return -EIO;
 	}
 
+#if !CONFIG_LIBUKSCHED
+	/* There is no worker thread retrieving the notifications */
+	uk_fuse_notify_process(dev);
+#endif
+
 	/* -ENOSPC is returned, if not enough descriptors are available on a
 	   virtqueue */
 #if CONFIG_LIBUKSCHED
@@ -220,6 +274,119 @@ int uk_fusedev_request(struct uk_fuse_dev *dev, struct uk_fuse_req *req)
 	return rc;
 }
 
+/**
+ * @brief submits @p req without waiting for the reply
+ *
+ * Once the reply has been received, @p done is invoked with @p done_arg (see
+ * uk_fusereq_done_t). If @p done is NULL, the caller waits for the reply with
+ * uk_fusereq_waitreply().
+ *
+ * The in/out buffers of @p req have to stay valid until the reply has been
+ * received.
+ *
+ * @param dev
+ * @param req initialized request
+ * @param done completion callback. May be NULL.
+ * @param done_arg
+ * @return int 0 if the request has been handed over to the transport.
+ * @p done is not invoked otherwise.
+ */
+int uk_fusedev_request_async(struct uk_fuse_dev *dev, struct uk_fuse_req *req,
+			     uk_fusereq_done_t done, void *done_arg)
+{
+	uk_fusedev_req_prepare(req, done, done_arg);
+
+	return uk_fusedev_request(dev, req);
+}
+
+/**
+ * @brief marks @p req ready for submission with uk_fusedev_request_batch()
+ *
+ * See uk_fusedev_request_async() for @p done and @p done_arg.
+ *
+ * @param req initialized request
+ * @param done completion callback. May be NULL.
+ * @param done_arg
+ */
+void uk_fusedev_req_prepare(struct uk_fuse_req *req, uk_fusereq_done_t done,
+			    void *done_arg)
+{
+	UK_ASSERT(req);
+
+	req->done = done;
+	req->done_arg = done_arg;
+	UK_WRITE_ONCE(req->state, UK_FUSEREQ_READY);
+}
+
+/**
+ * @brief submits the requests @p reqs, notifying the device as few times as
+ * possible
+ *
+ * Transports, that implement the request_batch operation, take their locks
+ * and notify the device once per call of it. The requests are submitted in
+ * order, so that on failure exactly the first @p submitted requests are in
+ * flight.
+ *
+ * @param dev
+ * @param reqs requests, prepared with uk_fusedev_req_prepare()
+ * @param count number of requests in @p reqs
+ * @param[out] submitted number of requests handed over to the transport
+ * @return int 0 if all requests have been submitted
+ */
+int uk_fusedev_request_batch(struct uk_fuse_dev *dev, struct uk_fuse_req **reqs,
+			     unsigned int count, unsigned int *submitted)
+{
+	unsigned int sent = 0;
+	int rc = 0;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(reqs || !count);
+	UK_ASSERT(submitted);
+
+	*submitted = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (UK_READ_ONCE(reqs[i]->state) != UK_FUSEREQ_READY)
+			return -EINVAL;
+	}
+
+	if (dev->state != UK_FUSEDEV_CONNECTED)
+		return -EIO;
+
+	if (!dev->ops->request_batch) {
+		for (; sent < count; sent++) {
+			rc = uk_fusedev_request(dev, reqs[sent]);
+			if (rc)
+				break;
+		}
+		*submitted = sent;
+		return rc;
+	}
+
+	while (sent < count) {
+		/* -ENOSPC is returned, if no request fits on the virtqueue */
+#if CONFIG_LIBUKSCHED
+		uk_waitq_wait_event(&dev->xmit_wq,
+			(rc = dev->ops->request_batch(dev, reqs + sent,
+						      count - sent))
+			!= -ENOSPC);
+#else
+		do {
+			rc = dev->ops->request_batch(dev, reqs + sent,
+						     count - sent);
+		} while (rc == -ENOSPC);
+#endif
+		if (rc < 0)
+			break;
+
+		sent += rc;
+		rc = 0;
+	}
+
+	*submitted = sent;
+	return rc;
+}
+
 void uk_fusedev_xmit_notify(struct uk_fuse_dev *dev)
 {
 	#if CONFIG_LIBUKSCHED
@@ -227,6 +394,44 @@ void uk_fusedev_xmit_notify(struct uk_fuse_dev *dev)
 	#endif
 }
 
+/**
+ * @brief busy-polls the device for the reply to @p req
+ *
+ * Polls at most dev->poll_budget times with the completion interrupts of the
+ * device switched off. Replies to other requests, that are received while
+ * polling, are delivered as usual.
+ *
+ * @param dev
+ * @param req submitted request
+ * @return int 1, if the reply to @p req has been received, 0 otherwise (the
+ * caller has to wait for the interrupt).
+ */
+int uk_fusedev_poll_reply(struct uk_fuse_dev *dev, struct uk_fuse_req *req)
+{
+	uint32_t budget;
+	int received;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(req);
+
+	budget = UK_READ_ONCE(dev->poll_budget);
+	if (!budget || !dev->ops->poll || !dev->ops->poll_mode)
+		return UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED;
+
+	dev->ops->poll_mode(dev, true);
+	while (!(received = UK_READ_ONCE(req->state) == UK_FUSEREQ_RECEIVED)
+	       && budget--)
+		dev->ops->poll(dev);
+	dev->ops->poll_mode(dev, false);
+
+	if (received)
+		ukarch_inc(&dev->poll_hits);
+	else
+		ukarch_inc(&dev->poll_misses);
+
+	return received;
+}
+
 struct uk_fuse_dev *uk_fusedev_connect(const struct uk_fusedev_trans *trans,
 				       const char *device_identifier,
 				       struct uk_alloc *a)
@@ -253,13 +458,35 @@ struct uk_fuse_dev *uk_fusedev_connect(const struct uk_fusedev_trans *trans,
 	uk_waitq_init(&dev->xmit_wq);
 #endif
 
-	_req_mgmt_init(&dev->_req_mgmt);
+	rc = _req_mgmt_init(&dev->_req_mgmt, a);
+	if (rc < 0)
+		goto free_dev;
+
+	ukarch_spin_init(&dev->_forgets.spinlock);
+	uk_fuse_cq_init(&dev->_forgets.sent);
+	uk_fuse_cq_init(&dev->_forgets.unsent);
+	uk_fuse_node_table_init(&dev->_nodes);
+	uk_fuse_dentry_cache_init(&dev->_dentries);
+	uk_fuse_pcache_init(&dev->_pcache);
+	uk_fuse_wb_init(&dev->_wb);
+	uk_fuse_notify_init(&dev->_notify);
+
 	rc = dev->ops->connect(dev, device_identifier);
 	if (rc < 0)
 		goto free_dev;
 
 	dev->state = UK_FUSEDEV_CONNECTED;
 
+	/* The caches only expire without notifications */
+	rc = uk_fuse_notify_start(dev);
+	if (rc < 0)
+		uk_pr_warn("Failed to start processing notifications: %d\n",
+			   rc);
+
+	rc = uk_fuse_forget_start(dev);
+	if (rc < 0)
+		uk_pr_warn("Failed to start the forget flusher: %d\n", rc);
+
 	return dev;
 
 free_dev:
@@ -276,6 +503,17 @@ int uk_fusedev_disconnect(struct uk_fuse_dev *dev)
 	UK_ASSERT(dev);
 	UK_ASSERT(dev->state == UK_FUSEDEV_CONNECTED);
 
+	/* Notifications must not touch the caches being dropped. */
+	uk_fuse_notify_fini(dev);
+
+	/* Write dirty data and wait for the reads of the page cache, while
+	   the device can still reply to them. */
+	uk_fuse_wb_fini(dev);
+	uk_fuse_pcache_fini(dev);
+
+	/* Forgets of the nodes released on unmount are still collected. */
+	uk_fuse_forget_fini(dev);
+
 	dev->state = UK_FUSEDEV_DISCONNECTING;
 
 	/* Clean up the requests before closing the channel. */
@@ -287,6 +525,28 @@ int uk_fusedev_disconnect(struct uk_fuse_dev *dev)
 	 */
 	rc = dev->ops->disconnect(dev);
 
+	uk_fuse_dentry_cache_fini(dev);
+	uk_fuse_node_table_fini(dev);
 	uk_free(dev->a, dev);
 	return rc;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief retrieves the DAX window of @p dev
+ *
+ * @param dev
+ * @param[out] addr
+ * @param[out] len
+ * @return int 0 on success, -ENODEV if the device has no DAX window
+ */
+int uk_fusedev_dax_window(struct uk_fuse_dev *dev, uint64_t *addr,
+			  uint64_t *len)
+{
+	UK_ASSERT(dev);
+	UK_ASSERT(addr);
+	UK_ASSERT(len);
+
+	if (!dev->ops->dax_window)
+		return -ENODEV;
+	return dev->ops->dax_window(dev, addr, len);
+}
@@ -45,6 +45,8 @@
 #include "uk/refcount.h"
 #include "uk/wait.h"
 #include "uk/arch/atomic.h"
+#include <uk/arch/lcpu.h>
+#include <uk/plat/spinlock.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
@@ -56,7 +58,20 @@
 void uk_fusereq_init(struct uk_fuse_req *req)
 {
 	UK_INIT_LIST_HEAD(&req->_list);
+	UK_INIT_LIST_HEAD(&req->_cq_list);
 	uk_refcount_init(&req->refcount, 1);
+	req->in_buffer = NULL;
+	req->in_buffer_size = 0;
+	req->out_buffer = NULL;
+	req->out_buffer_size = 0;
+	req->rc = 0;
+	req->done = NULL;
+	req->done_arg = NULL;
+	req->zc_dir = UK_FUSEREQ_ZCDIR_NONE;
+	req->zc_buf = NULL;
+	req->zc_size = 0;
+	req->hiprio = false;
+	req->_buf = NULL;
 #if CONFIG_LIBUKSCHED
 	uk_waitq_init(&req->wq);
 #endif
@@ -72,16 +87,38 @@ int uk_fusereq_put(struct uk_fuse_req *req)
 	int last;
 
 	last = uk_refcount_release(&req->refcount);
-	if (last)
+	if (last) {
+		if (req->_buf) {
+			uk_free(req->_a, req->_buf);
+			req->_buf = NULL;
+		}
 		uk_fusedev_req_to_freelist(req->_dev, req);
+	}
 	return last;
 }
 
+/**
+ * @brief extracts the error code from the reply of a received request
+ *
+ * @param req
+ * @return int 0 or a negative FUSE error code
+ */
+static int uk_fusereq_status(struct uk_fuse_req *req)
+{
+	if (req->out_buffer_size == 0) /* No reply was expected */
+		return 0;
+
+	return ((struct fuse_out_header *) req->out_buffer)->error;
+}
+
 int uk_fusereq_receive_cb(struct uk_fuse_req *req, uint32_t recv_size __unused)
 {
 	if (UK_READ_ONCE(req->state) != UK_FUSEREQ_SENT)
 		return -EIO;
 
+	req->rc = uk_fusereq_status(req);
+	/* Make the result visible before the state change */
+	wmb();
 	UK_WRITE_ONCE(req->state, UK_FUSEREQ_RECEIVED);
 
 #if CONFIG_LIBUKSCHED
@@ -89,31 +126,32 @@ int uk_fusereq_receive_cb(struct uk_fuse_req *req, uint32_t recv_size __unused)
 	uk_waitq_wake_up(&req->wq);
 #endif
 
-	// TODOFS: implement
+	/* The completion callback may release the request. Do not touch it
+	   afterwards. */
+	if (req->done)
+		req->done(req, req->done_arg);
 
 	return 0;
 }
 
 int uk_fusereq_error(struct uk_fuse_req *req)
 {
-	int32_t fuse_error = 0;
-
 	UK_ASSERT(req);
 
 	if (UK_READ_ONCE(req->state) != UK_FUSEREQ_RECEIVED)
 		return -EIO;
 
-	if (req->out_buffer_size == 0) /* No reply was expected */
-		goto end;
-
-	fuse_error = ((struct fuse_out_header *) req->out_buffer)->error;
-	if (fuse_error) {
-		uk_pr_err("FUSE reply error code: %" __PRIs32 " (%s) "
-		"\n", fuse_error, strerror(-fuse_error));
-		return fuse_error;
+	if (req->rc) {
+		/* Lookups of missing names are expected (e.g., along $PATH) */
+		if (req->rc == -ENOENT)
+			uk_pr_debug("FUSE reply error code: %" __PRIs32
+				    " (%s)\n", req->rc, strerror(-req->rc));
+		else
+			uk_pr_err("FUSE reply error code: %" __PRIs32 " (%s) "
+			"\n", req->rc, strerror(-req->rc));
+		return req->rc;
 	}
 
-end:
 	return 0;
 }
 
@@ -121,6 +159,11 @@ int uk_fusereq_waitreply(struct uk_fuse_req *req)
 {
 	int rc;
 
+	/* Replies to short requests usually arrive faster than the
+	   completion interrupt could be delivered. */
+	if (req->_dev)
+		uk_fusedev_poll_reply(req->_dev, req);
+
 #if CONFIG_LIBUKSCHED
 	uk_waitq_wait_event(&req->wq, req->state == UK_FUSEREQ_RECEIVED);
 #else
@@ -132,3 +175,102 @@ int uk_fusereq_waitreply(struct uk_fuse_req *req)
 
 	return rc;
 }
+
+void uk_fuse_cq_init(struct uk_fuse_cq *cq)
+{
+	UK_ASSERT(cq);
+
+	ukarch_spin_init(&cq->lock);
+	UK_INIT_LIST_HEAD(&cq->done_list);
+#if CONFIG_LIBUKSCHED
+	uk_waitq_init(&cq->wq);
+#endif
+}
+
+/**
+ * @brief completion callback, which appends @p req to the completion queue
+ * @p cq
+ *
+ * Pass it together with the completion queue, when submitting a request
+ * asynchronously. The request is retrieved with uk_fuse_cq_poll() or
+ * uk_fuse_cq_wait().
+ *
+ * @param req
+ * @param cq struct uk_fuse_cq *
+ */
+void uk_fuse_cq_post(struct uk_fuse_req *req, void *cq)
+{
+	struct uk_fuse_cq *q = cq;
+	unsigned long flags;
+
+	UK_ASSERT(req);
+	UK_ASSERT(q);
+
+	ukplat_spin_lock_irqsave(&q->lock, flags);
+	uk_list_add_tail(&req->_cq_list, &q->done_list);
+	ukplat_spin_unlock_irqrestore(&q->lock, flags);
+
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&q->wq);
+#endif
+}
+
+/**
+ * @brief retrieves up to @p cnt completed requests without blocking
+ *
+ * The caller takes over the requests and has to release each of them with
+ * uk_fusedev_req_remove().
+ *
+ * @param cq
+ * @param[out] reqs array of at least @p cnt elements
+ * @param cnt
+ * @return unsigned int number of requests stored in @p reqs
+ */
+unsigned int uk_fuse_cq_poll(struct uk_fuse_cq *cq, struct uk_fuse_req **reqs,
+			     unsigned int cnt)
+{
+	struct uk_fuse_req *req, *reqn;
+	unsigned int i = 0;
+	unsigned long flags;
+
+	UK_ASSERT(cq);
+	UK_ASSERT(reqs || !cnt);
+
+	ukplat_spin_lock_irqsave(&cq->lock, flags);
+	uk_list_for_each_entry_safe(req, reqn, &cq->done_list, _cq_list) {
+		if (i == cnt)
+			break;
+		uk_list_del_init(&req->_cq_list);
+		reqs[i++] = req;
+	}
+	ukplat_spin_unlock_irqrestore(&cq->lock, flags);
+
+	return i;
+}
+
+/**
+ * @brief retrieves up to @p cnt completed requests, blocking until at least
+ * one is available
+ *
+ * @param cq
+ * @param[out] reqs array of at least @p cnt elements
+ * @param cnt has to be greater than 0
+ * @return unsigned int number of requests stored in @p reqs
+ */
+unsigned int uk_fuse_cq_wait(struct uk_fuse_cq *cq, struct uk_fuse_req **reqs,
+			     unsigned int cnt)
+{
+	unsigned int n;
+
+	UK_ASSERT(cnt > 0);
+
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wait_event(&cq->wq,
+		(n = uk_fuse_cq_poll(cq, reqs, cnt)) > 0);
+#else
+	while ((n = uk_fuse_cq_poll(cq, reqs, cnt)) == 0)
+		;
+#endif
+
+	return n;
+}
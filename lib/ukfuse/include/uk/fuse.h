@@ -43,6 +43,11 @@
 
 #define PAGE_SIZE_4k 4096
 
+/* Mode flags of uk_fuse_request_fallocate() (values of Linux' FALLOC_FL_*) */
+#define UK_FUSE_FALLOC_KEEP_SIZE	0x01
+#define UK_FUSE_FALLOC_PUNCH_HOLE	0x02
+#define UK_FUSE_FALLOC_ZERO_RANGE	0x10
+
 typedef struct
 {
 	bool is_dir;
@@ -59,6 +64,34 @@ typedef struct
 	uint32_t mode;
 } fuse_file_context;
 
+/**
+ * Cursor over the entries of an open directory (see
+ * uk_fuse_readdirplus_open()).
+ */
+struct uk_fuse_readdirplus {
+	struct uk_fuse_dev *dev;
+	uint64_t nodeid;
+	uint64_t fh;
+	/* Size of one buffer of entries */
+	uint32_t buf_size;
+	/* Whether the next buffer is requested ahead of time */
+	bool prefetch;
+	/* At the end of the directory */
+	bool eof;
+
+	/* Reply, whose entries are retrieved, and the prefetched request */
+	struct uk_fuse_req *cur;
+	struct uk_fuse_req *next;
+	/* Position and number of bytes of entries in cur */
+	uint32_t pos;
+	uint32_t len;
+	/* Directory offset of the next buffer */
+	uint64_t offset;
+
+	/* Name of the last entry retrieved */
+	char name[NAME_MAX + 1];
+};
+
 int uk_fuse_request_fsync(struct uk_fuse_dev *dev, bool is_dir,
 			  uint64_t nodeid, uint64_t fh, uint32_t flags);
 
@@ -66,6 +99,9 @@ int uk_fuse_request_removemapping_multiple(struct uk_fuse_dev *dev,
 					FUSE_REMOVEMAPPING_IN *removemapping_in,
 					size_t removemapping_one_cnt);
 
+int uk_fuse_request_removemapping(struct uk_fuse_dev *dev, uint64_t moffset,
+				  uint64_t len);
+
 int uk_fuse_request_removemapping_legacy(struct uk_fuse_dev *dev,
 					 uint64_t nodeid, uint64_t fh,
 					 uint64_t moffset, uint64_t len);
@@ -79,10 +115,12 @@ int uk_fuse_request_lseek(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
 			  uint64_t offset, uint32_t whence,
 			  off_t *offset_out);
 
-int uk_fuse_request_readdirplus(struct uk_fuse_dev *dev, uint64_t buff_len,
-				uint64_t nodeid, uint64_t fh,
-				struct fuse_dirent *dirents,
-				size_t *num_dirents);
+int uk_fuse_readdirplus_open(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t fh, uint32_t buf_size, bool prefetch,
+			     struct uk_fuse_readdirplus *rd);
+int uk_fuse_readdirplus_next(struct uk_fuse_readdirplus *rd,
+			     const struct fuse_direntplus **direntplus);
+int uk_fuse_readdirplus_close(struct uk_fuse_readdirplus *rd);
 
 int uk_fuse_request_mkdir(struct uk_fuse_dev *dev, uint64_t parent_nodeid,
 			  const char *dir_name, uint32_t mode,
@@ -91,6 +129,10 @@ int uk_fuse_request_mkdir(struct uk_fuse_dev *dev, uint64_t parent_nodeid,
 int uk_fuse_request_forget(struct uk_fuse_dev *dev, uint64_t nodeid,
 			   uint64_t nlookup);
 
+int uk_fuse_forget_flush(struct uk_fuse_dev *dev);
+int uk_fuse_forget_start(struct uk_fuse_dev *dev);
+void uk_fuse_forget_fini(struct uk_fuse_dev *dev);
+
 int uk_fuse_request_unlink(struct uk_fuse_dev *dev, const char *filename,
 			   bool is_dir, uint64_t nodeid, uint64_t nlookup,
 			   uint64_t parent_nodeid);
@@ -103,6 +145,16 @@ int uk_fuse_request_write(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
 			  const void *in_buf, uint32_t length, uint64_t off,
 			  uint32_t *bytes_transferred);
 
+int uk_fuse_request_copy_file_range(struct uk_fuse_dev *dev,
+				    uint64_t nodeid_in, uint64_t fh_in,
+				    uint64_t off_in, uint64_t nodeid_out,
+				    uint64_t fh_out, uint64_t off_out,
+				    uint64_t length, uint64_t *bytes_copied);
+
+int uk_fuse_request_fallocate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			      uint64_t fh, uint64_t off, uint64_t length,
+			      uint32_t mode);
+
 int uk_fuse_request_release(struct uk_fuse_dev *dev, bool is_dir,
 			    uint64_t nodeid, uint64_t fh);
 
@@ -110,6 +162,8 @@ int uk_fuse_request_setattr(struct uk_fuse_dev *dev, uint64_t nodeid,
 			    bool is_dir, uint64_t fh, uint32_t mode,
 			    uint64_t last_access_time, uint64_t last_write_time,
 			    uint64_t change_time);
+int uk_fuse_request_truncate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t fh, uint64_t size);
 
 int uk_fuse_request_flush(struct uk_fuse_dev *dev, uint64_t nodeid,
 			  uint64_t fh);
@@ -130,6 +184,62 @@ int uk_fuse_request_get_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
 
 int uk_fuse_request_init(struct uk_fuse_dev *dev);
 
+/* Asynchronous requests.
+ *
+ * Each of the functions below submits a request and returns it without
+ * waiting for the reply. If no completion callback is supplied, the reply is
+ * waited for with uk_fusereq_waitreply(). Results are retrieved with the
+ * matching uk_fuse_reply_*() function. The request is released with
+ * uk_fusedev_req_remove() in both cases.
+ */
+struct uk_fuse_req *uk_fuse_request_lookup_async(struct uk_fuse_dev *dev,
+						 uint64_t dir_nodeid,
+						 const char *filename,
+						 uk_fusereq_done_t done,
+						 void *done_arg);
+int uk_fuse_reply_lookup(struct uk_fuse_req *req, uint64_t *nodeid);
+
+struct uk_fuse_req *uk_fuse_request_get_attr_async(struct uk_fuse_dev *dev,
+						   uint64_t nodeid,
+						   uint64_t file_handle,
+						   uk_fusereq_done_t done,
+						   void *done_arg);
+int uk_fuse_reply_get_attr(struct uk_fuse_req *req, struct fuse_attr *attr);
+
+struct uk_fuse_req *uk_fuse_request_open_async(struct uk_fuse_dev *dev,
+					       bool is_dir, uint64_t nodeid,
+					       uint32_t flags,
+					       uk_fusereq_done_t done,
+					       void *done_arg);
+int uk_fuse_reply_open(struct uk_fuse_req *req, uint64_t *fh);
+
+struct uk_fuse_req *uk_fuse_request_release_async(struct uk_fuse_dev *dev,
+						  bool is_dir,
+						  uint64_t nodeid, uint64_t fh,
+						  uk_fusereq_done_t done,
+						  void *done_arg);
+
+struct uk_fuse_req *uk_fuse_request_flush_async(struct uk_fuse_dev *dev,
+						uint64_t nodeid, uint64_t fh,
+						uk_fusereq_done_t done,
+						void *done_arg);
+
+struct uk_fuse_req *uk_fuse_request_read_async(struct uk_fuse_dev *dev,
+					       uint64_t nodeid, uint64_t fh,
+					       uint64_t file_off,
+					       uint32_t length, void *out_buf,
+					       uk_fusereq_done_t done,
+					       void *done_arg);
+int uk_fuse_reply_read(struct uk_fuse_req *req, uint32_t *bytes_transferred);
+
+struct uk_fuse_req *uk_fuse_request_write_async(struct uk_fuse_dev *dev,
+						uint64_t nodeid, uint64_t fh,
+						const void *in_buf,
+						uint32_t length, uint64_t off,
+						uk_fusereq_done_t done,
+						void *done_arg);
+int uk_fuse_reply_write(struct uk_fuse_req *req, uint32_t *bytes_transferred);
+
 int test_method();
 
 #endif /* __LINUX_FUSE_H__ */
\ No newline at end of file
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_FUSE_DENTRY__
+#define __UK_FUSE_DENTRY__
+
+#include <stdint.h>
+#include <uk/arch/spinlock.h>
+#include <uk/arch/time.h>
+#include <uk/list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+
+/**
+ * Result of a lookup of a name in a directory.
+ */
+struct uk_fuse_dentry {
+	/* Entry in the hash bucket of (parent, name). */
+	struct uk_hlist_node		hash;
+	/* Entry in the LRU list of the cache. */
+	struct uk_list_head		lru;
+	uint64_t			parent;
+	/* Node the name refers to, 0 if it does not exist. */
+	uint64_t			nodeid;
+	/* Generations of parent and nodeid in the node table, when the entry
+	   has been cached (see struct uk_fuse_node). */
+	uint64_t			parent_gen;
+	uint64_t			gen;
+	/* ukplat_monotonic_clock() time, until which the entry is valid. */
+	__nsec				expiry;
+	uint32_t			hashval;
+	char				name[];
+};
+
+/**
+ * @internal
+ * Lookup results of a device, evicted least recently used first.
+ */
+struct uk_fuse_dentry_cache {
+	/* Spinlock protecting this data. */
+	__spinlock			spinlock;
+	/* Hash buckets, allocated with the first entry. */
+	struct uk_hlist_head		*buckets;
+	/* Number of buckets (a power of two). */
+	uint32_t			nbuckets;
+	/* Number of entries. */
+	uint32_t			count;
+	/* Entries, most recently used first. */
+	struct uk_list_head		lru;
+};
+
+void uk_fuse_dentry_cache_init(struct uk_fuse_dentry_cache *c);
+void uk_fuse_dentry_cache_fini(struct uk_fuse_dev *dev);
+
+int uk_fuse_dentry_lookup(struct uk_fuse_dev *dev, uint64_t parent,
+			  const char *name, uint64_t *nodeid);
+void uk_fuse_dentry_add(struct uk_fuse_dev *dev, uint64_t parent,
+			const char *name, uint64_t nodeid, __nsec ttl);
+void uk_fuse_dentry_remove(struct uk_fuse_dev *dev, uint64_t parent,
+			   const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_FUSE_DENTRY__ */
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_FUSE_NODE__
+#define __UK_FUSE_NODE__
+
+#include "uk/fuse_i.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <uk/arch/spinlock.h>
+#include <uk/arch/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+
+/**
+ * Coherence of the attribute cache (see LIBUKFUSE_ATTR_CACHE).
+ */
+enum uk_fuse_attr_cache_mode {
+	/* Attributes are always fetched from the device. */
+	UK_FUSE_ATTR_CACHE_OFF,
+	/* Cached for attr_valid, dropped by local changes. */
+	UK_FUSE_ATTR_CACHE_STRICT,
+	/* Cached for at least attr_min_ms, local changes patched in. */
+	UK_FUSE_ATTR_CACHE_RELAXED
+};
+
+/**
+ * What the client knows about a nodeid, that the device has handed out.
+ */
+struct uk_fuse_node {
+	uint64_t			nodeid;
+	/* Tells the node apart from earlier ones with the same nodeid, which
+	   the device may reuse once a node is forgotten. Never 0. */
+	uint64_t			gen;
+	/* Lookups not yet forgotten (see struct fuse_forget_in). */
+	uint64_t			nlookup;
+	/* Directory the node has last been looked up in (0 if unknown). */
+	uint64_t			parent;
+	/* Held by a user (e.g., a vnode), which forgets the lookups. Nodes,
+	   that are not held, only back cached lookups and are evicted. */
+	bool				held;
+	/* Attributes last received from the device. */
+	struct fuse_attr		attr;
+	/* ukplat_monotonic_clock() time, until which attr is valid. 0, if no
+	   attributes are cached. */
+	uint64_t			attr_expiry;
+};
+
+/**
+ * @internal
+ * Hash table of the nodes of a device (open addressing, linear probing).
+ */
+struct uk_fuse_node_table {
+	/* Spinlock protecting this data. */
+	__spinlock			spinlock;
+	/* Slots, allocated with the first node. */
+	struct uk_fuse_node		*slots;
+	/* Number of slots (a power of two). */
+	uint32_t			size;
+	/* Number of nodes. */
+	uint32_t			count;
+	/* Number of slots of removed nodes, which end no probe sequence. */
+	uint32_t			tombstones;
+	/* Number of nodes, that are not held. */
+	uint32_t			unheld;
+	/* Slot, at which the next eviction starts looking. */
+	uint32_t			evict_pos;
+	/* Generation of the node inserted last. */
+	uint64_t			gen;
+};
+
+/**
+ * Converts a validity timeout of the device (e.g., entry_valid and
+ * entry_valid_nsec) to nanoseconds. "Valid forever" timeouts give UINT64_MAX.
+ */
+static inline __nsec uk_fuse_timeout_nsec(uint64_t valid, uint32_t valid_nsec)
+{
+	/* Avoid overflows */
+	if (valid >= UINT32_MAX)
+		return UINT64_MAX;
+	return ukarch_time_sec_to_nsec(valid) + valid_nsec;
+}
+
+void uk_fuse_node_table_init(struct uk_fuse_node_table *t);
+void uk_fuse_node_table_fini(struct uk_fuse_dev *dev);
+
+int uk_fuse_node_lookup_add(struct uk_fuse_dev *dev, uint64_t parent,
+			    const struct fuse_entry_out *entry);
+int uk_fuse_node_pin(struct uk_fuse_dev *dev, uint64_t nodeid);
+int uk_fuse_node_hold(struct uk_fuse_dev *dev, uint64_t nodeid);
+uint32_t uk_fuse_node_evict(struct uk_fuse_dev *dev, uint32_t max,
+			    struct fuse_forget_one *forgets, uint32_t cnt);
+uint64_t uk_fuse_node_forget(struct uk_fuse_dev *dev, uint64_t nodeid,
+			     uint64_t nlookup);
+void uk_fuse_node_set_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
+			   const struct fuse_attr *attr, uint64_t valid,
+			   uint32_t valid_nsec);
+int uk_fuse_node_get(struct uk_fuse_dev *dev, uint64_t nodeid,
+		     struct uk_fuse_node *node);
+int uk_fuse_node_get_attr(struct uk_fuse_dev *dev, uint64_t nodeid,
+			  struct fuse_attr *attr);
+void uk_fuse_node_invalidate_attr(struct uk_fuse_dev *dev, uint64_t nodeid);
+void uk_fuse_node_extend_size(struct uk_fuse_dev *dev, uint64_t nodeid,
+			      uint64_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_FUSE_NODE__ */
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_FUSE_NOTIFY__
+#define __UK_FUSE_NOTIFY__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uk/wait_types.h>
+#include <uk/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+struct uk_thread;
+
+/**
+ * @internal
+ * Processing of the notifications sent by the device.
+ */
+struct uk_fuse_notify {
+	/* Set by uk_fuse_notify_wakeup(), cleared before the notifications
+	   are retrieved from the transport. */
+	bool				pending;
+#if CONFIG_LIBUKSCHED
+	/* Slept on by the worker, until notifications are pending. */
+	struct uk_waitq			wq;
+	/* Retrieves and processes the notifications. */
+	struct uk_thread		*worker;
+	bool				stop;
+#endif
+};
+
+void uk_fuse_notify_init(struct uk_fuse_notify *n);
+int uk_fuse_notify_start(struct uk_fuse_dev *dev);
+void uk_fuse_notify_fini(struct uk_fuse_dev *dev);
+
+void uk_fuse_notify_wakeup(struct uk_fuse_dev *dev);
+void uk_fuse_notify_process(struct uk_fuse_dev *dev);
+int uk_fuse_notify(struct uk_fuse_dev *dev, const void *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_FUSE_NOTIFY__ */
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_FUSE_PCACHE__
+#define __UK_FUSE_PCACHE__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uk/arch/spinlock.h>
+#include <uk/list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+struct uk_fuse_req;
+struct uk_fuse_extent;
+
+/**
+ * Cached page of a file.
+ */
+struct uk_fuse_page {
+	/* Entry in the hash bucket of (nodeid, index). */
+	struct uk_hlist_node		hash;
+	/* Entry in the LRU list of the cache. */
+	struct uk_list_head		lru;
+	uint64_t			nodeid;
+	/* Offset in the file in pages. */
+	uint64_t			index;
+	/* Extent holding the data of the page. */
+	struct uk_fuse_extent		*ext;
+	/* Number of valid bytes, less than a page at the end of the file. */
+	uint32_t			len;
+	/* Whether the data has been read. */
+	bool				uptodate;
+};
+
+/**
+ * Consecutive pages of a file, read with one FUSE_READ request into one
+ * buffer. The buffer is freed, once the last of its pages is evicted.
+ */
+struct uk_fuse_extent {
+	/* Entry in the list of extents being read. */
+	struct uk_list_head		list;
+	/* Read request, NULL once its reply has been processed. */
+	struct uk_fuse_req		*req;
+	/* Number of cached pages and waiters referencing the extent. */
+	uint32_t			refs;
+	/* Index of the first page. */
+	uint64_t			index;
+	uint32_t			npages;
+	/* Number of bytes read, once the reply has been processed. */
+	uint32_t			bytes;
+	char				*buf;
+	struct uk_fuse_page		pages[];
+};
+
+/**
+ * Readahead state of an open file. Zero-initialized before the first read.
+ */
+struct uk_fuse_ra_state {
+	/* Page following the last read. */
+	uint64_t			next;
+	/* Current readahead window (pages). size is 0, while the file is
+	   not read sequentially. */
+	uint64_t			start;
+	uint32_t			size;
+	/* Once a read reaches this page, the next window is read ahead. */
+	uint64_t			marker;
+};
+
+/**
+ * @internal
+ * Pages of the files of a device, evicted least recently used first.
+ */
+struct uk_fuse_pcache {
+	/* Spinlock protecting this data. */
+	__spinlock			spinlock;
+	/* Hash buckets, allocated with the first page. */
+	struct uk_hlist_head		*buckets;
+	/* Number of buckets (a power of two). */
+	uint32_t			nbuckets;
+	/* Number of pages. */
+	uint32_t			count;
+	/* Pages, most recently used first. */
+	struct uk_list_head		lru;
+	/* Extents being read. */
+	struct uk_list_head		inflight;
+};
+
+void uk_fuse_pcache_init(struct uk_fuse_pcache *pc);
+void uk_fuse_pcache_fini(struct uk_fuse_dev *dev);
+
+int uk_fuse_pcache_read(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
+			uint64_t file_off, uint32_t length, void *out_buf,
+			uint32_t *bytes_transferred,
+			struct uk_fuse_ra_state *ra);
+void uk_fuse_pcache_invalidate(struct uk_fuse_dev *dev, uint64_t nodeid,
+			       uint64_t file_off, uint64_t length);
+int uk_fuse_pcache_store(struct uk_fuse_dev *dev, uint64_t nodeid,
+			 uint64_t file_off, uint32_t length, const void *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_FUSE_PCACHE__ */
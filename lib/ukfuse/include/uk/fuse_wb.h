@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_FUSE_WB__
+#define __UK_FUSE_WB__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uk/arch/spinlock.h>
+#include <uk/arch/time.h>
+#include <uk/wait_types.h>
+#include <uk/list.h>
+#include <uk/config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+struct uk_thread;
+
+/**
+ * Dirty range of a file, written with one FUSE_WRITE request.
+ */
+struct uk_fuse_wb_range {
+	/* Entry in the list of dirty ranges, oldest first. */
+	struct uk_list_head		list;
+	uint64_t			nodeid;
+	/* File handle of the first write. */
+	uint64_t			fh;
+	/* Offset in the file. */
+	uint64_t			off;
+	/* Number of dirty bytes. */
+	uint32_t			len;
+	/* Size of buf (dev->max_write at the time of the first write). */
+	uint32_t			cap;
+	/* Time of the first write (nanoseconds). */
+	__nsec				dirtied;
+	/* Whether the range is being written. Its data must not change
+	   then, as the device reads it directly from buf. */
+	bool				flushing;
+	char				buf[];
+};
+
+/**
+ * @internal
+ * Dirty data of the files of a device, not yet written to the device.
+ */
+struct uk_fuse_wb {
+	/* Spinlock protecting this data. */
+	__spinlock			spinlock;
+	/* Dirty ranges, oldest first. */
+	struct uk_list_head		dirty;
+	/* Memory used by the dirty ranges (bytes). */
+	uint64_t			bytes;
+	/* Incremented, whenever a range has been written. */
+	uint32_t			gen;
+	/* First failed write of a range, reported by the next
+	   uk_fuse_wb_flush() of its node. */
+	uint64_t			err_nodeid;
+	int				err;
+#if CONFIG_LIBUKSCHED
+	/* Slept on by threads waiting for a range being written. */
+	struct uk_waitq			wq;
+	/* Writes ranges, that have been dirty for too long. */
+	struct uk_thread		*flusher;
+	bool				stop;
+#endif
+};
+
+void uk_fuse_wb_init(struct uk_fuse_wb *wb);
+int uk_fuse_wb_start(struct uk_fuse_dev *dev);
+void uk_fuse_wb_fini(struct uk_fuse_dev *dev);
+
+int uk_fuse_wb_write(struct uk_fuse_dev *dev, uint64_t nodeid, uint64_t fh,
+		     const void *in_buf, uint32_t length, uint64_t off,
+		     uint32_t *bytes_transferred);
+int uk_fuse_wb_flush(struct uk_fuse_dev *dev, uint64_t nodeid);
+void uk_fuse_wb_overlay(struct uk_fuse_dev *dev, uint64_t nodeid,
+			uint64_t file_off, uint32_t length, void *buf,
+			uint32_t *bytes_transferred);
+uint64_t uk_fuse_wb_size(struct uk_fuse_dev *dev, uint64_t nodeid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_FUSE_WB__ */
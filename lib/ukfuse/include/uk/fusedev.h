@@ -55,11 +55,20 @@ void uk_fusedev_req_to_freelist(struct uk_fuse_dev *dev,
 struct uk_fuse_req *uk_fusedev_req_create(struct uk_fuse_dev *dev);
 int uk_fusedev_req_remove(struct uk_fuse_dev *dev, struct uk_fuse_req *req);
 int uk_fusedev_request(struct uk_fuse_dev *dev, struct uk_fuse_req *req);
+void uk_fusedev_req_prepare(struct uk_fuse_req *req, uk_fusereq_done_t done,
+			    void *done_arg);
+int uk_fusedev_request_async(struct uk_fuse_dev *dev, struct uk_fuse_req *req,
+			     uk_fusereq_done_t done, void *done_arg);
+int uk_fusedev_request_batch(struct uk_fuse_dev *dev, struct uk_fuse_req **reqs,
+			     unsigned int count, unsigned int *submitted);
 void uk_fusedev_xmit_notify(struct uk_fuse_dev *dev);
+int uk_fusedev_poll_reply(struct uk_fuse_dev *dev, struct uk_fuse_req *req);
 struct uk_fuse_dev *uk_fusedev_connect(const struct uk_fusedev_trans *trans,
 				       const char *device_identifier,
 				       struct uk_alloc *a);
 int uk_fusedev_disconnect(struct uk_fuse_dev *dev);
+int uk_fusedev_dax_window(struct uk_fuse_dev *dev, uint64_t *addr,
+			  uint64_t *len);
 
 
 
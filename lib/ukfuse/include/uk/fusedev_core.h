@@ -74,10 +74,19 @@
 #define __UK_FUSEDEV_CORE__
 
 #include "uk/fusereq.h"
+#include "uk/fuse_node.h"
+#include "uk/fuse_dentry.h"
+#include "uk/fuse_pcache.h"
+#include "uk/fuse_wb.h"
+#include "uk/fuse_notify.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <uk/arch/spinlock.h>
 #include <uk/wait_types.h>
 #include <uk/list.h>
+#include <uk/config.h>
+
+struct uk_thread;
 
 #ifdef __cplusplus
 extern "C" {
@@ -85,6 +94,17 @@ extern "C" {
 
 struct uk_fuse_dev;
 
+#define UK_FUSE_IO_WINDOW_MAX 32
+#define UK_FUSE_FORGET_BATCH_MAX 256
+
+#if CONFIG_LIBUKFUSE_ATTR_CACHE_RELAXED
+#define UK_FUSE_ATTR_CACHE_DEFAULT UK_FUSE_ATTR_CACHE_RELAXED
+#elif CONFIG_LIBUKFUSE_ATTR_CACHE_STRICT
+#define UK_FUSE_ATTR_CACHE_DEFAULT UK_FUSE_ATTR_CACHE_STRICT
+#else
+#define UK_FUSE_ATTR_CACHE_DEFAULT UK_FUSE_ATTR_CACHE_OFF
+#endif
+
 /**
  * Function type used for connecting to a device on a certain transport.
  *
@@ -111,10 +131,90 @@ typedef int (*uk_fuse_disconnect_t)(struct uk_fuse_dev *dev);
 typedef int (*uk_fuse_request_t)(struct uk_fuse_dev *fuse_dev,
 				 struct uk_fuse_req *fuse_req);
 
+/**
+ * Function type used for sending multiple requests to the FUSE device at
+ * once, e.g., with a single notification of the device.
+ *
+ * @param dev
+ *   The Unikraft FUSE device.
+ * @param reqs
+ *   The requests to be sent, in order.
+ * @param count
+ *   The number of requests in reqs.
+ * @return
+ *   The number of requests sent (from the start of reqs), or a negative
+ *   error code, if none has been sent (-ENOSPC, if the transport is full).
+ */
+typedef int (*uk_fuse_request_batch_t)(struct uk_fuse_dev *dev,
+				       struct uk_fuse_req **reqs,
+				       unsigned int count);
+
+/**
+ * Function type used for switching the completion interrupts of the device
+ * off (while a thread busy-polls for replies) and on again.
+ *
+ * Nested calls are allowed: interrupts are switched on again, once every
+ * thread that switched them off is done polling.
+ *
+ * @param dev
+ *   The Unikraft FUSE device.
+ * @param polling
+ *   true, if a thread starts polling, false, if it is done.
+ */
+typedef void (*uk_fuse_poll_mode_t)(struct uk_fuse_dev *dev, bool polling);
+
+/**
+ * Function type used for processing the replies that the device has
+ * completed so far, without waiting for an interrupt.
+ *
+ * @param dev
+ *   The Unikraft FUSE device.
+ * @return
+ *   A positive value, if replies have been processed, 0 otherwise.
+ */
+typedef int (*uk_fuse_poll_t)(struct uk_fuse_dev *dev);
+
+/**
+ * Function type used for retrieving the notifications that the device has
+ * sent so far. Each one is processed with uk_fuse_notify(), and its buffer
+ * is given back to the device afterwards.
+ *
+ * @param dev
+ *   The Unikraft FUSE device.
+ * @return
+ *   The number of notifications processed.
+ */
+typedef int (*uk_fuse_notify_poll_t)(struct uk_fuse_dev *dev);
+
+/**
+ * Function type used for retrieving the DAX window of the device, through
+ * which FUSE_SETUPMAPPING maps files.
+ *
+ * @param dev
+ *   The Unikraft FUSE device.
+ * @param[out] addr
+ *   Address of the window.
+ * @param[out] len
+ *   Length of the window in bytes.
+ * @return
+ *   0 on success, -ENODEV if the device has no window.
+ */
+typedef int (*uk_fuse_dax_window_t)(struct uk_fuse_dev *dev, uint64_t *addr,
+				    uint64_t *len);
+
 struct uk_fusedev_trans_ops {
 	uk_fuse_connect_t			connect;
 	uk_fuse_disconnect_t			disconnect;
 	uk_fuse_request_t			request;
+	/* Optional, requests are sent one by one otherwise. */
+	uk_fuse_request_batch_t			request_batch;
+	/* Optional, required for busy-polling. */
+	uk_fuse_poll_mode_t			poll_mode;
+	uk_fuse_poll_t				poll;
+	/* Optional, the device sends no notifications otherwise. */
+	uk_fuse_notify_poll_t			notify_poll;
+	/* Optional, the device has no DAX window otherwise. */
+	uk_fuse_dax_window_t			dax_window;
 };
 
 enum uk_fuse_dev_trans_state {
@@ -133,6 +233,37 @@ struct uk_fusedev_req_mgmt {
 	struct uk_list_head			req_list;
 	/* Free-list of requests. */
 	struct uk_list_head			req_free_list;
+	/* Preallocated requests, used before falling back to the heap. */
+	struct uk_allocpool			*req_pool;
+};
+
+/**
+ * @internal
+ * Forgets collected to be sent as one FUSE_BATCH_FORGET request.
+ */
+struct uk_fusedev_forget_queue {
+	/* Spinlock protecting this data. */
+	__spinlock				spinlock;
+	/* Number of collected forgets. */
+	uint32_t				count;
+	/* Time the oldest collected forget has been added (nanoseconds). */
+	uint64_t				oldest;
+	struct fuse_forget_one			entries[UK_FUSE_FORGET_BATCH_MAX];
+	/* FUSE_BATCH_FORGET requests the device is done with. They are
+	   released by the next flush. */
+	struct uk_fuse_cq			sent;
+	/* Number of FUSE_BATCH_FORGET requests not yet released. */
+	uint32_t				inflight;
+	/* FUSE_BATCH_FORGET requests, that could not be sent. They are sent
+	   again by the next flush. */
+	struct uk_fuse_cq			unsent;
+	/* Number of requests in unsent. */
+	uint32_t				nunsent;
+#if CONFIG_LIBUKSCHED
+	/* Sends forgets, that have waited for too long. */
+	struct uk_thread			*flusher;
+	bool					stop;
+#endif
 };
 
 /**
@@ -155,12 +286,85 @@ struct uk_fuse_dev {
 	/* foffset and moffset parameters of FUSE_SETUPMAPPING have to be
 	   a multiple of this value */
 	uint32_t				map_alignment;
+	/* Number of chunk requests uk_fuse_request_read() and
+	   uk_fuse_request_write() keep in flight at once
+	   (1..UK_FUSE_IO_WINDOW_MAX). */
+	uint32_t				io_window;
+	/* Number of times a thread polls for a reply, before it goes to
+	   sleep until the completion interrupt (0 disables polling). */
+	uint32_t				poll_budget;
+	/* Number of waits, that did/did not complete while polling. */
+	uint64_t				poll_hits;
+	uint64_t				poll_misses;
+	/* Collected forgets are sent, once there are this many of them
+	   (1..UK_FUSE_FORGET_BATCH_MAX)... */
+	uint32_t				forget_batch;
+	/* ...or the oldest one has waited this long (milliseconds). */
+	uint32_t				forget_delay_ms;
+	/* Coherence of cached attributes. */
+	enum uk_fuse_attr_cache_mode		attr_cache;
+	/* Minimum validity of cached attributes in relaxed mode
+	   (milliseconds). */
+	uint32_t				attr_min_ms;
+	/* Number of uk_fuse_request_get_attr() calls, that have/have not
+	   been served from the attribute cache. */
+	uint64_t				attr_hits;
+	uint64_t				attr_misses;
+	/* Maximum number of cached lookups (0 disables the cache). */
+	uint32_t				dentry_max;
+	/* Validity of cached ENOENT lookups (milliseconds). */
+	uint32_t				neg_entry_ms;
+	/* Number of uk_fuse_request_lookup() calls, that have/have not
+	   been served from the lookup cache. */
+	uint64_t				dentry_hits;
+	uint64_t				dentry_misses;
+	/* Maximum number of pages in the page cache (0 disables it). */
+	uint32_t				pcache_max_pages;
+	/* Maximum size of a readahead window (pages, 0 disables
+	   readahead). */
+	uint32_t				ra_max_pages;
+	/* Number of pages read by uk_fuse_pcache_read(), that have/have not
+	   been cached and up to date. */
+	uint64_t				pcache_hits;
+	uint64_t				pcache_misses;
+	/* Number of pages requested by readahead. */
+	uint64_t				ra_pages;
+	/* Maximum memory used by the dirty ranges of the writeback cache
+	   (bytes, 0 disables it). */
+	uint64_t				wb_max_bytes;
+	/* Dirty ranges are written, once they have been dirty this long
+	   (milliseconds, 0 only writes them when flushed or when they use
+	   too much memory). */
+	uint32_t				wb_delay_ms;
+	/* Number of writes merged into dirty ranges, and of FUSE_WRITE
+	   requests sent to write dirty ranges. */
+	uint64_t				wb_writes;
+	uint64_t				wb_flushes;
+	/* Number of notifications received from the device. */
+	uint64_t				notifies;
+
+	/* The device replied ENOSYS to FUSE_COPY_FILE_RANGE. */
+	bool					no_copy_file_range;
+	/* The device replied ENOSYS to FUSE_FALLOCATE. */
+	bool					no_fallocate;
 
 	/* Uid/Gid used to describe files' owner on the host side. */
 	uint32_t				owner_uid;
 	uint32_t				owner_gid;
 	/* @internal Request management. */
 	struct uk_fusedev_req_mgmt		_req_mgmt;
+	/* @internal Forgets not yet sent. */
+	struct uk_fusedev_forget_queue		_forgets;
+	/* @internal Nodeids handed out by the device. */
+	struct uk_fuse_node_table		_nodes;
+	/* @internal Lookup results. */
+	struct uk_fuse_dentry_cache		_dentries;
+	/* @internal Cached pages of files. */
+	struct uk_fuse_pcache			_pcache;
+	/* @internal Dirty data of files. */
+	struct uk_fuse_wb			_wb;
+	/* @internal Notifications sent by the device. */
+	struct uk_fuse_notify			_notify;
 #if CONFIG_LIBUKSCHED
 	/*
 	 * Slept on by threads waiting for their turn for enough space to send
@@ -170,8 +374,21 @@ struct uk_fuse_dev {
 #endif
 };
 
+
 #define INIT_FUSE_DEV(dev) *dev = (struct uk_fuse_dev) \
-	{.owner_uid = 0, .owner_gid = 0}
+	{.owner_uid = 0, .owner_gid = 0,				\
+	 .io_window = CONFIG_LIBUKFUSE_IO_WINDOW,			\
+	 .poll_budget = CONFIG_LIBUKFUSE_POLL_BUDGET,			\
+	 .forget_batch = CONFIG_LIBUKFUSE_FORGET_BATCH,			\
+	 .forget_delay_ms = CONFIG_LIBUKFUSE_FORGET_DELAY_MS,		\
+	 .attr_cache = UK_FUSE_ATTR_CACHE_DEFAULT,			\
+	 .attr_min_ms = CONFIG_LIBUKFUSE_ATTR_CACHE_MIN_MS,		\
+	 .dentry_max = CONFIG_LIBUKFUSE_DENTRY_CACHE_SIZE,		\
+	 .neg_entry_ms = CONFIG_LIBUKFUSE_NEG_ENTRY_MS,			\
+	 .pcache_max_pages = CONFIG_LIBUKFUSE_PAGE_CACHE_KB / 4,	\
+	 .ra_max_pages = CONFIG_LIBUKFUSE_READAHEAD_KB / 4,		\
+	 .wb_max_bytes = CONFIG_LIBUKFUSE_WRITEBACK_KB * 1024ULL,	\
+	 .wb_delay_ms = CONFIG_LIBUKFUSE_WRITEBACK_DELAY_MS}
 
 #ifdef __cplusplus
 }
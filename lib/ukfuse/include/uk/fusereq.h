@@ -71,14 +71,24 @@
 #include "limits.h"
 #include "uk/fuse_i.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <limits.h>
 #include <uk/arch/types.h>
+#include <uk/arch/spinlock.h>
+#include <uk/arch/lcpu.h>
+#include <uk/essentials.h>
 #include <uk/refcount.h>
 #include <uk/list.h>
 #include <uk/wait_types.h>
 
 #define FUSE_DEFAULT_MAX_PAGES_PER_REQ  32
 
+/* Size of the inline in/out buffers of a request. They are large enough for
+   the headers of the metadata requests (e.g., FUSE_LOOKUP with a name of
+   NAME_MAX characters), which then do not need any further allocation. */
+#define UK_FUSEREQ_INLINE_IN_SIZE	320
+#define UK_FUSEREQ_INLINE_OUT_SIZE	192
+
 #define INVALID_FILE_HANDLE (((uint64_t) (-1)))
 #define INVALID_MODE_ATTRIBUTES (((uint32_t) (-1)))
 
@@ -100,6 +110,41 @@ enum uk_fusereq_state {
 	UK_FUSEREQ_RECEIVED
 };
 
+/**
+ * Describes the zero-copy direction of a request.
+ *
+ * - NONE: All data is part of in_buffer and out_buffer.
+ * - READ: The reply payload is written by the device directly into zc_buf,
+ *   right after out_buffer (e.g., FUSE_READ).
+ * - WRITE: zc_buf is sent to the device right after in_buffer
+ *   (e.g., FUSE_WRITE).
+ */
+enum uk_fusereq_zcdir {
+	UK_FUSEREQ_ZCDIR_NONE = 0,
+	UK_FUSEREQ_ZCDIR_READ,
+	UK_FUSEREQ_ZCDIR_WRITE
+};
+
+struct uk_fuse_req;
+struct uk_allocpool;
+
+/**
+ * Function type invoked once the reply to an asynchronously submitted request
+ * has been received.
+ *
+ * It is called from the receive path of the transport (possibly in interrupt
+ * context) and therefore must not block. The callback owns the creator's
+ * reference to the request and has to release it with
+ * uk_fusedev_req_remove() once it is done with the reply (either directly or
+ * later on, e.g., after handing the request over to a completion queue).
+ *
+ * @param req
+ *   The completed request. req->rc holds the result of the request.
+ * @param done_arg
+ *   Argument supplied when submitting the request.
+ */
+typedef void (*uk_fusereq_done_t)(struct uk_fuse_req *req, void *done_arg);
+
 
 struct uk_fuse_req {
 	void 				*in_buffer;
@@ -108,17 +153,63 @@ struct uk_fuse_req {
 	uint32_t 			out_buffer_size;
 	/* State of the request. See the state enum for details. */
 	enum uk_fusereq_state		state;
+	/* Result of the request (0 or a negative FUSE error code). Valid once
+	   the request is in the UK_FUSEREQ_RECEIVED state. */
+	int				rc;
+	/* Completion callback of an asynchronous request (NULL otherwise). */
+	uk_fusereq_done_t		done;
+	void				*done_arg;
+	/* Zero-copy direction. See the zcdir enum for details. */
+	enum uk_fusereq_zcdir		zc_dir;
+	/* Caller supplied zero-copy buffer. It is handed to the transport as
+	   is and has to stay valid until the request is received. */
+	void				*zc_buf;
+	/* Zero-copy buffer size. */
+	uint32_t			zc_size;
+	/* Send on the high priority queue of the transport, if it has one
+	   (e.g., FUSE_FORGET and FUSE_BATCH_FORGET with virtio-fs). */
+	bool				hiprio;
+	/* @internal Request owned memory backing in_buffer and out_buffer.
+	   Freed, when the last reference to the request is dropped. */
+	void				*_buf;
+	/* @internal Entry into the list of a completion queue. */
+	struct uk_list_head		_cq_list;
 	/* @internal Entry into the list of requests (API-internal). */
 	struct uk_list_head		_list;
 	/* @internal FUSE device  request belongs to. */
 	struct uk_fuse_dev		*_dev;
 	/* @internal Allocator used to allocate this request. */
 	struct uk_alloc			*_a;
+	/* @internal Pool this request was taken from (NULL, if it has been
+	   allocated with _a). */
+	struct uk_allocpool		*_pool;
 	/* Tracks the number of references to this structure. */
 	__atomic 			refcount;
 #if CONFIG_LIBUKSCHED
 	/* Wait-queue for state changes. */
 	struct uk_waitq			wq;
+#endif
+	/* @internal Inline storage for in_buffer and out_buffer. */
+	char				_inline_in[UK_FUSEREQ_INLINE_IN_SIZE]
+					__align(CACHE_LINE_SIZE);
+	char				_inline_out[UK_FUSEREQ_INLINE_OUT_SIZE]
+					__align(CACHE_LINE_SIZE);
+};
+
+/**
+ * A completion queue, asynchronous requests may be delivered to.
+ *
+ * Submit requests with uk_fuse_cq_post() as completion callback and the queue
+ * as callback argument to collect their completions in one place.
+ */
+struct uk_fuse_cq {
+	/* Spinlock protecting the list of completed requests. */
+	__spinlock			lock;
+	/* Completed requests, not yet retrieved by the owner of the queue. */
+	struct uk_list_head		done_list;
+#if CONFIG_LIBUKSCHED
+	/* Slept on by threads waiting for completions. */
+	struct uk_waitq			wq;
 #endif
 };
 
@@ -323,6 +414,8 @@ typedef struct
 	struct fuse_out_header hdr;
 } FUSE_SETUPMAPPING_OUT;
 
+/* Packed, since the entries follow the 4-byte count without padding on the
+   wire */
 typedef struct
 {
 	struct fuse_in_header hdr;
@@ -332,7 +425,7 @@ typedef struct
 	struct fuse_removemapping_one removemapping_one[4096
 		/ sizeof(struct fuse_removemapping_one)];
 
-} FUSE_REMOVEMAPPING_IN;
+} __packed __align(8) FUSE_REMOVEMAPPING_IN;
 
 
 typedef struct
@@ -359,6 +452,29 @@ typedef struct
 	struct fuse_out_header hdr;
 } FUSE_FSYNC_OUT;
 
+typedef struct
+{
+	struct fuse_in_header hdr;
+	struct fuse_copy_file_range_in copy_file_range;
+} FUSE_COPY_FILE_RANGE_IN;
+
+typedef struct
+{
+	struct fuse_out_header hdr;
+	struct fuse_write_out write;
+} FUSE_COPY_FILE_RANGE_OUT;
+
+typedef struct
+{
+	struct fuse_in_header hdr;
+	struct fuse_fallocate_in fallocate;
+} FUSE_FALLOCATE_IN;
+
+typedef struct
+{
+	struct fuse_out_header hdr;
+} FUSE_FALLOCATE_OUT;
+
 
 
 
@@ -368,6 +484,13 @@ int uk_fusereq_put(struct uk_fuse_req *req);
 int uk_fusereq_receive_cb(struct uk_fuse_req *req, uint32_t len __unused);
 int uk_fusereq_waitreply(struct uk_fuse_req *req);
 
+void uk_fuse_cq_init(struct uk_fuse_cq *cq);
+void uk_fuse_cq_post(struct uk_fuse_req *req, void *cq);
+unsigned int uk_fuse_cq_poll(struct uk_fuse_cq *cq, struct uk_fuse_req **reqs,
+			     unsigned int cnt);
+unsigned int uk_fuse_cq_wait(struct uk_fuse_cq *cq, struct uk_fuse_req **reqs,
+			     unsigned int cnt);
+
 
 
 #endif /* __LINUX_FUSEREQ_H__ */
\ No newline at end of file
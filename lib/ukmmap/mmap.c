@@ -37,10 +37,18 @@
 #include <string.h>
 #include <uk/syscall.h>
 #include <uk/page.h>
+#include <uk/config.h>
+#if CONFIG_LIBVFSCORE
+#include <vfscore/file.h>
+#endif
 
 struct mmap_addr {
 	void *begin;
 	void *end;
+#if CONFIG_LIBVFSCORE
+	/* File mapped by its file system, NULL for memory */
+	struct vfscore_file *fp;
+#endif
 	struct mmap_addr *next;
 };
 
@@ -62,7 +70,122 @@ static struct mmap_addr *mmap_addr;
  * @fildes =	-1
  * @off    =	0
  *
+ * With vfscore, files are mapped by their file system, if it supports it
+ * (see mmap_file()).
+ */
+
+#if CONFIG_LIBVFSCORE
+static int mmap_add(void *begin, size_t len, struct vfscore_file *fp)
+{
+	struct mmap_addr *new, *last = mmap_addr;
+
+	new = uk_malloc(uk_alloc_get_default(), sizeof(struct mmap_addr));
+	if (!new)
+		return ENOMEM;
+
+	new->begin = begin;
+	new->end = (char *) begin + len;
+	new->fp = fp;
+	new->next = NULL;
+	if (!mmap_addr) {
+		mmap_addr = new;
+	} else {
+		while (last->next)
+			last = last->next;
+		last->next = new;
+	}
+	return 0;
+}
+
+/* Copies the file into memory, for private mappings */
+static void *mmap_file_copy(size_t len, int fildes, off_t off)
+{
+	void *mem;
+	size_t pos = 0;
+	ssize_t bytes;
+	int rc;
+
+	mem = uk_memalign(uk_alloc_get_default(), __PAGE_SIZE, len);
+	if (!mem) {
+		errno = ENOMEM;
+		return (void *) -1;
+	}
+
+	/* The part beyond the end of the file reads as zero */
+	memset(mem, 0, len);
+	while (pos < len) {
+		bytes = uk_syscall_r_pread64((long) fildes,
+					     (long) ((char *) mem + pos),
+					     (long) (len - pos),
+					     (long) (off + pos));
+		if (bytes < 0) {
+			rc = (int) -bytes;
+			goto err_free;
+		}
+		if (!bytes)
+			break;
+		pos += bytes;
+	}
+
+	rc = mmap_add(mem, len, NULL);
+	if (rc)
+		goto err_free;
+	return mem;
+
+err_free:
+	uk_free(uk_alloc_get_default(), mem);
+	errno = rc;
+	return (void *) -1;
+}
+
+/*
+ * Maps a file through vfscore_mmap(), e.g., onto the DAX window of virtiofs.
+ * The mapping holds a reference to the file until it is unmapped. Private
+ * mappings of files that cannot be mapped, and writable private mappings,
+ * are copies of the file.
  */
+static void *mmap_file(size_t len, int prot, int flags, int fildes, off_t off)
+{
+	struct vfscore_file *fp;
+	void *mem;
+	int rc;
+
+	if (fildes < 0 || fildes >= FDTABLE_MAX_FILES) {
+		errno = EBADF;
+		return (void *) -1;
+	}
+	if (!(flags & (MAP_SHARED | MAP_PRIVATE)) || (flags & MAP_FIXED)) {
+		errno = EINVAL;
+		return (void *) -1;
+	}
+
+	fp = vfscore_get_file(fildes);
+	if (!fp) {
+		errno = EBADF;
+		return (void *) -1;
+	}
+
+	rc = vfscore_mmap(fp, off, len, prot, flags, &mem);
+	if (rc == ENODEV && (flags & MAP_PRIVATE)) {
+		vfscore_put_file(fp);
+		return mmap_file_copy(len, fildes, off);
+	}
+	if (rc)
+		goto err_put;
+
+	rc = mmap_add(mem, len, fp);
+	if (rc) {
+		vfscore_munmap(fp, mem, len);
+		goto err_put;
+	}
+	return mem;
+
+err_put:
+	vfscore_put_file(fp);
+	errno = rc;
+	return (void *) -1;
+}
+#endif /* CONFIG_LIBVFSCORE */
 
 UK_SYSCALL_DEFINE(void*, mmap, void*, addr, size_t, len, int, prot,
 		int, flags, int, fildes, off_t, off)
@@ -74,6 +197,11 @@ UK_SYSCALL_DEFINE(void*, mmap, void*, addr, size_t, len, int, prot,
 		return (void *) -1;
 	}
 
+#if CONFIG_LIBVFSCORE
+	if (!(flags & MAP_ANON) && fildes != -1)
+		return mmap_file(len, prot, flags, fildes, off);
+#endif
+
 	/* Check if parameters match the ones that go use
 	 * Otherwise return 0 (unimplemented mmap)
 	 */
@@ -113,6 +241,9 @@ UK_SYSCALL_DEFINE(void*, mmap, void*, addr, size_t, len, int, prot,
 
 	new->begin = mem;
 	new->end = mem + len;
+#if CONFIG_LIBVFSCORE
+	new->fp = NULL;
+#endif
 	new->next = NULL;
 	if (!mmap_addr)
 		mmap_addr = new;
@@ -153,12 +284,30 @@ UK_SYSCALL_DEFINE(int, munmap, void*, addr, size_t, len)
 			if (len != (__uptr)tmp->end - (__uptr)tmp->begin)
 				return 0;
 
+#if CONFIG_LIBVFSCORE
+			if (tmp->fp) {
+				int rc = vfscore_munmap(tmp->fp, addr, len);
+
+				if (rc) {
+					errno = rc;
+					return -1;
+				}
+			}
+#endif
+
 			/* Caller wants to unmap the whole region. Easy! */
 			if (!prev)
 				mmap_addr = tmp->next;
 			else
 				prev->next = tmp->next;
 
+#if CONFIG_LIBVFSCORE
+			if (tmp->fp) {
+				vfscore_put_file(tmp->fp);
+				uk_free(uk_alloc_get_default(), tmp);
+				return 0;
+			}
+#endif
 			uk_free(uk_alloc_get_default(), tmp);
 			uk_free(uk_alloc_get_default(), addr);
 			return 0;
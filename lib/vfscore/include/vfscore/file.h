@@ -76,6 +76,13 @@ void vfscore_put_file(struct vfscore_file *file);
 void fhold(struct vfscore_file* fp);
 int fdrop(struct vfscore_file* fp);
 
+/*
+ * Mapping of files into the address space, for file systems that support it
+ */
+int vfscore_mmap(struct vfscore_file *fp, off_t off, size_t len, int prot,
+		 int flags, void **addr);
+int vfscore_munmap(struct vfscore_file *fp, void *addr, size_t len);
+
 #define FOF_OFFSET  0x0800    /* Use the offset in uio argument */
 
 /* Also used from posix-sysinfo to determine sysconf(_SC_OPEN_MAX). */
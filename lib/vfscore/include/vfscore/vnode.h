@@ -171,6 +171,13 @@ typedef int (*vnop_cache_t) (struct vnode *, struct vfscore_file *, struct uio *
 typedef int (*vnop_fallocate_t) (struct vnode *, int, off_t, off_t);
 typedef int (*vnop_readlink_t)  (struct vnode *, struct uio *);
 typedef int (*vnop_symlink_t)   (struct vnode *, char *, char *);
+typedef int (*vnop_copy_file_range_t) (struct vfscore_file *, off_t,
+				       struct vfscore_file *, off_t, size_t,
+				       size_t *);
+typedef int (*vnop_mmap_t)	(struct vnode *, struct vfscore_file *, off_t,
+				 size_t, int, int, void **);
+typedef int (*vnop_munmap_t)	(struct vnode *, struct vfscore_file *, void *,
+				 size_t);
 
 /*
  * vnode operations
@@ -199,6 +206,11 @@ struct vnops {
 	vnop_fallocate_t	vop_fallocate;
 	vnop_readlink_t		vop_readlink;
 	vnop_symlink_t		vop_symlink;
+	/* Optional, data is copied through the guest otherwise. */
+	vnop_copy_file_range_t	vop_copy_file_range;
+	/* Optional, mmap() of the file is not supported otherwise. */
+	vnop_mmap_t		vop_mmap;
+	vnop_munmap_t		vop_munmap;
 };
 
 /*
@@ -228,6 +240,11 @@ struct vnops {
 #define VOP_FALLOCATE(VP, M, OFF, LEN) ((VP)->v_op->vop_fallocate)(VP, M, OFF, LEN)
 #define VOP_READLINK(VP, U)        ((VP)->v_op->vop_readlink)(VP, U)
 #define VOP_SYMLINK(DVP, OP, NP)   ((DVP)->v_op->vop_symlink)(DVP, OP, NP)
+#define VOP_COPY_FILE_RANGE(VP, FPI, OI, FPO, OO, L, C) \
+			   ((VP)->v_op->vop_copy_file_range)(FPI, OI, FPO, OO, L, C)
+#define VOP_MMAP(VP, FP, OFF, L, P, F, A) \
+			   ((VP)->v_op->vop_mmap)(VP, FP, OFF, L, P, F, A)
+#define VOP_MUNMAP(VP, FP, A, L)   ((VP)->v_op->vop_munmap)(VP, FP, A, L)
 
 int vfscore_vop_nullop();
 int vfscore_vop_einval();
@@ -2232,6 +2232,21 @@ UK_SYSCALL_R_DEFINE(int, fallocate, int, fd, int, mode, loff_t, offset, loff_t,
 
 LFS64(fallocate);
 
+#if UK_LIBC_SYSCALLS
+int posix_fallocate(int fd, off_t offset, off_t len)
+{
+	/* The error is returned, errno is not set */
+	return -uk_syscall_r_fallocate((long) fd, 0, (long) offset,
+				       (long) len);
+}
+
+#ifdef posix_fallocate64
+#undef posix_fallocate64
+#endif
+
+LFS64(posix_fallocate);
+#endif /* UK_LIBC_SYSCALLS */
+
 UK_TRACEPOINT(trace_vfs_utimes, "\"%s\"", const char*);
 UK_TRACEPOINT(trace_vfs_utimes_ret, "");
 UK_TRACEPOINT(trace_vfs_utimes_err, "%d", int);
@@ -2461,87 +2476,89 @@ UK_SYSCALL_R_DEFINE(int, lchown, const char*, path, uid_t, owner, gid_t, group)
 }
 
 
-#if 0
-ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
-{
-	struct vfscore_file *in_fp;
-	struct vfscore_file *out_fp;
-	fileref in_f{fileref_from_fd(in_fd)};
-	fileref out_f{fileref_from_fd(out_fd)};
+UK_TRACEPOINT(trace_vfs_sendfile, "%d %d %p 0x%x", int, int, off_t *, size_t);
+UK_TRACEPOINT(trace_vfs_sendfile_ret, "0x%x", ssize_t);
+UK_TRACEPOINT(trace_vfs_sendfile_err, "%d", int);
 
-	if (!in_f || !out_f) {
-		return libc_error(EBADF);
-	}
+UK_SYSCALL_R_DEFINE(ssize_t, sendfile, int, out_fd, int, in_fd,
+		    off_t *, offset, size_t, count)
+{
+	struct vfscore_file *in_fp, *out_fp;
+	size_t bytes;
+	int error;
 
-	in_fp = in_f.get();
-	out_fp = out_f.get();
+	trace_vfs_sendfile(out_fd, in_fd, offset, count);
+	error = fget(in_fd, &in_fp);
+	if (error)
+		goto out_error;
 
-	if (!in_fp->f_dentry) {
-		return libc_error(EBADF);
-	}
+	error = fget(out_fd, &out_fp);
+	if (error)
+		goto out_error_in;
 
-	if (!(in_fp->f_flags & UK_FREAD))
-		return libc_error(EBADF);
+	error = sys_sendfile(out_fp, in_fp, offset, count, &bytes);
+	fdrop(out_fp);
+out_error_in:
+	fdrop(in_fp);
 
-	if (out_fp->f_type & DTYPE_VNODE) {
-		if (!out_fp->f_dentry)
-			return libc_error(EBADF);
-		else if (!(out_fp->f_flags & UK_FWRITE))
-			return libc_error(EBADF);
-	}
+	if (error)
+		goto out_error;
+	trace_vfs_sendfile_ret(bytes);
+	return bytes;
 
-	off_t offset ;
+	out_error:
+	trace_vfs_sendfile_err(error);
+	return -error;
+}
 
-	if (_offset != nullptr) {
-		offset = *_offset;
-	} else {
-		/* if _offset is nullptr, we need to read from the present position of in_fd */
-		offset = lseek(in_fd, 0, SEEK_CUR);
-	}
+#ifdef sendfile64
+#undef sendfile64
+#endif
 
-	// Constrain count to the extent of the file...
-	struct stat st;
-	if (fstat(in_fd, &st) < 0) {
-		return -1;
-	} else {
-		if (offset >= st.st_size) {
-			return 0;
-		} else if ((offset + count) >= st.st_size) {
-			count = st.st_size - offset;
-			if (count == 0) {
-				return 0;
-			}
-		}
-	}
+LFS64(sendfile);
 
-	size_t bytes_to_mmap = count + (offset % mmu::page_size);
-	off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
+UK_TRACEPOINT(trace_vfs_copy_file_range, "%d %p %d %p 0x%x 0x%x", int,
+	      off_t *, int, off_t *, size_t, unsigned int);
+UK_TRACEPOINT(trace_vfs_copy_file_range_ret, "0x%x", ssize_t);
+UK_TRACEPOINT(trace_vfs_copy_file_range_err, "%d", int);
 
-	char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ, MAP_SHARED, in_fd, offset_for_mmap));
+UK_SYSCALL_R_DEFINE(ssize_t, copy_file_range, int, fd_in, off_t *, off_in,
+		    int, fd_out, off_t *, off_out, size_t, len,
+		    unsigned int, flags)
+{
+	struct vfscore_file *fp_in, *fp_out;
+	size_t bytes;
+	int error;
 
-	if (src == MAP_FAILED) {
-		return -1;
+	trace_vfs_copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+	if (flags) {
+		error = EINVAL;
+		goto out_error;
 	}
 
-	int ret = write(out_fd, src + (offset % PAGESIZE), count);
-
-	if (ret < 0) {
-		return libc_error(errno);
-	} else if(_offset == nullptr) {
-		lseek(in_fd, ret, SEEK_CUR);
-	} else {
-		*_offset += ret;
-	}
+	error = fget(fd_in, &fp_in);
+	if (error)
+		goto out_error;
 
-	assert(munmap(src, count) == 0);
+	error = fget(fd_out, &fp_out);
+	if (error)
+		goto out_error_in;
 
-	return ret;
-}
+	error = sys_copy_file_range(fp_in, off_in, fp_out, off_out, len,
+				    &bytes);
+	fdrop(fp_out);
+out_error_in:
+	fdrop(fp_in);
 
-#undef sendfile64
+	if (error)
+		goto out_error;
+	trace_vfs_copy_file_range_ret(bytes);
+	return bytes;
 
-LFS64(sendfile);
-#endif
+	out_error:
+	trace_vfs_copy_file_range_err(error);
+	return -error;
+}
 
 int posix_fadvise(int fd __unused, off_t offset __unused, off_t len __unused,
 		int advice)
@@ -45,6 +45,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include <dirent.h>
 #include <vfscore/prex.h>
@@ -53,6 +54,8 @@
 
 #include "vfs.h"
 #include <vfscore/fs.h>
+#include <uk/essentials.h>
+#include <uk/arch/limits.h>
 
 extern struct task *main_task;
 
@@ -1491,6 +1494,217 @@ ret:
 	return error;
 }
 
+/* Size of the buffer data is copied through, if it cannot be copied by the
+   file system */
+#define COPY_BUFSZ	(64 * 1024)
+
+/*
+ * Copies data by reading it into a buffer and writing it out. If pos_out is
+ * -1, data is written at the current offset of fp_out, which is advanced.
+ */
+static int
+copy_file_generic(struct vfscore_file *fp_in, off_t pos_in,
+		  struct vfscore_file *fp_out, off_t pos_out, size_t len,
+		  size_t *count)
+{
+	struct iovec iov;
+	size_t nread, nwritten;
+	char *buf;
+	int error = 0;
+
+	buf = malloc(MIN(len, (size_t) COPY_BUFSZ));
+	if (!buf)
+		return ENOMEM;
+
+	while (*count < len) {
+		iov.iov_base = buf;
+		iov.iov_len = MIN(len - *count, (size_t) COPY_BUFSZ);
+		error = sys_read(fp_in, &iov, 1, pos_in + (off_t) *count, &nread);
+		if (error || !nread)
+			break;
+
+		iov.iov_len = nread;
+		error = sys_write(fp_out, &iov, 1,
+				  (pos_out == -1) ? -1 : pos_out + (off_t) *count,
+				  &nwritten);
+		*count += nwritten;
+		if (error || nwritten < nread)
+			break;
+	}
+
+	free(buf);
+	/* Report the data copied before the error */
+	return *count ? 0 : error;
+}
+
+int
+sys_copy_file_range(struct vfscore_file *fp_in, off_t *off_in,
+		    struct vfscore_file *fp_out, off_t *off_out, size_t len,
+		    size_t *count)
+{
+	struct vnode *vp_in, *vp_out;
+	off_t pos_in, pos_out;
+	int error;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_copy_file_range: fp_in=%p fp_out=%p\n",
+				fp_in, fp_out));
+
+	*count = 0;
+	if (!(fp_in->f_flags & UK_FREAD) || !(fp_out->f_flags & UK_FWRITE)
+	    || (fp_out->f_flags & O_APPEND))
+		return EBADF;
+	if (!fp_in->f_dentry || !fp_out->f_dentry)
+		return EINVAL;
+
+	vp_in = fp_in->f_dentry->d_vnode;
+	vp_out = fp_out->f_dentry->d_vnode;
+	if (vp_in->v_type == VDIR || vp_out->v_type == VDIR)
+		return EISDIR;
+	if (vp_in->v_type != VREG || vp_out->v_type != VREG)
+		return EINVAL;
+
+	pos_in = off_in ? *off_in : fp_in->f_offset;
+	pos_out = off_out ? *off_out : fp_out->f_offset;
+	if (pos_in < 0 || pos_out < 0)
+		return EINVAL;
+	if (len > (size_t) (LONG_MAX - MAX(pos_in, pos_out)))
+		len = LONG_MAX - MAX(pos_in, pos_out);
+	if (vp_in == vp_out && pos_in < (off_t) (pos_out + len)
+	    && pos_out < (off_t) (pos_in + len))
+		return EINVAL;
+	if (!len)
+		return 0;
+
+	/* Let the file system copy, e.g., on the host of a shared file
+	   system */
+	error = EOPNOTSUPP;
+	if (vp_in->v_mount == vp_out->v_mount
+	    && vp_in->v_op->vop_copy_file_range) {
+		/* Always lock in the same order */
+		if (vp_in < vp_out) {
+			vn_lock(vp_in);
+			vn_lock(vp_out);
+		} else {
+			vn_lock(vp_out);
+			if (vp_in != vp_out)
+				vn_lock(vp_in);
+		}
+
+		error = VOP_COPY_FILE_RANGE(vp_in, fp_in, pos_in, fp_out,
+					    pos_out, len, count);
+
+		if (vp_in != vp_out)
+			vn_unlock(vp_in);
+		vn_unlock(vp_out);
+	}
+
+	if (error == EOPNOTSUPP || error == ENOSYS || error == EXDEV)
+		error = copy_file_generic(fp_in, pos_in, fp_out, pos_out, len,
+					  count);
+	if (error)
+		return error;
+
+	if (off_in)
+		*off_in += *count;
+	else
+		fp_in->f_offset += *count;
+	if (off_out)
+		*off_out += *count;
+	else
+		fp_out->f_offset += *count;
+	return 0;
+}
+
+int
+sys_sendfile(struct vfscore_file *fp_out, struct vfscore_file *fp_in,
+	     off_t *offset, size_t count, size_t *bytes)
+{
+	off_t pos;
+	int error;
+
+	DPRINTF(VFSDB_SYSCALL, ("sys_sendfile: fp_out=%p fp_in=%p\n",
+				fp_out, fp_in));
+
+	*bytes = 0;
+	if (!(fp_in->f_flags & UK_FREAD) || !(fp_out->f_flags & UK_FWRITE))
+		return EBADF;
+	if (!fp_in->f_dentry || fp_in->f_dentry->d_vnode->v_type != VREG)
+		return EINVAL;
+
+	/* Between regular files, the file system may copy the data */
+	if (fp_out->f_dentry && fp_out->f_dentry->d_vnode->v_type == VREG
+	    && !(fp_out->f_flags & O_APPEND))
+		return sys_copy_file_range(fp_in, offset, fp_out, NULL, count,
+					   bytes);
+
+	pos = offset ? *offset : fp_in->f_offset;
+	if (pos < 0)
+		return EINVAL;
+
+	error = copy_file_generic(fp_in, pos, fp_out, -1, count, bytes);
+	if (error)
+		return error;
+
+	if (offset)
+		*offset += *bytes;
+	else
+		fp_in->f_offset += *bytes;
+	return 0;
+}
+
+int
+vfscore_mmap(struct vfscore_file *fp, off_t off, size_t len, int prot,
+	     int flags, void **addr)
+{
+	struct vnode *vp;
+	int error;
+
+	DPRINTF(VFSDB_SYSCALL, ("vfscore_mmap: fp=%p off=%ld len=%zu\n",
+				fp, (long) off, len));
+
+	if (!len || off < 0 || off & (__PAGE_SIZE - 1))
+		return EINVAL;
+	if (!(fp->f_flags & UK_FREAD))
+		return EACCES;
+	/* Writes through a shared mapping go to the file */
+	if ((flags & MAP_SHARED) && (prot & PROT_WRITE)
+	    && !(fp->f_flags & UK_FWRITE))
+		return EACCES;
+	if (!fp->f_dentry)
+		return ENODEV;
+
+	vp = fp->f_dentry->d_vnode;
+	if (vp->v_type != VREG || !vp->v_op->vop_mmap)
+		return ENODEV;
+
+	vn_lock(vp);
+	error = VOP_MMAP(vp, fp, off, len, prot, flags, addr);
+	vn_unlock(vp);
+	return error;
+}
+
+int
+vfscore_munmap(struct vfscore_file *fp, void *addr, size_t len)
+{
+	struct vnode *vp;
+	int error;
+
+	DPRINTF(VFSDB_SYSCALL, ("vfscore_munmap: fp=%p addr=%p len=%zu\n",
+				fp, addr, len));
+
+	if (!fp->f_dentry)
+		return EINVAL;
+
+	vp = fp->f_dentry->d_vnode;
+	if (!vp->v_op->vop_munmap)
+		return EINVAL;
+
+	vn_lock(vp);
+	error = VOP_MUNMAP(vp, fp, addr, len);
+	vn_unlock(vp);
+	return error;
+}
+
 int
 sys_chmod(const char *path, mode_t mode)
 {
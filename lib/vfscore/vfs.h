@@ -109,6 +109,11 @@ int  sys_utimensat(int dirfd, const char *pathname,
 				   const struct timespec times[2], int flags);
 int  sys_futimens(int fd, const struct timespec times[2]);
 int  sys_fallocate(struct vfscore_file *fp, int mode, loff_t offset, loff_t len);
+int  sys_copy_file_range(struct vfscore_file *fp_in, off_t *off_in,
+			 struct vfscore_file *fp_out, off_t *off_out,
+			 size_t len, size_t *count);
+int  sys_sendfile(struct vfscore_file *fp_out, struct vfscore_file *fp_in,
+		  off_t *offset, size_t count, size_t *bytes);
 
 int	 sys_pivot_root(const char *new_root, const char *old_put);
 void	 sync(void);
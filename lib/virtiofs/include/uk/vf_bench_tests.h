@@ -1,7 +0,0 @@
-#ifndef __VF_BENCH_TESTS_H__
-#define __VF_BENCH_TESTS_H__
-
-struct uk_vfdev uk_vf_connect(void);
-
-
-#endif /* __VF_BENCH_TESTS_H__ */
\ No newline at end of file
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_VF_DAX__
+#define __UK_VF_DAX__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uk/arch/spinlock.h>
+#include <uk/arch/types.h>
+#include <uk/wait_types.h>
+#include <uk/list.h>
+#include <uk/config.h>
+#include <uk/fusereq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uk_fuse_dev;
+struct uk_thread;
+
+/**
+ * Chunk of the DAX window, mapping one chunk of a file.
+ */
+struct uk_vf_dax_chunk {
+	/* Entry in the hash bucket of (nodeid, index), while mapped. */
+	struct uk_hlist_node		hash;
+	/* Entry in the LRU list while mapped, or in the free list. */
+	struct uk_list_head		lru;
+	uint64_t			nodeid;
+	/* Offset in the file in chunks. */
+	uint64_t			index;
+	/* Number of users accessing the window through the chunk. A chunk
+	   with users is not evicted. */
+	uint32_t			refs;
+	/* Whether the mapping is being set up. */
+	bool				busy;
+	/* Whether the mapping has been set up for writing. */
+	bool				writable;
+};
+
+/**
+ * File range mapped into the address space through chunks of the DAX
+ * window, which stay referenced until it is unmapped.
+ */
+struct uk_vf_dax_mapping {
+	/* Entry in the list of mappings. */
+	struct uk_list_head		list;
+	/* Address returned by uk_vf_dax_mmap(). */
+	void				*addr;
+	size_t				len;
+	/* Whether the chunks are mapped one after another at vaddr in the
+	   mmap area. Otherwise, addr points into the only chunk. */
+	bool				remapped;
+	__vaddr_t			vaddr;
+	uint32_t			nchunks;
+	struct uk_vf_dax_chunk		*chunks[];
+};
+
+/**
+ * DAX window of a virtiofs device. The window is split into chunks of
+ * chunk_size bytes, each mapping one chunk of a file. Mapped chunks are
+ * unmapped least recently used first, once no chunk is free.
+ */
+struct uk_vf_dax {
+	/* Spinlock protecting this data. */
+	__spinlock			spinlock;
+	/* FUSE device setting up the mappings. */
+	struct uk_fuse_dev		*dev;
+	/* Start of the window. */
+	char				*base;
+	/* Size of a chunk (a multiple of dev->map_alignment). */
+	uint64_t			chunk_size;
+	uint32_t			nchunks;
+	/* chunks[i] is mapped at base + i * chunk_size. */
+	struct uk_vf_dax_chunk		*chunks;
+	/* Hash buckets of the mapped chunks. */
+	struct uk_hlist_head		*buckets;
+	/* Number of buckets (a power of two). */
+	uint32_t			nbuckets;
+	/* Mapped chunks, most recently used first. */
+	struct uk_list_head		lru;
+	/* Chunks without a mapping. */
+	struct uk_list_head		free;
+	uint32_t			nfree;
+	/* Once fewer than free_low chunks are free, the reclaim thread
+	   unmaps chunks until free_high are free. */
+	uint32_t			free_low;
+	uint32_t			free_high;
+	/* Incremented, whenever a chunk has been mapped or released. */
+	uint32_t			gen;
+	/* Buffer of the FUSE_REMOVEMAPPING requests, used by one unmapping
+	   thread at a time. */
+	FUSE_REMOVEMAPPING_IN		*rm_in;
+	/* Whether rm_in is in use. */
+	bool				reclaiming;
+	/* File ranges mapped by uk_vf_dax_mmap(). Those in the mmap area
+	   are sorted by address. */
+	struct uk_list_head		mappings;
+	/* Number of chunks reserved by mappings, at most pin_max. */
+	uint32_t			pinned;
+	uint32_t			pin_max;
+#if CONFIG_LIBUKSCHED
+	/* Slept on by threads waiting for a chunk. */
+	struct uk_waitq			wq;
+	/* Slept on by the reclaim thread. */
+	struct uk_waitq			reclaim_wq;
+	struct uk_thread		*reclaimer;
+	bool				stop;
+#endif
+
+	/* Statistics */
+	uint64_t			hits;
+	uint64_t			misses;
+	uint64_t			evictions;
+	uint64_t			removemappings;
+	/* Unmapping batches by threads waiting for a chunk, and by the
+	   reclaim thread */
+	uint64_t			fg_reclaims;
+	uint64_t			bg_reclaims;
+};
+
+static inline char *uk_vf_dax_chunk_addr(const struct uk_vf_dax *dax,
+					 const struct uk_vf_dax_chunk *c)
+{
+	return dax->base + (uint64_t) (c - dax->chunks) * dax->chunk_size;
+}
+
+struct uk_vf_dax *uk_vf_dax_create(struct uk_fuse_dev *dev, uint64_t addr,
+				   uint64_t len);
+void uk_vf_dax_destroy(struct uk_vf_dax *dax);
+
+int uk_vf_dax_get(struct uk_vf_dax *dax, uint64_t nodeid, uint64_t fh,
+		  uint64_t file_off, bool write,
+		  struct uk_vf_dax_chunk **chunk);
+void uk_vf_dax_put(struct uk_vf_dax *dax, struct uk_vf_dax_chunk *c);
+int uk_vf_dax_reclaim(struct uk_vf_dax *dax, uint64_t nodeid, uint32_t max);
+void uk_vf_dax_invalidate(struct uk_vf_dax *dax, uint64_t nodeid);
+
+int uk_vf_dax_mmap(struct uk_vf_dax *dax, uint64_t nodeid, uint64_t fh,
+		   uint64_t file_off, size_t len, bool write, void **addr);
+int uk_vf_dax_munmap(struct uk_vf_dax *dax, void *addr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_VF_DAX__ */
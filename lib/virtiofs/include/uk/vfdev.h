@@ -2,6 +2,7 @@
 #define __UK_VFDEV__
 
 #include <uk/fusedev_core.h>
+#include <uk/vf_dax.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -47,6 +48,8 @@ struct uk_vfdev {
 	uint64_t			dax_addr;
 	/* Length of the DAX window. Valid only if dax_enabled==TRUE */
 	uint64_t			dax_len;
+	/* Chunks of the DAX window. Valid only if dax_enabled==TRUE */
+	struct uk_vf_dax		*dax;
 };
 
 
@@ -0,0 +1,786 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Manager of the DAX window of a virtiofs device.
+ *
+ * The window is split into chunks of CONFIG_LIBVIRTIOFS_DAX_CHUNK_KB,
+ * rounded up to the map alignment of the device. Each chunk maps one chunk
+ * of a file, set up with FUSE_SETUPMAPPING on the first access. Mapped
+ * chunks are looked up in one hash table keyed by nodeid and chunk index, so
+ * repeated accesses to a file need no request to the device. Once no chunk
+ * is free, a batch of the least recently used chunks without users is
+ * unmapped with a single FUSE_REMOVEMAPPING request. Adjacent chunks are
+ * unmapped as one range.
+ *
+ * With LIBUKSCHED, a reclaim thread keeps the number of free chunks between
+ * the watermarks virtiofs.dax_free_low and virtiofs.dax_free_high (percent
+ * of the window), so that chunks are rarely unmapped in the I/O path.
+ *
+ * uk_vf_dax_mmap() maps a file range by pinning its chunks. A range within
+ * one chunk is accessed at its address in the window. With PAGING, the
+ * chunks of a larger range are mapped one after another into the area
+ * [CONFIG_LIBVIRTIOFS_DAX_MMAP_VBASE, + CONFIG_LIBVIRTIOFS_DAX_MMAP_VSIZE).
+ */
+
+#include "uk/vf_dax.h"
+#include "uk/fuse.h"
+#include "uk/fuse_i.h"
+#include "uk/fusedev_core.h"
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/errptr.h>
+#include <uk/libparam.h>
+#include <uk/print.h>
+#include <uk/plat/spinlock.h>
+#if CONFIG_PAGING
+#include <uk/plat/io.h>
+#include <uk/plat/paging.h>
+#endif
+#if CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/wait.h>
+#endif
+#include <errno.h>
+#include <string.h>
+
+/* Minimum number of hash buckets */
+#define VF_DAX_MIN_BUCKETS		64
+/* Number of chunks unmapped at once, when a chunk is needed */
+#define VF_DAX_RECLAIM_BATCH		32
+/* Mappings leave at least one in this many chunks unpinned */
+#define VF_DAX_PIN_RESERVE		4
+
+/* Watermarks of free chunks (percent of the window) */
+static __u32 dax_free_low = CONFIG_LIBVIRTIOFS_DAX_FREE_LOW;
+static __u32 dax_free_high = CONFIG_LIBVIRTIOFS_DAX_FREE_HIGH;
+UK_LIB_PARAM(dax_free_low, __u32);
+UK_LIB_PARAM(dax_free_high, __u32);
+
+static inline uint32_t vf_dax_hash(uint64_t nodeid, uint64_t index)
+{
+	/* Consecutive chunks of a file go to consecutive buckets */
+	return (uint32_t) ((nodeid * 0x9E3779B97F4A7C15ULL) >> 32)
+	       + (uint32_t) index;
+}
+
+static struct uk_vf_dax_chunk *vf_dax_find_locked(struct uk_vf_dax *dax,
+						  uint64_t nodeid,
+						  uint64_t index)
+{
+	struct uk_vf_dax_chunk *c;
+
+	uk_hlist_for_each_entry(c, &dax->buckets[vf_dax_hash(nodeid, index)
+						 & (dax->nbuckets - 1)], hash) {
+		if (c->nodeid == nodeid && c->index == index)
+			return c;
+	}
+	return NULL;
+}
+
+/**
+ * @brief waits, until a chunk has been mapped or released since @p gen was
+ * read
+ */
+static void vf_dax_wait(struct uk_vf_dax *dax, uint32_t gen)
+{
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wait_event(&dax->wq, UK_READ_ONCE(dax->gen) != gen);
+#else
+	while (UK_READ_ONCE(dax->gen) == gen)
+		;
+#endif
+}
+
+static inline void vf_dax_wake(struct uk_vf_dax *dax __maybe_unused)
+{
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&dax->wq);
+#endif
+}
+
+static inline uint64_t vf_dax_chunk_moffset(const struct uk_vf_dax *dax,
+					    const struct uk_vf_dax_chunk *c)
+{
+	return (uint64_t) (c - dax->chunks) * dax->chunk_size;
+}
+
+/**
+ * @brief adds the window range of @p c to the request in dax->rm_in
+ *
+ * @return bool false, if the request is full
+ */
+static bool vf_dax_rm_add(struct uk_vf_dax *dax, uint32_t *cnt,
+			  const struct uk_vf_dax_chunk *c)
+{
+	FUSE_REMOVEMAPPING_IN *rm = dax->rm_in;
+	uint64_t moffset = vf_dax_chunk_moffset(dax, c);
+
+	if (*cnt) {
+		/* Merge with the previous range, if adjacent */
+		if (rm->removemapping_one[*cnt - 1].moffset
+		    + rm->removemapping_one[*cnt - 1].len == moffset) {
+			rm->removemapping_one[*cnt - 1].len += dax->chunk_size;
+			return true;
+		}
+		if (moffset + dax->chunk_size
+		    == rm->removemapping_one[*cnt - 1].moffset) {
+			rm->removemapping_one[*cnt - 1].moffset = moffset;
+			rm->removemapping_one[*cnt - 1].len += dax->chunk_size;
+			return true;
+		}
+	}
+	if (*cnt == ARRAY_SIZE(rm->removemapping_one))
+		return false;
+
+	rm->removemapping_one[*cnt].moffset = moffset;
+	rm->removemapping_one[*cnt].len = dax->chunk_size;
+	(*cnt)++;
+	return true;
+}
+
+/**
+ * @brief unmaps up to @p max of the least recently used chunks without
+ * users
+ *
+ * The chunks are unmapped with one FUSE_REMOVEMAPPING request, built in
+ * the preallocated dax->rm_in, and put on the free list. Concurrent calls
+ * are serialized.
+ *
+ * @param nodeid only chunks of this file, or of all files, if 0
+ * @return int number of chunks unmapped. If the request fails, the chunks
+ * are freed nonetheless, since setting up a mapping replaces an old one.
+ */
+int uk_vf_dax_reclaim(struct uk_vf_dax *dax, uint64_t nodeid, uint32_t max)
+{
+	struct uk_vf_dax_chunk *c, *tmp;
+	unsigned long flags;
+	uint32_t n = 0, cnt = 0;
+	uint32_t gen;
+	UK_LIST_HEAD(victims);
+	int rc = 0;
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	while (dax->reclaiming) {
+		gen = dax->gen;
+		ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+		vf_dax_wait(dax, gen);
+		ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	}
+
+	uk_list_for_each_entry_safe_reverse(c, tmp, &dax->lru, lru) {
+		if (n == max)
+			break;
+		if (c->refs || (nodeid && c->nodeid != nodeid))
+			continue;
+		if (!vf_dax_rm_add(dax, &cnt, c))
+			break;
+		uk_hlist_del(&c->hash);
+		uk_list_move(&c->lru, &victims);
+		n++;
+	}
+	if (!n) {
+		ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+		return 0;
+	}
+	dax->reclaiming = true;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+
+	rc = uk_fuse_request_removemapping_multiple(dax->dev, dax->rm_in, cnt);
+	if (rc)
+		uk_pr_warn("Failed to unmap %"__PRIu32" DAX chunks: %d\n", n,
+			   rc);
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	uk_list_splice_tail(&victims, &dax->free);
+	dax->nfree += n;
+	dax->reclaiming = false;
+	dax->evictions += n;
+	dax->removemappings++;
+	dax->gen++;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+	vf_dax_wake(dax);
+
+	return (int) n;
+}
+
+static inline void vf_dax_reclaim_wake(struct uk_vf_dax *dax __maybe_unused)
+{
+#if CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&dax->reclaim_wq);
+#endif
+}
+
+#if CONFIG_LIBUKSCHED
+static void vf_dax_reclaimer(void *arg)
+{
+	struct uk_vf_dax *dax = arg;
+	uint32_t nfree;
+	int n;
+
+	for (;;) {
+		uk_waitq_wait_event(&dax->reclaim_wq,
+				    UK_READ_ONCE(dax->stop)
+				    || UK_READ_ONCE(dax->nfree)
+				       < dax->free_low);
+		if (UK_READ_ONCE(dax->stop))
+			break;
+
+		while ((nfree = UK_READ_ONCE(dax->nfree)) < dax->free_high) {
+			n = uk_vf_dax_reclaim(dax, 0, dax->free_high - nfree);
+			if (n <= 0) {
+				/* All mapped chunks are in use */
+				uk_sched_thread_sleep(ukarch_time_msec_to_nsec(1));
+				break;
+			}
+			ukarch_inc(&dax->bg_reclaims);
+		}
+	}
+}
+#endif
+
+/**
+ * @brief starts the reclaim thread, if the watermarks are set
+ */
+static int vf_dax_start(struct uk_vf_dax *dax)
+{
+	uint32_t low = MIN(dax_free_low, 100U);
+	uint32_t high = MIN(MAX(dax_free_high, low), 100U);
+
+	if (!low)
+		return 0;
+
+	dax->free_low = MAX((uint32_t) ((uint64_t) dax->nchunks * low / 100),
+			    1U);
+	dax->free_high = MAX((uint32_t) ((uint64_t) dax->nchunks * high
+					 / 100), dax->free_low);
+
+#if CONFIG_LIBUKSCHED
+	dax->stop = false;
+	dax->reclaimer = uk_thread_create("virtiofs-dax", vf_dax_reclaimer,
+					  dax);
+	if (!dax->reclaimer)
+		return -ENOMEM;
+#endif
+	return 0;
+}
+
+/**
+ * @brief looks up the chunk of the DAX window mapping @p file_off of
+ * @p nodeid, and sets up the mapping, if there is none
+ *
+ * The chunk is referenced and must be released with uk_vf_dax_put() once
+ * the window is not accessed through it anymore. The data of the file
+ * starts at uk_vf_dax_chunk_addr() + @p file_off % dax->chunk_size.
+ *
+ * @param fh file handle, through which a missing mapping is set up
+ * @param write whether the chunk has to be mapped writable
+ * @param[out] chunk
+ * @return int 0 on success, -ENOSPC if every chunk is in use, another
+ * negative errno otherwise
+ */
+int uk_vf_dax_get(struct uk_vf_dax *dax, uint64_t nodeid, uint64_t fh,
+		  uint64_t file_off, bool write,
+		  struct uk_vf_dax_chunk **chunk)
+{
+	uint64_t index = file_off / dax->chunk_size;
+	struct uk_vf_dax_chunk *c;
+	unsigned long flags;
+	uint64_t map_flags;
+	bool upgrade, low;
+	uint32_t gen;
+	int freed;
+	int rc;
+
+	UK_ASSERT(chunk);
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	for (;;) {
+		c = vf_dax_find_locked(dax, nodeid, index);
+		if (c && !c->busy) {
+			c->refs++;
+			uk_list_move(&c->lru, &dax->lru);
+			if (!write || c->writable) {
+				dax->hits++;
+				ukplat_spin_unlock_irqrestore(&dax->spinlock,
+							      flags);
+				*chunk = c;
+				return 0;
+			}
+			/* Mapped read-only: map it again for writing */
+			upgrade = true;
+			break;
+		}
+		if (!c && !uk_list_empty(&dax->free)) {
+			c = uk_list_first_entry(&dax->free,
+						struct uk_vf_dax_chunk, lru);
+			c->nodeid = nodeid;
+			c->index = index;
+			c->refs = 1;
+			c->writable = false;
+			uk_hlist_add_head(&c->hash,
+					  &dax->buckets[vf_dax_hash(nodeid,
+								    index)
+							& (dax->nbuckets - 1)]);
+			uk_list_move(&c->lru, &dax->lru);
+			dax->nfree--;
+			dax->misses++;
+			upgrade = false;
+			break;
+		}
+
+		gen = dax->gen;
+		if (!c && !dax->reclaiming) {
+			/* Window full: unmap a batch of cold chunks */
+			ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+			freed = uk_vf_dax_reclaim(dax, 0,
+						  VF_DAX_RECLAIM_BATCH);
+			ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+			if (freed) {
+				dax->fg_reclaims++;
+				continue;
+			}
+			/* Every chunk is in use, e.g., pinned by mappings.
+			   The caller falls back to FUSE requests. */
+			if (uk_list_empty(&dax->free)
+			    && !vf_dax_find_locked(dax, nodeid, index)) {
+				ukplat_spin_unlock_irqrestore(&dax->spinlock,
+							      flags);
+				return -ENOSPC;
+			}
+			continue;
+		}
+
+		/* Mapping is being set up, or all chunks are in use */
+		ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+		vf_dax_wait(dax, gen);
+		ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	}
+	c->busy = true;
+	low = dax->nfree < dax->free_low;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+
+	if (low)
+		vf_dax_reclaim_wake(dax);
+
+	map_flags = FUSE_SETUPMAPPING_FLAG_READ;
+	if (write)
+		map_flags |= FUSE_SETUPMAPPING_FLAG_WRITE;
+	rc = uk_fuse_request_setupmapping(dax->dev, nodeid, fh,
+					  index * dax->chunk_size,
+					  dax->chunk_size, map_flags,
+					  vf_dax_chunk_moffset(dax, c));
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	c->busy = false;
+	dax->gen++;
+	if (!rc) {
+		c->writable = write;
+	} else if (upgrade) {
+		/* The read-only mapping is still intact */
+		c->refs--;
+	} else {
+		uk_hlist_del(&c->hash);
+		uk_list_move(&c->lru, &dax->free);
+		dax->nfree++;
+		c->refs = 0;
+	}
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+	vf_dax_wake(dax);
+
+	if (rc) {
+		uk_pr_err("Failed to map chunk %"__PRIu64" of nodeid %"
+			  __PRIu64": %d\n", index, nodeid, rc);
+		return rc;
+	}
+
+	*chunk = c;
+	return 0;
+}
+
+void uk_vf_dax_put(struct uk_vf_dax *dax, struct uk_vf_dax_chunk *c)
+{
+	unsigned long flags;
+	bool idle;
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	UK_ASSERT(c->refs);
+	idle = !--c->refs;
+	if (idle)
+		dax->gen++;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+
+	if (idle)
+		vf_dax_wake(dax);
+}
+
+/**
+ * @brief unmaps the chunks of @p nodeid, e.g., once the node is forgotten
+ *
+ * Chunks in use remain mapped.
+ */
+void uk_vf_dax_invalidate(struct uk_vf_dax *dax, uint64_t nodeid)
+{
+	while (uk_vf_dax_reclaim(dax, nodeid, UINT32_MAX) > 0)
+		;
+}
+
+/**
+ * Releases the chunks of @p m and the @p pinned chunks reserved for it.
+ */
+static void vf_dax_mapping_put(struct uk_vf_dax *dax,
+			       struct uk_vf_dax_mapping *m, uint32_t pinned)
+{
+	unsigned long flags;
+	uint32_t i;
+
+	for (i = 0; i < m->nchunks; i++)
+		uk_vf_dax_put(dax, m->chunks[i]);
+	uk_free(dax->dev->a, m);
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	UK_ASSERT(dax->pinned >= pinned);
+	dax->pinned -= pinned;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+}
+
+#if CONFIG_PAGING
+/**
+ * Reserves @p len bytes of the mmap area by inserting @p m into the sorted
+ * list of mappings (first fit). Called with the spinlock held.
+ */
+static int vf_dax_vreserve_locked(struct uk_vf_dax *dax,
+				  struct uk_vf_dax_mapping *m, size_t len)
+{
+	__vaddr_t start = CONFIG_LIBVIRTIOFS_DAX_MMAP_VBASE;
+	__vaddr_t end = start + CONFIG_LIBVIRTIOFS_DAX_MMAP_VSIZE;
+	struct uk_list_head *pos = &dax->mappings;
+	struct uk_vf_dax_mapping *it;
+
+	uk_list_for_each_entry(it, &dax->mappings, list) {
+		if (!it->remapped)
+			continue;
+		if (it->vaddr - start >= len)
+			break;
+		start = it->vaddr + it->nchunks * dax->chunk_size;
+		pos = &it->list;
+	}
+	if (end - start < len)
+		return -ENOMEM;
+
+	m->vaddr = start;
+	m->remapped = true;
+	uk_list_add(&m->list, pos);
+	return 0;
+}
+
+static int vf_dax_remap(struct uk_vf_dax *dax, struct uk_vf_dax_mapping *m,
+			bool write)
+{
+	struct uk_pagetable *pt = ukplat_pt_get_active();
+	unsigned long pages = dax->chunk_size >> PAGE_SHIFT;
+	unsigned long attr = write ? PAGE_ATTR_PROT_RW : PAGE_ATTR_PROT_READ;
+	__vaddr_t vaddr;
+	uint32_t i;
+	int rc;
+
+	for (i = 0; i < m->nchunks; i++) {
+		vaddr = m->vaddr + i * dax->chunk_size;
+		rc = ukplat_page_map(pt, vaddr,
+			ukplat_virt_to_phys(uk_vf_dax_chunk_addr(dax,
+								m->chunks[i])),
+			pages, attr, 0);
+		if (unlikely(rc)) {
+			uk_pr_err("Failed to map chunk at %p: %d\n",
+				  (void *) vaddr, rc);
+			if (i)
+				ukplat_page_unmap(pt, m->vaddr, i * pages,
+						  PAGE_FLAG_KEEP_FRAMES);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void vf_dax_unremap(struct uk_vf_dax *dax, struct uk_vf_dax_mapping *m)
+{
+	int rc;
+
+	rc = ukplat_page_unmap(ukplat_pt_get_active(), m->vaddr,
+			       (m->nchunks * dax->chunk_size) >> PAGE_SHIFT,
+			       PAGE_FLAG_KEEP_FRAMES);
+	if (unlikely(rc))
+		uk_pr_err("Failed to unmap %p: %d\n",
+			  (void *) m->vaddr, rc);
+}
+#endif /* CONFIG_PAGING */
+
+/**
+ * @brief maps [@p file_off, @p file_off + @p len) of @p nodeid into the
+ * address space through the DAX window
+ *
+ * The chunks of the range stay mapped until uk_vf_dax_munmap(). Accesses
+ * beyond the end of the file are not backed by the device and are fatal.
+ * Mappings pin at most dax->pin_max chunks altogether, so that reads and
+ * writes through the window always find a chunk to use.
+ *
+ * @param fh file handle, through which missing chunks are mapped
+ * @param file_off page aligned offset into the file
+ * @param write whether the range is written through the mapping
+ * @param[out] addr address of the range
+ * @return int 0 on success, -ENOMEM if too many chunks are pinned, another
+ * negative errno otherwise
+ */
+int uk_vf_dax_mmap(struct uk_vf_dax *dax, uint64_t nodeid, uint64_t fh,
+		   uint64_t file_off, size_t len, bool write, void **addr)
+{
+	struct uk_vf_dax_mapping *m;
+	uint64_t first, last;
+	unsigned long flags;
+	uint32_t nchunks, i;
+	int rc;
+
+	UK_ASSERT(dax);
+	UK_ASSERT(addr);
+
+	if (unlikely(!len || file_off & (__PAGE_SIZE - 1)))
+		return -EINVAL;
+	if (unlikely(file_off + len < file_off))
+		return -EOVERFLOW;
+
+	first = file_off / dax->chunk_size;
+	last = (file_off + len - 1) / dax->chunk_size;
+	if (last - first >= dax->nchunks)
+		return -ENOMEM;
+	nchunks = (uint32_t) (last - first + 1);
+#if CONFIG_PAGING
+	if (nchunks > 1 && dax->chunk_size & (__PAGE_SIZE - 1))
+		return -ENOTSUP;
+#else
+	if (nchunks > 1)
+		return -ENOTSUP;
+#endif
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	if (nchunks > dax->pin_max - dax->pinned) {
+		ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+		return -ENOMEM;
+	}
+	dax->pinned += nchunks;
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+
+	m = uk_calloc(dax->dev->a, 1,
+		      sizeof(*m) + nchunks * sizeof(*m->chunks));
+	if (!m) {
+		ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+		dax->pinned -= nchunks;
+		ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+		return -ENOMEM;
+	}
+	m->len = len;
+
+	for (i = 0; i < nchunks; i++) {
+		rc = uk_vf_dax_get(dax, nodeid, fh,
+				   (first + i) * dax->chunk_size, write,
+				   &m->chunks[i]);
+		if (rc)
+			goto err_put;
+		m->nchunks++;
+	}
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	if (nchunks == 1) {
+		m->addr = uk_vf_dax_chunk_addr(dax, m->chunks[0]) +
+			  file_off % dax->chunk_size;
+		uk_list_add_tail(&m->list, &dax->mappings);
+		rc = 0;
+	}
+#if CONFIG_PAGING
+	else {
+		rc = vf_dax_vreserve_locked(dax, m, nchunks * dax->chunk_size);
+	}
+#endif
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+	if (rc)
+		goto err_put;
+
+#if CONFIG_PAGING
+	if (m->remapped) {
+		rc = vf_dax_remap(dax, m, write);
+		if (rc) {
+			ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+			uk_list_del(&m->list);
+			ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+			goto err_put;
+		}
+		m->addr = (char *) m->vaddr + file_off % dax->chunk_size;
+	}
+#endif
+
+	*addr = m->addr;
+	return 0;
+
+err_put:
+	vf_dax_mapping_put(dax, m, nchunks);
+	return rc;
+}
+
+/**
+ * @brief unmaps a range mapped by uk_vf_dax_mmap()
+ *
+ * Only whole mappings can be unmapped.
+ *
+ * @return int 0 on success, -EINVAL if there is no such mapping
+ */
+int uk_vf_dax_munmap(struct uk_vf_dax *dax, void *addr, size_t len)
+{
+	struct uk_vf_dax_mapping *m;
+	unsigned long flags;
+	bool found = false;
+
+	UK_ASSERT(dax);
+
+	ukplat_spin_lock_irqsave(&dax->spinlock, flags);
+	uk_list_for_each_entry(m, &dax->mappings, list) {
+		if (m->addr == addr && m->len == len) {
+			uk_list_del(&m->list);
+			found = true;
+			break;
+		}
+	}
+	ukplat_spin_unlock_irqrestore(&dax->spinlock, flags);
+	if (!found)
+		return -EINVAL;
+
+#if CONFIG_PAGING
+	if (m->remapped)
+		vf_dax_unremap(dax, m);
+#endif
+	vf_dax_mapping_put(dax, m, m->nchunks);
+	return 0;
+}
+
+/**
+ * @brief creates the manager of the DAX window [@p addr, @p addr + @p len)
+ *
+ * Has to be called after FUSE_INIT, which sets the map alignment of @p dev.
+ *
+ * @return struct uk_vf_dax* or an error pointer
+ */
+struct uk_vf_dax *uk_vf_dax_create(struct uk_fuse_dev *dev, uint64_t addr,
+				   uint64_t len)
+{
+	struct uk_vf_dax *dax;
+	uint64_t chunk_size;
+	uint32_t nchunks, nbuckets, i;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->map_alignment);
+
+	chunk_size = ALIGN_UP((uint64_t) CONFIG_LIBVIRTIOFS_DAX_CHUNK_KB * 1024,
+			      (uint64_t) dev->map_alignment);
+	nchunks = (uint32_t) MIN(len / chunk_size, (uint64_t) UINT32_MAX);
+	if (!nchunks) {
+		uk_pr_err("DAX window of %"__PRIu64" bytes is smaller than a chunk\n",
+			  len);
+		return ERR2PTR(-ENOSPC);
+	}
+	for (nbuckets = VF_DAX_MIN_BUCKETS; nbuckets < nchunks; nbuckets <<= 1)
+		;
+
+	dax = uk_calloc(dev->a, 1, sizeof(*dax));
+	if (!dax)
+		return ERR2PTR(-ENOMEM);
+	dax->chunks = uk_calloc(dev->a, nchunks, sizeof(*dax->chunks));
+	if (!dax->chunks)
+		goto err_free_dax;
+	dax->buckets = uk_calloc(dev->a, nbuckets, sizeof(*dax->buckets));
+	if (!dax->buckets)
+		goto err_free_chunks;
+	dax->rm_in = uk_malloc(dev->a, sizeof(*dax->rm_in));
+	if (!dax->rm_in)
+		goto err_free_buckets;
+
+	ukarch_spin_init(&dax->spinlock);
+	dax->dev = dev;
+	dax->base = (char *) addr;
+	dax->chunk_size = chunk_size;
+	dax->nchunks = nchunks;
+	dax->nbuckets = nbuckets;
+	UK_INIT_LIST_HEAD(&dax->lru);
+	UK_INIT_LIST_HEAD(&dax->free);
+	UK_INIT_LIST_HEAD(&dax->mappings);
+	for (i = 0; i < nchunks; i++)
+		uk_list_add_tail(&dax->chunks[i].lru, &dax->free);
+	dax->nfree = nchunks;
+	dax->pin_max = nchunks - MAX(nchunks / VF_DAX_PIN_RESERVE, 1U);
+#if CONFIG_LIBUKSCHED
+	uk_waitq_init(&dax->wq);
+	uk_waitq_init(&dax->reclaim_wq);
+#endif
+	if (vf_dax_start(dax))
+		uk_pr_warn("Failed to start the DAX reclaim thread\n");
+
+	uk_pr_info("DAX window: %"__PRIu32" chunks of %"__PRIu64" bytes\n",
+		   nchunks, chunk_size);
+	return dax;
+
+err_free_buckets:
+	uk_free(dev->a, dax->buckets);
+err_free_chunks:
+	uk_free(dev->a, dax->chunks);
+err_free_dax:
+	uk_free(dev->a, dax);
+	return ERR2PTR(-ENOMEM);
+}
+
+void uk_vf_dax_destroy(struct uk_vf_dax *dax)
+{
+	struct uk_alloc *a = dax->dev->a;
+
+	UK_ASSERT(uk_list_empty(&dax->mappings));
+
+#if CONFIG_LIBUKSCHED
+	if (dax->reclaimer) {
+		UK_WRITE_ONCE(dax->stop, true);
+		uk_waitq_wake_up(&dax->reclaim_wq);
+		uk_thread_wait(dax->reclaimer);
+		dax->reclaimer = NULL;
+	}
+#endif
+
+	uk_free(a, dax->rm_in);
+	uk_free(a, dax->buckets);
+	uk_free(a, dax->chunks);
+	uk_free(a, dax);
+}
@@ -1,177 +1,277 @@
 #include "uk/vf_vnops.h"
-#include "uk/vf_bench_tests.h"
 #include "uk/assert.h"
 #include "uk/fusedev_core.h"
 #include "uk/print.h"
-#include <virtio/virtio_bus.h>
 #include "uk/vfdev.h"
+#include "uk/vf_dax.h"
 #include <uk/fuse.h>
 #include <uk/fuse_i.h>
+#include <uk/fuse_node.h>
+#include <uk/fuse_pcache.h>
+#include <uk/fuse_wb.h>
 #include <stdint.h>
 #include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/errptr.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static struct virtio_dev *vdev_for_dax = NULL;
-static struct uk_fuse_dev *fusedev_for_dax = NULL;
-
-static inline int uk_vf_write_dax(struct uk_vfdev *vfdev, uint64_t nodeid,
-				  uint64_t fh, uint32_t len, uint64_t off,
-				  void *in_buf)
+/**
+ * @brief reads with FUSE_READ requests
+ */
+static int uk_vf_read_fuse(struct uk_vfdev *vfdev, uint64_t nodeid,
+			   uint64_t fh, uint32_t len, uint64_t off,
+			   void *out_buf, uint32_t *bytes_transferred)
 {
-	int rc = 0;
-	UK_ASSERT(vfdev);
-	UK_ASSERT(vfdev->fuse_dev);
+	int rc;
 
-	rc = uk_fuse_request_setupmapping(vfdev->fuse_dev, nodeid, fh, off, len,
-		FUSE_SETUPMAPPING_FLAG_WRITE, 0);
-	if (rc) {
-		uk_pr_err("%s: failed setting up a mapping\n", __func__);
-		return -1;
-	}
-
-	memcpy((void *) vfdev->dax_addr, in_buf, 10);
-	uk_pr_info("Wrote through DAX \n");
+	rc = uk_fuse_request_read(vfdev->fuse_dev, nodeid, fh, off, len,
+				  out_buf, bytes_transferred);
+	/* Reading at or past the end of the file is not an error here */
+	return rc == EOF ? 0 : rc;
+}
 
-	return 0;
+/**
+ * @brief writes with FUSE_WRITE requests
+ */
+static int uk_vf_write_fuse(struct uk_vfdev *vfdev, uint64_t nodeid,
+			    uint64_t fh, uint32_t len, uint64_t off,
+			    const void *in_buf, uint32_t *bytes_transferred)
+{
+	return uk_fuse_request_write(vfdev->fuse_dev, nodeid, fh, in_buf, len,
+				     off, bytes_transferred);
 }
 
-static inline int uk_vf_read_dax(struct uk_vfdev *vfdev, uint64_t nodeid,
-				 uint64_t fh, uint32_t len, uint64_t off,
-				 void *out_buf)
+/**
+ * @brief copies between @p buf and [@p off, @p off + @p len) of a file
+ * through the DAX window, chunk by chunk
+ *
+ * @param[out] bytes_transferred bytes copied, also on failure
+ */
+static int uk_vf_copy_dax(struct uk_vfdev *vfdev, uint64_t nodeid,
+			  uint64_t fh, uint32_t len, uint64_t off, void *buf,
+			  bool write, uint32_t *bytes_transferred)
 {
-	int rc = 0;
-	UK_ASSERT(vfdev);
-	UK_ASSERT(vfdev->fuse_dev);
+	struct uk_vf_dax *dax = vfdev->dax;
+	struct uk_vf_dax_chunk *c;
+	uint64_t coff;
+	uint32_t n;
+	char *addr;
+	int rc;
 
-	rc = uk_fuse_request_setupmapping(vfdev->fuse_dev, nodeid, fh, off,
-		len, FUSE_SETUPMAPPING_FLAG_READ, 0);
-	if (rc) {
-		uk_pr_err("%s: failed setting up a mapping\n", __func__);
-		return -1;
-	}
+	*bytes_transferred = 0;
+	while (*bytes_transferred < len) {
+		rc = uk_vf_dax_get(dax, nodeid, fh, off + *bytes_transferred,
+				   write, &c);
+		if (rc)
+			return rc;
 
-	memcpy(out_buf, (void *) vfdev->dax_addr, 10);
-	uk_pr_info("Read through DAX \n"
-		   "out_buf: %s\n", (char *) out_buf);
+		coff = (off + *bytes_transferred) % dax->chunk_size;
+		n = (uint32_t) MIN((uint64_t) (len - *bytes_transferred),
+				   dax->chunk_size - coff);
+		addr = uk_vf_dax_chunk_addr(dax, c) + coff;
+		if (write)
+			memcpy(addr, (char *) buf + *bytes_transferred, n);
+		else
+			memcpy((char *) buf + *bytes_transferred, addr, n);
+		uk_vf_dax_put(dax, c);
 
-	return 0;
-
-}
+		*bytes_transferred += n;
+	}
 
-static inline int uk_vf_write_fuse(struct uk_vfdev *vfdev, uint64_t nodeid,
-				  uint64_t fh, uint32_t len, uint64_t off,
-				  void *out_buf)
-{
 	return 0;
 }
 
-static inline int uk_vf_read_fuse(struct uk_vfdev *vfdev, uint64_t nodeid,
-				  uint64_t fh, uint32_t len, uint64_t off,
-				  void *out_buf)
+/**
+ * @brief writes dirty data of the file and determines its size
+ *
+ * Dirty data of the writeback cache is not visible in the DAX window, and
+ * would overwrite data written through it later on.
+ *
+ * The size known to the caller (@p known, UINT64_MAX if there is none) or
+ * cached is used, as long as [@p off, @p end) lies within it. Otherwise,
+ * the file may have grown, and the size is retrieved from the device.
+ */
+static int uk_vf_dax_prepare(struct uk_vfdev *vfdev, uint64_t nodeid,
+			     uint64_t fh, uint64_t known, uint64_t end,
+			     uint64_t *size)
 {
-	return 0;
-}
+	struct fuse_attr attr;
+	int rc;
 
-int uk_vf_write(struct uk_vfdev *vfdev, uint64_t nodeid, uint64_t fh,
-		       uint32_t len, uint64_t off, void *in_buf)
-{
-	int rc = 0;
+	if ((rc = uk_fuse_wb_flush(vfdev->fuse_dev, nodeid)))
+		return rc;
 
-	if (vfdev->dax_enabled) {
-		rc = uk_vf_write_dax(vfdev, nodeid, fh, len, off, in_buf);
-	} else {
-		rc = uk_vf_write_fuse(vfdev, nodeid, fh, len, off, in_buf);
+	if (known == UINT64_MAX
+	    && !uk_fuse_node_get_attr(vfdev->fuse_dev, nodeid, &attr))
+		known = attr.size;
+	if (known != UINT64_MAX && end <= known) {
+		*size = known;
+		return 0;
 	}
 
-	return rc;
+	uk_fuse_node_invalidate_attr(vfdev->fuse_dev, nodeid);
+	if ((rc = uk_fuse_request_get_attr(vfdev->fuse_dev, nodeid, fh,
+					   &attr)))
+		return rc;
+
+	*size = attr.size;
+	return 0;
 }
 
 /**
- * @brief
+ * @brief reads through the DAX window
  *
- * TODOFS: completely rework the signature. The one in place is just for testing
- * purposes. A good reference would be:
- * unikraft/lib/9pfs/9pfs_vnops.c:uk_9pfs_write()
- *
- * @param vfdev
- * @param nodeid
- * @param fh
- * @param length
- * @param off
- * @return int
+ * Only the data up to the end of the file is read, since accessing the
+ * window beyond it faults. If a chunk cannot be mapped, the rest is read
+ * with FUSE_READ.
  */
-int uk_vf_read(struct uk_vfdev *vfdev, uint64_t nodeid, uint64_t fh,
-		      uint32_t len, uint64_t off, void *out_buf)
+static int uk_vf_read_dax(struct uk_vfdev *vfdev, uint64_t nodeid,
+			  uint64_t fh, uint32_t len, uint64_t off,
+			  void *out_buf, uint32_t *bytes_transferred,
+			  uint64_t *file_size)
 {
-	int rc = 0;
+	uint32_t done;
+	uint64_t size;
+	int rc;
+
+	*bytes_transferred = 0;
+	if ((rc = uk_vf_dax_prepare(vfdev, nodeid, fh,
+				    file_size ? *file_size : UINT64_MAX,
+				    off + len, &size)))
+		return rc;
+	if (file_size)
+		*file_size = size;
+	if (off >= size)
+		return 0;
+	len = (uint32_t) MIN((uint64_t) len, size - off);
 
-	if (vfdev->dax_enabled) {
-		rc = uk_vf_read_dax(vfdev, nodeid, fh, len, off, out_buf);
-	} else { /* Fallback to normal FUSE requests, if DAX is not enabled */
-		rc = uk_vf_read_fuse(vfdev, nodeid, fh, len, off, out_buf);
+	rc = uk_vf_copy_dax(vfdev, nodeid, fh, len, off, out_buf, false,
+			    &done);
+	*bytes_transferred = done;
+	if (rc) {
+		uk_pr_debug("%s: falling back to FUSE_READ: %d\n", __func__,
+			    rc);
+		rc = uk_vf_read_fuse(vfdev, nodeid, fh, len - done, off + done,
+				     (char *) out_buf + done, &done);
+		*bytes_transferred += done;
 	}
 
 	return rc;
 }
 
-void add_vdev_for_dax(struct virtio_dev *vdev)
+/**
+ * @brief writes through the DAX window
+ *
+ * The window only reaches the existing data of the file. The part of the
+ * write beyond the end of the file, and the rest after a chunk could not be
+ * mapped, are written with FUSE_WRITE, which extends the file.
+ */
+static int uk_vf_write_dax(struct uk_vfdev *vfdev, uint64_t nodeid,
+			   uint64_t fh, uint32_t len, uint64_t off,
+			   const void *in_buf, uint32_t *bytes_transferred,
+			   uint64_t *file_size)
 {
-	vdev_for_dax = vdev;
-}
+	struct uk_fuse_dev *dev = vfdev->fuse_dev;
+	uint32_t inside, done;
+	uint64_t size;
+	int rc;
 
-void add_fusedev(struct uk_fuse_dev *fusedev)
-{
-	fusedev_for_dax = fusedev;
-}
+	*bytes_transferred = 0;
+	if ((rc = uk_vf_dax_prepare(vfdev, nodeid, fh,
+				    file_size ? *file_size : UINT64_MAX,
+				    off + len, &size)))
+		return rc;
+	inside = off < size ? (uint32_t) MIN((uint64_t) len, size - off) : 0;
 
-struct uk_vfdev uk_vf_connect(void) {
-	struct uk_vfdev vfdev = {0};
+	rc = uk_vf_copy_dax(vfdev, nodeid, fh, inside, off, (void *) in_buf,
+			    true, &done);
+	*bytes_transferred = done;
+	if (done) {
+		/* As for FUSE_WRITE, but the size is unchanged */
+		uk_fuse_pcache_invalidate(dev, nodeid, off, done);
+		if (dev->attr_cache != UK_FUSE_ATTR_CACHE_RELAXED)
+			uk_fuse_node_invalidate_attr(dev, nodeid);
+	}
+	if (rc)
+		uk_pr_debug("%s: falling back to FUSE_WRITE: %d\n", __func__,
+			    rc);
 
-	if (vdev_for_dax) {
-		vfdev.dax_enabled =
-			vdev_for_dax->cops->shm_present(vdev_for_dax, 0);
-		vfdev.dax_addr =
-			vdev_for_dax->cops->get_shm_addr(vdev_for_dax, 0);
-		vfdev.dax_len =
-			vdev_for_dax->cops->get_shm_length(vdev_for_dax, 0);
+	if (done < len) {
+		rc = uk_vf_write_fuse(vfdev, nodeid, fh, len - done,
+				      off + done,
+				      (const char *) in_buf + done, &done);
+		*bytes_transferred += done;
 	}
-	if (fusedev_for_dax)
-		vfdev.fuse_dev = fusedev_for_dax;
-	else
-		uk_pr_info("%s: No fuse device found. \n", __func__);
 
-	return vfdev;
+	if (file_size)
+		*file_size = MAX(size, off + *bytes_transferred);
+	return rc;
 }
 
-void vf_test_method(void) {
-	struct uk_vfdev vfdev = {0};
-	void *outbuf;
-
-
+/**
+ * @brief writes @p len bytes at @p off of a file
+ *
+ * Through the DAX window, if it is enabled, otherwise with FUSE_WRITE
+ * requests. The caches of ukfuse are kept coherent with the data written.
+ *
+ * @param vfdev
+ * @param nodeid
+ * @param fh file handle, opened for writing
+ * @param len
+ * @param off
+ * @param in_buf
+ * @param[out] bytes_transferred how many bytes have been written
+ * @param[in,out] file_size size of the file known to the caller, updated
+ * with the size after the write. Optional, the cached attributes are used
+ * otherwise.
+ * @return int 0 or a negative errno
+ */
+int uk_vf_write(struct uk_vfdev *vfdev, uint64_t nodeid, uint64_t fh,
+		uint32_t len, uint64_t off, const void *in_buf,
+		uint32_t *bytes_transferred, uint64_t *file_size)
+{
+	UK_ASSERT(vfdev);
+	UK_ASSERT(vfdev->fuse_dev);
+	UK_ASSERT(bytes_transferred);
 
-	if (vdev_for_dax) {
-		vfdev.dax_enabled =
-			vdev_for_dax->cops->shm_present(vdev_for_dax, 0);
-		vfdev.dax_addr =
-			vdev_for_dax->cops->get_shm_addr(vdev_for_dax, 0);
-		vfdev.dax_len =
-			vdev_for_dax->cops->get_shm_length(vdev_for_dax, 0);
-	}
-	if (fusedev_for_dax)
-		vfdev.fuse_dev = fusedev_for_dax;
-	else
-		uk_pr_err("%s: No fuse device found. \n", __func__);
-
-	outbuf = calloc(11, 1);
-	if (!outbuf) {
-		uk_pr_err("%s: malloc failed \n", __func__);
-		return;
-	}
-	uk_vf_write(&vfdev, 2, 0, 10,
-		0, "0123456789");
+	if (vfdev->dax_enabled)
+		return uk_vf_write_dax(vfdev, nodeid, fh, len, off, in_buf,
+				       bytes_transferred, file_size);
+	return uk_vf_write_fuse(vfdev, nodeid, fh, len, off, in_buf,
+				bytes_transferred);
+}
 
-	// uk_vf_read(&vfdev, 2, 0,
-	// 	10, 0,outbuf);
+/**
+ * @brief reads up to @p len bytes at @p off of a file
+ *
+ * Through the DAX window, if it is enabled, otherwise with FUSE_READ
+ * requests. Fewer bytes are read at the end of the file.
+ *
+ * @param vfdev
+ * @param nodeid
+ * @param fh
+ * @param len
+ * @param off
+ * @param[out] out_buf
+ * @param[out] bytes_transferred how many bytes have been read
+ * @param[in,out] file_size size of the file known to the caller. Only a
+ * read beyond it asks the device for the size, which is stored here.
+ * Optional, the cached attributes are used otherwise.
+ * @return int 0 or a negative errno
+ */
+int uk_vf_read(struct uk_vfdev *vfdev, uint64_t nodeid, uint64_t fh,
+	       uint32_t len, uint64_t off, void *out_buf,
+	       uint32_t *bytes_transferred, uint64_t *file_size)
+{
+	UK_ASSERT(vfdev);
+	UK_ASSERT(vfdev->fuse_dev);
+	UK_ASSERT(bytes_transferred);
 
-	free(outbuf);
-}
\ No newline at end of file
+	if (vfdev->dax_enabled)
+		return uk_vf_read_dax(vfdev, nodeid, fh, len, off, out_buf,
+				      bytes_transferred, file_size);
+	return uk_vf_read_fuse(vfdev, nodeid, fh, len, off, out_buf,
+			       bytes_transferred);
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UK_VIRTIOFS__
+#define __UK_VIRTIOFS__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uk/fusedev.h>
+#include <uk/fusedev_trans.h>
+#include <uk/fuse.h>
+#include <uk/fuse_pcache.h>
+#include <uk/vf_dax.h>
+
+#include <vfscore/prex.h>
+
+struct uk_virtiofs_mount_data {
+	/* FUSE device. */
+	struct uk_fuse_dev		*dev;
+	/* Wanted transport. */
+	struct uk_fusedev_trans		*trans;
+	/* DAX window of the device, NULL if files cannot be mapped. */
+	struct uk_vf_dax		*dax;
+};
+
+struct uk_virtiofs_file_data {
+	/* File handle returned by FUSE_OPEN/FUSE_OPENDIR. */
+	uint64_t			fh;
+	/* Readahead state of the file. */
+	struct uk_fuse_ra_state		ra;
+	/* Directory cursor, opened by the first readdir() call. */
+	struct uk_fuse_readdirplus	rd;
+	bool				rd_open;
+};
+
+struct uk_virtiofs_node_data {
+	/* FUSE node id of the vfs node. */
+	uint64_t			nodeid;
+	/* Handle used by vop_write(), opened by the first write. */
+	uint64_t			wfh;
+};
+
+int uk_virtiofs_allocate_vnode_data(struct vnode *vp, uint64_t nodeid);
+void uk_virtiofs_free_vnode_data(struct vnode *vp);
+
+/* Default readdir buffer size. */
+#define UK_VIRTIOFS_READDIR_BUFSZ	8192
+
+#define UK_VIRTIOFS_FD(file) \
+	((struct uk_virtiofs_file_data *) (file)->f_data)
+#define UK_VIRTIOFS_ND(vnode) \
+	((struct uk_virtiofs_node_data *) (vnode)->v_data)
+#define UK_VIRTIOFS_NODEID(vnode) (UK_VIRTIOFS_ND(vnode)->nodeid)
+#define UK_VIRTIOFS_MD(mount) \
+	((struct uk_virtiofs_mount_data *) (mount)->m_data)
+
+#endif /* __UK_VIRTIOFS__ */
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <uk/config.h>
+#include <uk/errptr.h>
+#include <uk/print.h>
+#include <vfscore/mount.h>
+#include <vfscore/dentry.h>
+#include <stdlib.h>
+
+#include "virtiofs.h"
+
+extern struct vnops uk_virtiofs_vnops;
+
+static int uk_virtiofs_mount(struct mount *mp, const char *dev, int flags,
+			     const void *data);
+
+static int uk_virtiofs_unmount(struct mount *mp, int flags);
+
+#define uk_virtiofs_sync	((vfsop_sync_t)vfscore_nullop)
+#define uk_virtiofs_vget	((vfsop_vget_t)vfscore_nullop)
+#define uk_virtiofs_statfs	((vfsop_statfs_t)vfscore_nullop)
+
+struct vfsops uk_virtiofs_vfsops = {
+	.vfs_mount	= uk_virtiofs_mount,
+	.vfs_unmount	= uk_virtiofs_unmount,
+	.vfs_sync	= uk_virtiofs_sync,
+	.vfs_vget	= uk_virtiofs_vget,
+	.vfs_statfs	= uk_virtiofs_statfs,
+	.vfs_vnops	= &uk_virtiofs_vnops
+};
+
+static struct vfscore_fs_type uk_virtiofs_fs = {
+	.vs_name	= "virtiofs",
+	.vs_init	= NULL,
+	.vs_op		= &uk_virtiofs_vfsops
+};
+
+UK_FS_REGISTER(uk_virtiofs_fs);
+
+static int uk_virtiofs_mount(struct mount *mp, const char *dev,
+			     int flags __unused, const void *data __unused)
+{
+	struct uk_virtiofs_mount_data *md;
+	uint64_t dax_addr, dax_len;
+	int rc;
+
+	/* Set data as null, vnop_inactive() checks this for the root node. */
+	mp->m_root->d_vnode->v_data = NULL;
+
+	md = malloc(sizeof(*md));
+	if (!md)
+		return ENOMEM;
+
+	/* Currently, no options are supported. */
+	md->trans = uk_fusedev_trans_get_default();
+	if (!md->trans) {
+		rc = ENODEV;
+		goto out_free_mdata;
+	}
+
+	md->dax = NULL;
+	mp->m_data = md;
+
+	/* Establish connection with the given virtiofs tag. */
+	md->dev = uk_fusedev_connect(md->trans, dev, NULL);
+	if (PTRISERR(md->dev)) {
+		rc = -PTR2ERR(md->dev);
+		goto out_free_mdata;
+	}
+
+	rc = uk_fuse_request_init(md->dev);
+	if (rc) {
+		uk_pr_warn("Could not initialize the FUSE session: %d\n", rc);
+		rc = -rc;
+		goto out_disconnect;
+	}
+
+	/* Files are accessed through FUSE requests without a DAX window. */
+	if (!uk_fusedev_dax_window(md->dev, &dax_addr, &dax_len)) {
+		md->dax = uk_vf_dax_create(md->dev, dax_addr, dax_len);
+		if (PTRISERR(md->dax)) {
+			uk_pr_warn("DAX window unusable: %d\n",
+				   PTR2ERR(md->dax));
+			md->dax = NULL;
+		}
+	}
+
+	rc = uk_virtiofs_allocate_vnode_data(mp->m_root->d_vnode,
+					     FUSE_ROOT_ID);
+	if (rc != 0) {
+		rc = -rc;
+		goto out_destroy_dax;
+	}
+
+	return 0;
+
+out_destroy_dax:
+	if (md->dax)
+		uk_vf_dax_destroy(md->dax);
+out_disconnect:
+	uk_fusedev_disconnect(md->dev);
+out_free_mdata:
+	free(md);
+	return rc;
+}
+
+static void uk_virtiofs_release_tree(struct dentry *d)
+{
+	struct dentry *p;
+
+	uk_list_for_each_entry(p, &d->d_child_list, d_child_link) {
+		uk_virtiofs_release_tree(p);
+		drele(p);
+	}
+}
+
+static int uk_virtiofs_unmount(struct mount *mp, int flags __unused)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(mp);
+
+	uk_virtiofs_release_tree(mp->m_root);
+	vfscore_release_mp_dentries(mp);
+	/* Stops the reclaim thread, which sends requests to the device. */
+	if (md->dax)
+		uk_vf_dax_destroy(md->dax);
+	uk_fusedev_disconnect(md->dev);
+	free(md);
+
+	return 0;
+}
@@ -0,0 +1,723 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/errptr.h>
+#include <uk/fuse_node.h>
+#include <uk/fuse_wb.h>
+#include <vfscore/mount.h>
+#include <vfscore/dentry.h>
+#include <vfscore/vnode.h>
+#include <vfscore/file.h>
+#include <vfscore/fs.h>
+
+#include "virtiofs.h"
+#include "uk/vf_vnops.h"
+
+static int uk_virtiofs_vtype_from_mode(uint32_t mode)
+{
+	if (S_ISDIR(mode))
+		return VDIR;
+	if (S_ISLNK(mode))
+		return VLNK;
+	return VREG;
+}
+
+static void uk_virtiofs_timespec(struct timespec *ts, uint64_t sec,
+				 uint32_t nsec)
+{
+	ts->tv_sec = sec;
+	ts->tv_nsec = nsec;
+}
+
+int uk_virtiofs_allocate_vnode_data(struct vnode *vp, uint64_t nodeid)
+{
+	struct uk_virtiofs_node_data *nd;
+
+	nd = malloc(sizeof(*nd));
+	if (nd == NULL)
+		return -ENOMEM;
+
+	nd->nodeid = nodeid;
+	nd->wfh = INVALID_FILE_HANDLE;
+	vp->v_data = nd;
+
+	return 0;
+}
+
+void uk_virtiofs_free_vnode_data(struct vnode *vp)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(vp->v_mount);
+	struct uk_fuse_dev *dev = md->dev;
+	struct uk_virtiofs_node_data *nd = UK_VIRTIOFS_ND(vp);
+
+	if (!vp->v_data)
+		return;
+
+	/* Mappings of the node id must not outlive it. */
+	if (md->dax)
+		uk_vf_dax_invalidate(md->dax, nd->nodeid);
+
+	/* Releasing the handle also writes the dirty data of the node. */
+	if (nd->wfh != INVALID_FILE_HANDLE)
+		uk_fuse_request_release(dev, false, nd->nodeid, nd->wfh);
+
+	/* The root node is never forgotten. */
+	if (nd->nodeid != FUSE_ROOT_ID)
+		uk_fuse_request_forget(dev, nd->nodeid, UINT64_MAX);
+
+	free(nd);
+	vp->v_data = NULL;
+}
+
+/*
+ * vop_write() does not get the file, so the node keeps its own handle for
+ * writing, which the dirty data also refers to.
+ */
+static int uk_virtiofs_open_wfh(struct uk_fuse_dev *dev,
+				struct uk_virtiofs_node_data *nd)
+{
+	uint64_t fh;
+	int rc;
+
+	if (nd->wfh != INVALID_FILE_HANDLE)
+		return 0;
+
+	rc = uk_fuse_request_open(dev, false, nd->nodeid, O_WRONLY, &fh);
+	if (rc)
+		return rc;
+
+	nd->wfh = fh;
+	return 0;
+}
+
+static int uk_virtiofs_open(struct vfscore_file *file)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(file->f_dentry->d_mount)->dev;
+	struct vnode *vp = file->f_dentry->d_vnode;
+	uint64_t nodeid = UK_VIRTIOFS_NODEID(vp);
+	struct uk_virtiofs_file_data *fd;
+	int flags;
+	int rc;
+
+	fd = calloc(1, sizeof(*fd));
+	if (!fd)
+		return ENOMEM;
+
+	/*
+	 * Creation is done by vop_create(), truncation by vop_truncate() and
+	 * appending by vfscore.
+	 */
+	flags = vfscore_oflags(file->f_flags);
+	flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_APPEND | O_TRUNC);
+
+	rc = uk_fuse_request_open(dev, vp->v_type == VDIR, nodeid, flags,
+				  &fd->fh);
+	if (rc)
+		goto out;
+
+	file->f_data = fd;
+
+	return 0;
+
+out:
+	free(fd);
+	return -rc;
+}
+
+static int uk_virtiofs_close(struct vnode *vp, struct vfscore_file *file)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	struct uk_virtiofs_file_data *fd = UK_VIRTIOFS_FD(file);
+	uint64_t nodeid = UK_VIRTIOFS_NODEID(vp);
+	int rc = 0;
+
+	if (vp->v_type == VDIR) {
+		if (fd->rd_open)
+			rc = uk_fuse_readdirplus_close(&fd->rd);
+	} else {
+		/* Reports errors of the dirty data written back. */
+		rc = uk_fuse_request_flush(dev, nodeid, fd->fh);
+	}
+
+	uk_fuse_request_release(dev, vp->v_type == VDIR, nodeid, fd->fh);
+	free(fd);
+
+	return -rc;
+}
+
+static int uk_virtiofs_lookup(struct vnode *dvp, char *name,
+			      struct vnode **vpp)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(dvp->v_mount)->dev;
+	struct fuse_attr attr;
+	struct vnode *vp;
+	uint64_t nodeid;
+	int rc;
+
+	if (strlen(name) > NAME_MAX)
+		return ENAMETOOLONG;
+
+	rc = uk_fuse_request_lookup(dev, UK_VIRTIOFS_NODEID(dvp), name,
+				    &nodeid);
+	if (rc)
+		goto out;
+
+	if (vfscore_vget(dvp->v_mount, nodeid, &vp)) {
+		/* Already in cache. */
+		*vpp = vp;
+		/* if the vnode already has node data, it may be reused. */
+		if (vp->v_data) {
+			rc = 0;
+			goto out;
+		}
+	}
+
+	if (!vp) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = uk_fuse_request_get_attr(dev, nodeid, INVALID_FILE_HANDLE, &attr);
+	if (rc)
+		goto out;
+
+	vp->v_flags = 0;
+	vp->v_mode = attr.mode;
+	vp->v_type = uk_virtiofs_vtype_from_mode(attr.mode);
+	vp->v_size = attr.size;
+
+	rc = uk_virtiofs_allocate_vnode_data(vp, nodeid);
+	if (rc != 0)
+		goto out;
+
+	*vpp = vp;
+
+	return 0;
+
+out:
+	return -rc;
+}
+
+static int uk_virtiofs_inactive(struct vnode *vp)
+{
+	if (vp->v_data)
+		uk_virtiofs_free_vnode_data(vp);
+
+	return 0;
+}
+
+static int uk_virtiofs_create(struct vnode *dvp, char *name, mode_t mode)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(dvp->v_mount)->dev;
+	uint64_t nodeid, fh, nlookup;
+	int rc;
+
+	if (!S_ISREG(mode))
+		return EINVAL;
+	if (strlen(name) > NAME_MAX)
+		return ENAMETOOLONG;
+
+	rc = uk_fuse_request_create(dev, UK_VIRTIOFS_NODEID(dvp), name,
+				    O_WRONLY | O_EXCL, mode, &nodeid, &fh,
+				    &nlookup);
+	if (rc)
+		return -rc;
+
+	/* vfscore opens the new file through vop_open() */
+	uk_fuse_request_release(dev, false, nodeid, fh);
+
+	return 0;
+}
+
+static int uk_virtiofs_remove_generic(struct vnode *dvp, struct vnode *vp,
+				      char *name)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(dvp->v_mount)->dev;
+
+	/* The lookups are forgotten by vop_inactive(). */
+	return -uk_fuse_request_unlink(dev, name, vp->v_type == VDIR,
+				       UK_VIRTIOFS_NODEID(vp), 0,
+				       UK_VIRTIOFS_NODEID(dvp));
+}
+
+static int uk_virtiofs_remove(struct vnode *dvp, struct vnode *vp,
+			      char *name)
+{
+	return uk_virtiofs_remove_generic(dvp, vp, name);
+}
+
+static int uk_virtiofs_mkdir(struct vnode *dvp, char *name, mode_t mode)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(dvp->v_mount)->dev;
+	uint64_t nodeid, nlookup;
+
+	if (!S_ISDIR(mode))
+		return EINVAL;
+	if (strlen(name) > NAME_MAX)
+		return ENAMETOOLONG;
+
+	return -uk_fuse_request_mkdir(dev, UK_VIRTIOFS_NODEID(dvp), name,
+				      mode, &nodeid, &nlookup);
+}
+
+static int uk_virtiofs_rmdir(struct vnode *dvp, struct vnode *vp,
+			     char *name)
+{
+	return uk_virtiofs_remove_generic(dvp, vp, name);
+}
+
+static int uk_virtiofs_readdir(struct vnode *vp, struct vfscore_file *fp,
+			       struct dirent *dir)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	struct uk_virtiofs_file_data *fd = UK_VIRTIOFS_FD(fp);
+	const struct fuse_direntplus *direntplus;
+	int rc;
+
+	/* rewinddir() restarts the iteration. */
+	if (fd->rd_open && fp->f_offset == 0) {
+		rc = uk_fuse_readdirplus_close(&fd->rd);
+		fd->rd_open = false;
+		if (rc)
+			return -rc;
+	}
+
+	if (!fd->rd_open) {
+		rc = uk_fuse_readdirplus_open(dev, UK_VIRTIOFS_NODEID(vp),
+					      fd->fh,
+					      UK_VIRTIOFS_READDIR_BUFSZ, true,
+					      &fd->rd);
+		if (rc)
+			return -rc;
+		fd->rd_open = true;
+	}
+
+	rc = uk_fuse_readdirplus_next(&fd->rd, &direntplus);
+	if (rc < 0)
+		return -rc;
+
+	/* End of directory. */
+	if (rc == 0)
+		return ENOENT;
+
+	dir->d_type = direntplus->dirent.type;
+	dir->d_ino = direntplus->dirent.ino;
+	dir->d_off = direntplus->dirent.off;
+	strlcpy((char *) &dir->d_name, fd->rd.name, sizeof(dir->d_name));
+	fp->f_offset++;
+
+	return 0;
+}
+
+/*
+ * With a DAX window, file data is copied through the window instead of
+ * being transferred by FUSE_READ/FUSE_WRITE and cached in the page cache.
+ */
+static void uk_virtiofs_vfdev(struct uk_virtiofs_mount_data *md,
+			      struct uk_vfdev *vfdev)
+{
+	memset(vfdev, 0, sizeof(*vfdev));
+	vfdev->fuse_dev = md->dev;
+	vfdev->dax_enabled = true;
+	vfdev->dax = md->dax;
+}
+
+static int uk_virtiofs_read(struct vnode *vp, struct vfscore_file *fp,
+			    struct uio *uio, int ioflag __unused)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(vp->v_mount);
+	struct uk_fuse_dev *dev = md->dev;
+	struct uk_virtiofs_file_data *fd = UK_VIRTIOFS_FD(fp);
+	struct uk_vfdev vfdev;
+	struct iovec *iov;
+	uint32_t len, bytes;
+	uint64_t size = vp->v_size;
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (uio->uio_offset < 0)
+		return EINVAL;
+
+	uk_virtiofs_vfdev(md, &vfdev);
+
+	while (uio->uio_resid) {
+		iov = uio->uio_iov;
+		if (!iov->iov_len) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		len = MIN(iov->iov_len, (size_t) UINT32_MAX);
+		if (md->dax) {
+			/* The size is only asked for at the end of v_size */
+			rc = uk_vf_read(&vfdev, UK_VIRTIOFS_NODEID(vp), fd->fh,
+					len, uio->uio_offset, iov->iov_base,
+					&bytes, &size);
+			vp->v_size = size;
+		} else {
+			rc = uk_fuse_pcache_read(dev, UK_VIRTIOFS_NODEID(vp),
+						 fd->fh, uio->uio_offset, len,
+						 iov->iov_base, &bytes,
+						 &fd->ra);
+		}
+		if (rc)
+			return -rc;
+
+		iov->iov_base = (char *) iov->iov_base + bytes;
+		iov->iov_len -= bytes;
+		uio->uio_resid -= bytes;
+		uio->uio_offset += bytes;
+
+		/* End of file. */
+		if (bytes < len)
+			break;
+	}
+
+	return 0;
+}
+
+static int uk_virtiofs_write(struct vnode *vp, struct uio *uio, int ioflag)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(vp->v_mount);
+	struct uk_fuse_dev *dev = md->dev;
+	struct uk_virtiofs_node_data *nd = UK_VIRTIOFS_ND(vp);
+	struct fuse_attr attr;
+	struct uk_vfdev vfdev;
+	struct iovec *iov;
+	uint32_t len, bytes;
+	uint64_t size;
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (uio->uio_offset < 0)
+		return EINVAL;
+	if (uio->uio_offset >= LONG_MAX)
+		return EFBIG;
+	if (uio->uio_resid == 0)
+		return 0;
+
+	rc = uk_virtiofs_open_wfh(dev, nd);
+	if (rc)
+		return -rc;
+
+	if (ioflag & IO_APPEND) {
+		/* Another guest may have appended to the file meanwhile. */
+		rc = uk_fuse_request_get_attr(dev, nd->nodeid, nd->wfh, &attr);
+		if (rc)
+			return -rc;
+		vp->v_size = attr.size;
+		uio->uio_offset = vp->v_size;
+	}
+
+	uk_virtiofs_vfdev(md, &vfdev);
+	size = vp->v_size;
+
+	while (uio->uio_resid) {
+		iov = uio->uio_iov;
+		if (!iov->iov_len) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		len = MIN(iov->iov_len, (size_t) UINT32_MAX);
+		if (md->dax)
+			rc = uk_vf_write(&vfdev, nd->nodeid, nd->wfh, len,
+					 uio->uio_offset, iov->iov_base,
+					 &bytes, &size);
+		else
+			rc = uk_fuse_wb_write(dev, nd->nodeid, nd->wfh,
+					      iov->iov_base, len,
+					      uio->uio_offset, &bytes);
+		if (rc)
+			return -rc;
+
+		iov->iov_base = (char *) iov->iov_base + bytes;
+		iov->iov_len -= bytes;
+		uio->uio_resid -= bytes;
+		uio->uio_offset += bytes;
+
+		if (bytes < len)
+			break;
+	}
+
+	/*
+	 * If the uio offset after completion of the write requests is bigger
+	 * than the vnode's associated size, then the size must be updated
+	 * accordingly.
+	 */
+	if (uio->uio_offset > vp->v_size)
+		vp->v_size = uio->uio_offset;
+
+	return 0;
+}
+
+static int uk_virtiofs_fsync(struct vnode *vp, struct vfscore_file *fp)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+
+	return -uk_fuse_request_fsync(dev, vp->v_type == VDIR,
+				      UK_VIRTIOFS_NODEID(vp),
+				      UK_VIRTIOFS_FD(fp)->fh, 0);
+}
+
+static int uk_virtiofs_getattr(struct vnode *vp, struct vattr *attr)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	struct fuse_attr fattr;
+	int rc;
+
+	rc = uk_fuse_request_get_attr(dev, UK_VIRTIOFS_NODEID(vp),
+				      INVALID_FILE_HANDLE, &fattr);
+	if (rc)
+		return -rc;
+
+	attr->va_type = uk_virtiofs_vtype_from_mode(fattr.mode);
+	attr->va_mode = fattr.mode;
+	attr->va_nlink = fattr.nlink;
+	attr->va_uid = fattr.uid;
+	attr->va_gid = fattr.gid;
+	attr->va_nodeid = fattr.ino;
+	attr->va_size = fattr.size;
+	attr->va_nblocks = fattr.blocks;
+
+	uk_virtiofs_timespec(&attr->va_atime, fattr.atime, fattr.atimensec);
+	uk_virtiofs_timespec(&attr->va_mtime, fattr.mtime, fattr.mtimensec);
+	uk_virtiofs_timespec(&attr->va_ctime, fattr.ctime, fattr.ctimensec);
+
+	vp->v_size = fattr.size;
+
+	return 0;
+}
+
+static int uk_virtiofs_setattr(struct vnode *vp, struct vattr *attr)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	int rc;
+
+	/* Only the mode can be changed through FUSE_SETATTR currently. */
+	if (!(attr->va_mask & AT_MODE))
+		return 0;
+
+	rc = uk_fuse_request_setattr(dev, UK_VIRTIOFS_NODEID(vp),
+				     vp->v_type == VDIR, INVALID_FILE_HANDLE,
+				     attr->va_mode, 0, 0, 0);
+	if (rc)
+		return -rc;
+
+	vp->v_mode = (vp->v_mode & S_IFMT) | (attr->va_mode & ~S_IFMT);
+
+	return 0;
+}
+
+static int uk_virtiofs_truncate(struct vnode *vp, off_t length)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	struct uk_virtiofs_node_data *nd = UK_VIRTIOFS_ND(vp);
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (length < 0)
+		return EINVAL;
+
+	/* The handle of vop_write(), if there is one, identifies the writer */
+	rc = uk_fuse_request_truncate(dev, nd->nodeid, nd->wfh, length);
+	if (rc)
+		return -rc;
+
+	vp->v_size = length;
+	return 0;
+}
+
+static int uk_virtiofs_copy_file_range(struct vfscore_file *fp_in,
+				       off_t off_in,
+				       struct vfscore_file *fp_out,
+				       off_t off_out, size_t len,
+				       size_t *copied)
+{
+	struct vnode *vp_out = fp_out->f_dentry->d_vnode;
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp_out->v_mount)->dev;
+	uint64_t bytes;
+	int rc;
+
+	rc = uk_fuse_request_copy_file_range(dev,
+			UK_VIRTIOFS_NODEID(fp_in->f_dentry->d_vnode),
+			UK_VIRTIOFS_FD(fp_in)->fh, off_in,
+			UK_VIRTIOFS_NODEID(vp_out), UK_VIRTIOFS_FD(fp_out)->fh,
+			off_out, len, &bytes);
+	if (rc)
+		return -rc;
+
+	if (off_out + (off_t) bytes > vp_out->v_size)
+		vp_out->v_size = off_out + bytes;
+
+	*copied = bytes;
+	return 0;
+}
+
+static int uk_virtiofs_fallocate(struct vnode *vp, int mode, off_t offset,
+				 off_t len)
+{
+	struct uk_fuse_dev *dev = UK_VIRTIOFS_MD(vp->v_mount)->dev;
+	struct uk_virtiofs_node_data *nd = UK_VIRTIOFS_ND(vp);
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return ENODEV;
+
+	rc = uk_virtiofs_open_wfh(dev, nd);
+	if (rc)
+		return -rc;
+
+	rc = uk_fuse_request_fallocate(dev, nd->nodeid, nd->wfh, offset, len,
+				       mode);
+	if (rc)
+		return -rc;
+
+	if (!(mode & UK_FUSE_FALLOC_KEEP_SIZE) && offset + len > vp->v_size)
+		vp->v_size = offset + len;
+
+	return 0;
+}
+
+/*
+ * Maps the file through the DAX window, so that loads and stores reach the
+ * host's page cache. Accesses beyond the end of the file are not backed by
+ * the device and are fatal, like SIGBUS on Linux.
+ */
+static int uk_virtiofs_mmap(struct vnode *vp, struct vfscore_file *fp,
+			    off_t off, size_t len, int prot, int flags,
+			    void **addr)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(vp->v_mount);
+	uint64_t nodeid = UK_VIRTIOFS_NODEID(vp);
+	bool write = (flags & MAP_SHARED) && (prot & PROT_WRITE);
+	int rc;
+
+	if (!md->dax)
+		return ENODEV;
+	/* There is no copy on write, the caller has to copy the data. */
+	if ((flags & MAP_PRIVATE) && (prot & PROT_WRITE))
+		return ENODEV;
+
+	/* The mapping has to see the data written so far. */
+	rc = uk_fuse_wb_flush(md->dev, nodeid);
+	if (rc)
+		return -rc;
+
+	rc = uk_vf_dax_mmap(md->dax, nodeid, UK_VIRTIOFS_FD(fp)->fh, off, len,
+			    write, addr);
+	/* A private mapping can still be a copy, if the window is short */
+	if ((rc == -ENOMEM || rc == -ENOTSUP || rc == -ENOSPC)
+	    && (flags & MAP_PRIVATE))
+		return ENODEV;
+	return -rc;
+}
+
+static int uk_virtiofs_munmap(struct vnode *vp, struct vfscore_file *fp,
+			      void *addr, size_t len)
+{
+	struct uk_virtiofs_mount_data *md = UK_VIRTIOFS_MD(vp->v_mount);
+	uint64_t nodeid = UK_VIRTIOFS_NODEID(vp);
+	int rc;
+
+	if (!md->dax)
+		return EINVAL;
+
+	rc = uk_vf_dax_munmap(md->dax, addr, len);
+	if (rc)
+		return -rc;
+
+	/* Stores through the mapping bypassed the caches. */
+	if (fp->f_flags & UK_FWRITE) {
+		uk_fuse_pcache_invalidate(md->dev, nodeid, 0, UINT64_MAX);
+		uk_fuse_node_invalidate_attr(md->dev, nodeid);
+	}
+	return 0;
+}
+
+#define uk_virtiofs_seek	((vnop_seek_t)vfscore_vop_nullop)
+#define uk_virtiofs_ioctl	((vnop_ioctl_t)vfscore_vop_einval)
+#define uk_virtiofs_link	((vnop_link_t)vfscore_vop_eperm)
+#define uk_virtiofs_cache	((vnop_cache_t)NULL)
+#define uk_virtiofs_readlink	((vnop_readlink_t)vfscore_vop_einval)
+#define uk_virtiofs_symlink	((vnop_symlink_t)vfscore_vop_eperm)
+#define uk_virtiofs_rename	((vnop_rename_t)vfscore_vop_einval)
+
+struct vnops uk_virtiofs_vnops = {
+	.vop_open		= uk_virtiofs_open,
+	.vop_close		= uk_virtiofs_close,
+	.vop_read		= uk_virtiofs_read,
+	.vop_write		= uk_virtiofs_write,
+	.vop_seek		= uk_virtiofs_seek,
+	.vop_ioctl		= uk_virtiofs_ioctl,
+	.vop_fsync		= uk_virtiofs_fsync,
+	.vop_readdir		= uk_virtiofs_readdir,
+	.vop_lookup		= uk_virtiofs_lookup,
+	.vop_create		= uk_virtiofs_create,
+	.vop_remove		= uk_virtiofs_remove,
+	.vop_rename		= uk_virtiofs_rename,
+	.vop_mkdir		= uk_virtiofs_mkdir,
+	.vop_rmdir		= uk_virtiofs_rmdir,
+	.vop_getattr		= uk_virtiofs_getattr,
+	.vop_setattr		= uk_virtiofs_setattr,
+	.vop_inactive		= uk_virtiofs_inactive,
+	.vop_truncate		= uk_virtiofs_truncate,
+	.vop_link		= uk_virtiofs_link,
+	.vop_cache		= uk_virtiofs_cache,
+	.vop_fallocate		= uk_virtiofs_fallocate,
+	.vop_readlink		= uk_virtiofs_readlink,
+	.vop_symlink		= uk_virtiofs_symlink,
+	.vop_copy_file_range	= uk_virtiofs_copy_file_range,
+	.vop_mmap		= uk_virtiofs_mmap,
+	.vop_munmap		= uk_virtiofs_munmap
+};
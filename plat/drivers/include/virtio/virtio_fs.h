@@ -38,7 +38,15 @@
 // #include <virtio/virtio_config.h>
 #include <virtio/virtio_types.h>
 
+/* The device sends notifications on a queue of their own. */
+#define VIRTIO_FS_F_NOTIFICATION 0
+
 #define VIRTIO_FS_HIPRIO_QUEUE_ID 0
+/* With VIRTIO_FS_F_NOTIFICATION, the request queues follow this queue. */
+#define VIRTIO_FS_NOTIFY_QUEUE_ID 1
+
+/* Shared memory region of the DAX window */
+#define VIRTIO_FS_SHMCAP_ID_CACHE 0
 
 #define VIRTIO_FS_TAG_EXTRACT(tag_64, tag) 					\
 	do {								\
@@ -82,6 +82,9 @@ extern "C" {
 /* Arbitrary descriptor layouts. */
 #define VIRTIO_F_ANY_LAYOUT       27
 
+/* Support for the packed virtqueue layout */
+#define VIRTIO_F_RING_PACKED      34
+
 /**
  * Descriptor table entry.
  * Descriptor chains are chained together via @p next
@@ -173,12 +176,22 @@ struct vring {
  * NOTE: for VirtIO PCI, align is 4096.
  */
 
+/* Maximum number of descriptors in an indirect descriptor table */
+#define VIRTQUEUE_INDIRECT_MAX_DESC	64
+/* Maximum number of indirect descriptor tables per virtqueue */
+#define VIRTQUEUE_INDIRECT_MAX_TABLES	64
+/* Marks a buffer that does not use an indirect descriptor table */
+#define VIRTQUEUE_NO_INDIRECT		((__u16) -1)
+
 /* Buffer info */
 struct virtqueue_desc_info {
 	/* Cookie to identify driver buffer */
 	void *cookie;
 	/* # of descriptors in this buffer */
 	__u16 desc_count;
+	/* Indirect descriptor table used by this buffer (or
+	   VIRTQUEUE_NO_INDIRECT) */
+	__u16 indirect;
 };
 
 struct virtqueue_vring {
@@ -194,6 +207,18 @@ struct virtqueue_vring {
 	__u16 head_free_desc;
 	/* Index of the last used descriptor by the host. */
 	__u16 last_used_desc_idx;
+	/* Available index at the time the host was last notified. */
+	__u16 last_notified_avail_idx;
+	/* Set, if VIRTIO_F_EVENT_IDX has been negotiated. */
+	__u8 event_idx;
+	/* Preallocated indirect descriptor tables (NULL, if
+	   VIRTIO_F_INDIRECT_DESC has not been negotiated). */
+	struct vring_desc *indirect_mem;
+	/* Number of indirect descriptor tables. */
+	__u16 indirect_count;
+	/* Stack of free indirect descriptor tables. */
+	__u16 indirect_free_cnt;
+	__u16 *indirect_free;
 	/* Holds information for each driver buffer. */
 	struct virtqueue_desc_info vq_info[];
 };
@@ -205,7 +230,7 @@ struct virtqueue_vring {
  * versa. They are at the end for backwards compatibility.
  */
 #define vring_used_event(vr) ((vr)->avail->ring[(vr)->num])
-#define vring_avail_event(vr) (*(__virtio16 *)&(vr)->used->ring[(vr)->num])
+#define vring_avail_event(vr) (*(__virtio_le16 *)&(vr)->used->ring[(vr)->num])
 
 /**
  * @brief initialize pointers of the vring structure to the descriptor,
@@ -224,7 +249,8 @@ static inline void vring_init(struct vring *vr, unsigned int num, uint8_t *p,
 	vr->avail = (struct vring_avail *) (p +
 			num * sizeof(struct vring_desc));
 	vr->used = (void *)
-	(((unsigned long) &vr->avail->ring[num] + align - 1) & ~(align - 1));
+	(((unsigned long) &vr->avail->ring[num] + sizeof(__virtio_le16)
+	  + align - 1) & ~(align - 1));
 }
 
 static inline unsigned int vring_size(unsigned int num, unsigned long align)
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PLAT_DRV_VIRTIO_RING_PACKED_H__
+#define __PLAT_DRV_VIRTIO_RING_PACKED_H__
+
+#include <uk/alloc.h>
+#include <uk/sglist.h>
+#include <virtio/virtio_types.h>
+#include <virtio/virtqueue.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus __ */
+
+/* Bit positions of the avail and used flags of a packed descriptor. */
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+
+/* Flags of the event suppression structures. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+/* Only if VIRTIO_F_EVENT_IDX: notify at the descriptor in off_wrap. */
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+/* Bit position of the wrap counter within off_wrap. */
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
+/**
+ * Packed descriptor ring entry (16 bytes).
+ * Descriptors of a chain are placed one after another in the ring.
+ */
+struct vring_packed_desc {
+	/* Address (guest-physical). */
+	__virtio_le64 addr;
+	/* Length. */
+	__virtio_le32 len;
+	/* Buffer ID. */
+	__virtio_le16 id;
+	/* VRING_DESC_F_* flags, plus the avail and used flags. */
+	__virtio_le16 flags;
+};
+
+/**
+ * Event suppression structure. The driver area is written by the driver to
+ * control interrupts, the device area is written by the device to control
+ * notifications.
+ */
+struct vring_packed_desc_event {
+	/* Descriptor ring offset and wrap counter (only with DESC). */
+	__virtio_le16 off_wrap;
+	/* VRING_PACKED_EVENT_FLAG_* */
+	__virtio_le16 flags;
+};
+
+/* Buffer info, indexed by buffer ID */
+struct virtqueue_packed_info {
+	/* Cookie to identify driver buffer */
+	void *cookie;
+	/* # of descriptors in this buffer */
+	__u16 desc_count;
+	/* Next free buffer ID */
+	__u16 next;
+};
+
+/**
+ * A packed virtqueue. It implements the same virtqueue_* API as the split
+ * virtqueue (struct virtqueue_vring).
+ */
+struct virtqueue_packed {
+	struct virtqueue vq;
+	/* Number of descriptors in the ring. */
+	__u16 num;
+	/* Descriptor ring */
+	struct vring_packed_desc *desc;
+	/* Driver event suppression area (written by us) */
+	struct vring_packed_desc_event *driver_event;
+	/* Device event suppression area (written by the host) */
+	struct vring_packed_desc_event *device_event;
+	/* Memory address of the virtqueue */
+	void *vring_mem;
+	/* Number of available descriptors. */
+	__u16 desc_avail;
+	/* Ring index, where the next buffer is made available. */
+	__u16 next_avail;
+	/* Avail wrap counter. */
+	__u8 avail_wrap;
+	/* Ring index of the next used buffer. */
+	__u16 last_used;
+	/* Used wrap counter. */
+	__u8 used_wrap;
+	/* Descriptors made available since the host was last notified. */
+	__u16 num_added;
+	/* Head of the list of free buffer IDs. */
+	__u16 free_head;
+	/* Last flags written to the driver event suppression area. */
+	__u16 event_flags;
+	/* Set, if VIRTIO_F_EVENT_IDX has been negotiated. */
+	__u8 event_idx;
+	/* Holds information for each driver buffer. */
+	struct virtqueue_packed_info info[];
+};
+
+#define to_virtqueue_packed(vq)			\
+	__containerof(vq, struct virtqueue_packed, vq)
+
+/*
+ * Packed counterparts of the virtqueue_* functions. They are called by
+ * the virtqueue_* functions for packed virtqueues and should not be used
+ * directly.
+ */
+struct virtqueue *virtqueue_packed_create(__u16 queue_id, __u16 nr_descs,
+					  virtqueue_callback_t callback,
+					  virtqueue_notify_host_t notify,
+					  struct virtio_dev *vdev,
+					  struct uk_alloc *a);
+void virtqueue_packed_destroy(struct virtqueue *vq, struct uk_alloc *a);
+int virtqueue_packed_buffer_enqueue(struct virtqueue *vq, void *cookie,
+				    struct uk_sglist *sg, __u16 read_bufs,
+				    __u16 write_bufs);
+int virtqueue_packed_buffer_dequeue(struct virtqueue *vq, void **cookie,
+				    __u32 *len);
+int virtqueue_packed_hasdata(struct virtqueue *vq);
+int virtqueue_packed_notify_enabled(struct virtqueue *vq);
+void virtqueue_packed_intr_disable(struct virtqueue *vq);
+int virtqueue_packed_intr_enable(struct virtqueue *vq);
+__paddr_t virtqueue_packed_physaddr(struct virtqueue *vq);
+__paddr_t virtqueue_packed_get_avail_addr(struct virtqueue *vq);
+__paddr_t virtqueue_packed_get_used_addr(struct virtqueue *vq);
+unsigned int virtqueue_packed_vring_get_num(struct virtqueue *vq);
+int virtqueue_packed_is_full(struct virtqueue *vq);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus __ */
+
+#endif /* __PLAT_DRV_VIRTIO_RING_PACKED_H__ */
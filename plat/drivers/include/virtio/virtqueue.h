@@ -59,6 +59,8 @@ struct virtqueue {
 	struct virtio_dev *vdev;
 	/* Virtqueue identifier */
 	__u16 queue_id;
+	/* Set, if the queue uses the packed layout (VIRTIO_F_RING_PACKED) */
+	__u8 packed;
 	/* Notify to the host */
 	virtqueue_notify_host_t vq_notify_host;
 	/* Callback from the virtqueue */
@@ -27,6 +27,7 @@
 #include <stdbool.h>
 #include <virtio/virtio_bus.h>
 #include <virtio/virtio_ids.h>
+#include <virtio/virtio_ring.h>
 #include <uk/blkdev.h>
 #include <virtio/virtio_blk.h>
 #include <uk/sglist.h>
@@ -50,7 +51,9 @@
  *	Multi-queue,
  *	Maximum size of a segment for requests,
  *	Maximum number of segments per request,
- *	Flush
+ *	Flush,
+ *	Event index,
+ *	Indirect descriptors
  **/
 #define VIRTIO_BLK_DRV_FEATURES(features)				\
 	do {								\
@@ -61,6 +64,8 @@
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_MQ);		\
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_SIZE_MAX);	\
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_FLUSH);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_F_EVENT_IDX);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_F_INDIRECT_DESC);	\
 	} while (0)
 
 static struct uk_alloc *a;
@@ -50,26 +50,54 @@
 #include <virtio/virtio_fs.h>
 #include <virtio/virtio_ids.h>
 #include <virtio/virtio_config.h>
+#include <virtio/virtio_ring.h>
 #include <virtio/virtio_types.h>
 #include <uk/sglist.h>
 #include <uk/plat/spinlock.h>
+#include <uk/plat/lcpu.h>
 #include <uk/fuse.h>
 #include <uk/fusedev.h>
 #include <uk/fusereq.h>
 #include <stdbool.h>
-#include <uk/vf_vnops.h>
 #include <uk/bench_tests.h>
 /* TODOFS: remove */
 
 
 
 #define DRIVER_NAME	"virtio-fs"
+/* Maximum number of segments of a single request. */
+#define VIRTIO_FS_MAX_SEGS	128
+/* Number of buffers kept on the notification queue. */
+#define VIRTIO_FS_NOTIFY_BUFS	16
 static struct uk_alloc *a;
 
 /* List of initialized virtio fs devices. */
 static UK_LIST_HEAD(virtio_fs_device_list);
 static __spinlock virtio_fs_device_list_lock;
 
+struct virtio_fs_device;
+
+/**
+ * @brief A single virtqueue of a virtio-fs device, together with the state
+ * needed to submit requests to it.
+ *
+ * Every queue is protected by its own lock, so that requests submitted to
+ * different queues (e.g., from different CPUs) do not contend.
+ */
+struct virtio_fs_queue {
+	/* Virtqueue reference. */
+	struct virtqueue *vq;
+	/* Device this queue belongs to. */
+	struct virtio_fs_device *dev;
+	/* Number of requests submitted, but not yet received. */
+	unsigned int inflight;
+	/* Scatter-gather list. */
+	struct uk_sglist sg;
+	struct uk_sglist_seg sgsegs[VIRTIO_FS_MAX_SEGS];
+	/* Spinlock protecting the sg list and the vq. */
+	__spinlock spinlock;
+};
+
 /**
  * @brief Holds information for communication with a single virtio-fs device,
  * which runs on host.
@@ -90,20 +118,23 @@ struct virtio_fs_device {
 	__virtio_le32 num_request_queues;
 	/* Entry within the virtio devices' list. */
 	struct uk_list_head _list;
-	/* Virtqueue references. */
-	struct virtqueue *vq_hiprio;
-	struct virtqueue *vq_notify;
-	struct virtqueue **vq_req;
+	/* Queue references. */
+	struct virtio_fs_queue hiprio;
+	struct virtio_fs_queue notify;
+	struct virtio_fs_queue *req_queues;
+	/* Whether VIRTIO_FS_F_NOTIFICATION has been negotiated. */
+	bool has_notify;
+	/* Receive buffers of the notification queue. */
+	char *notify_bufs;
+	uint32_t notify_buf_size;
+	uint16_t notify_nbufs;
 	/* Hw queue identifier. */
 	uint16_t hwvq_id;
 	/* libukfuse associated device (NULL if the device is not in use). */
 	struct uk_fuse_dev *fusedev;
-	/* Scatter-gather list. */
-	struct uk_sglist sg;
-	//TODOFS: change
-	struct uk_sglist_seg sgsegs[128];
-	/* Spinlock protecting the sg list and the vq. */
-	__spinlock spinlock;
+	/* Number of threads busy-polling the request queues. Interrupts of
+	   the request queues are disabled while it is not 0. */
+	unsigned int pollers;
 };
 
 static int virtio_fs_connect(struct uk_fuse_dev *fusedev,
@@ -154,7 +185,7 @@ static int virtio_fs_disconnect(struct uk_fuse_dev *fusedev)
 	/* Lock to prevent race conditions on fusedev
 	   with virtio_fs_connect */
 	ukarch_spin_lock(&virtio_fs_device_list_lock);
-	dev->fusedev = NULL;
+	UK_WRITE_ONCE(dev->fusedev, NULL);
 	ukarch_spin_unlock(&virtio_fs_device_list_lock);
 
 	return 0;
@@ -170,7 +201,8 @@ static int virtio_fs_disconnect(struct uk_fuse_dev *fusedev)
  */
 static int virtio_fs_recv(struct virtqueue *vq, void *priv)
 {
-	struct virtio_fs_device *dev;
+	struct virtio_fs_queue *q;
+	unsigned long flags;
 	uint32_t len;
 	struct uk_fuse_req *req = NULL;
 	int rc = 0;
@@ -179,16 +211,19 @@ static int virtio_fs_recv(struct virtqueue *vq, void *priv)
 	UK_ASSERT(vq);
 	UK_ASSERT(priv);
 
-	dev = priv;
+	q = priv;
 
 	while (1) {
 		/*
-		 * Protect against data races with virtio_9p_request() calls
-		 * which are trying to enqueue to the same vq.
+		 * Protect against data races with virtio_fs_request() calls
+		 * which are trying to enqueue to the same vq. Interrupts are
+		 * disabled, as this is also called by polling threads.
 		 */
-		ukarch_spin_lock(&dev->spinlock);
+		ukplat_spin_lock_irqsave(&q->spinlock, flags);
 		rc = virtqueue_buffer_dequeue(vq, (void **)&req, &len);
-		ukarch_spin_unlock(&dev->spinlock);
+		if (rc >= 0)
+			q->inflight--;
+		ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
 		if (rc < 0)
 			break;
 
@@ -198,25 +233,24 @@ static int virtio_fs_recv(struct virtqueue *vq, void *priv)
 			((struct fuse_in_header *) req->in_buffer)->opcode,
 			len);
 
+		/* Received not what expected (usually less). */
+		if (len != req->out_buffer_size + (req->zc_dir ==
+		    UK_FUSEREQ_ZCDIR_READ ? req->zc_size : 0))
+			uk_pr_debug("out_buffer_size is %"__PRIu32 ", but "
+			"received %" __PRIu32 " bytes.\n", req->out_buffer_size,
+			len);
+
 		/*Notify the FUSE API that this request has been successfully
-		 * received.
+		 * received. The completion callback of an asynchronous
+		 * request may release it, so the request is not accessed
+		 * afterwards.
 		 */
 		uk_fusereq_receive_cb(req, len);
 
-		/* TODOFS: req management? : */
+		/* Drop the reference taken in virtio_fs_request() */
 		uk_fusereq_put(req);
 		handled = 1;
 
-		/* Received not what expected (usually less). */
-		if (len != req->out_buffer_size) {
-			/* Not always an error. Used for debugging bc the text
-			is red */
-			uk_pr_err("out_buffer_size is %"__PRIu32 ", but "
-			"received %" __PRIu32 " bytes.\n", req->out_buffer_size,
-			len);
-			break;
-		}
-
 		/* Break if there are no more buffers on the virtqueue. */
 		if (rc == 0)
 			break;
@@ -227,101 +261,429 @@ static int virtio_fs_recv(struct virtqueue *vq, void *priv)
 	 * blocked on ENOSPC errors.
 	 */
 	if (handled)
-		uk_fusedev_xmit_notify(dev->fusedev);
+		uk_fusedev_xmit_notify(q->dev->fusedev);
 
 	return handled;
 }
 
 /**
- * @brief
+ * @brief appends the first device-writable buffer of a request to @p sg
  *
- * @param fuse_dev
+ * uk_sglist_append() merges physically contiguous ranges into one segment.
+ * The buffer is therefore appended to a view of the free segments only, so
+ * that it never gets merged into the last device-readable segment, even if it
+ * directly follows it in memory.
+ *
+ * @return int 0 or -ENOSPC
+ */
+static int virtio_fs_sg_append_writable(struct uk_sglist *sg, void *buf,
+					size_t len)
+{
+	struct uk_sglist wsg;
+	int rc;
+
+	uk_sglist_init(&wsg, sg->sg_maxseg - sg->sg_nseg,
+		       &sg->sg_segs[sg->sg_nseg]);
+	rc = uk_sglist_append(&wsg, buf, len);
+	if (rc < 0)
+		return rc;
+
+	sg->sg_nseg += wsg.sg_nseg;
+	return 0;
+}
+
+/**
+ * @brief selects the request queue, a request is submitted to
+ *
+ * With CONFIG_VIRTIO_FS_QSEL_PERCPU every CPU submits to its own queue, so
+ * that CPUs do not contend on the queue locks. With
+ * CONFIG_VIRTIO_FS_QSEL_LEAST_LOADED the queue with the fewest requests in
+ * flight is used.
+ */
+static struct virtio_fs_queue *virtio_fs_queue_select(
+						struct virtio_fs_device *dev)
+{
+#if CONFIG_VIRTIO_FS_QSEL_LEAST_LOADED
+	struct virtio_fs_queue *q, *best;
+	unsigned int best_inflight, inflight;
+
+	best = &dev->req_queues[0];
+	best_inflight = UK_READ_ONCE(best->inflight);
+	for (__virtio_le32 i = 1; i < dev->num_request_queues; i++) {
+		if (best_inflight == 0)
+			break;
+		q = &dev->req_queues[i];
+		inflight = UK_READ_ONCE(q->inflight);
+		if (inflight < best_inflight) {
+			best = q;
+			best_inflight = inflight;
+		}
+	}
+
+	return best;
+#else /* CONFIG_VIRTIO_FS_QSEL_PERCPU */
+	return &dev->req_queues[ukplat_lcpu_idx() % dev->num_request_queues];
+#endif
+}
+
+/**
+ * @brief enqueues a request on the virtqueue @p q, without notifying the host
+ *
+ * Has to be called with q->spinlock held. The reference to @p req, which the
+ * queue holds until virtio_fs_recv() has dequeued it, is taken on success.
+ *
+ * @param q
  * @param req
  * @return int -ENOSPC, if not enough descriptors are available on a vring.
  */
-static int virtio_fs_request(struct uk_fuse_dev *fuse_dev,
-			     struct uk_fuse_req *req)
+static int virtio_fs_queue_enqueue(struct virtio_fs_queue *q,
+				   struct uk_fuse_req *req)
 {
-	struct virtio_fs_device *dev;
-	unsigned long flags;
-	bool failed = false;
 	size_t read_segs, write_segs = 0;
-	int host_notified = 0;
 	int rc = 0;
 
-	UK_ASSERT(fuse_dev);
+	UK_ASSERT(q);
 	UK_ASSERT(req);
 	UK_ASSERT(req->in_buffer);
 
-	uk_fusereq_get(req);
-	dev = fuse_dev->priv;
-	/*
-	* Protect against data races with virtio_fs_recv() calls
-	* which are trying to dequeue from the same vq.
-	*/
-	ukplat_spin_lock_irqsave(&dev->spinlock, flags);
-	uk_sglist_reset(&dev->sg);
+	uk_sglist_reset(&q->sg);
 
-	rc = uk_sglist_append(&dev->sg, req->in_buffer,
+	rc = uk_sglist_append(&q->sg, req->in_buffer,
 			      req->in_buffer_size);
-	if (rc < 0) {
-		failed = true;
-		goto out_unlock;
+	if (rc < 0)
+		goto err_sg;
+
+	if (req->zc_dir == UK_FUSEREQ_ZCDIR_WRITE) {
+		rc = uk_sglist_append(&q->sg, req->zc_buf, req->zc_size);
+		if (rc < 0)
+			goto err_sg;
 	}
 
-	read_segs = dev->sg.sg_nseg;
+	read_segs = q->sg.sg_nseg;
 
 	/* no reply expected, when req->out_buffer == 0 */
 	if (req->out_buffer_size == 0)
 		goto skip_outbuf;
 
-	rc = uk_sglist_append(&dev->sg, req->out_buffer,
-			req->out_buffer_size);
-	if (rc < 0) {
-		failed = true;
-		goto out_unlock;
+	rc = virtio_fs_sg_append_writable(&q->sg, req->out_buffer,
+					  req->out_buffer_size);
+	if (rc < 0)
+		goto err_sg;
+
+	if (req->zc_dir == UK_FUSEREQ_ZCDIR_READ) {
+		rc = uk_sglist_append(&q->sg, req->zc_buf, req->zc_size);
+		if (rc < 0)
+			goto err_sg;
 	}
 
-	write_segs = dev->sg.sg_nseg - read_segs;
+	write_segs = q->sg.sg_nseg - read_segs;
 
 skip_outbuf:
 
-	/* TODOFS: write vq management code (i.e., which req virtqueue to use)*/
-	rc = virtqueue_buffer_enqueue(dev->vq_req[0], req, &dev->sg,
+	rc = virtqueue_buffer_enqueue(q->vq, req, &q->sg,
 				      read_segs, write_segs);
-	if (likely(rc >= 0)) {
-		UK_WRITE_ONCE(req->state, UK_FUSEREQ_SENT);
-		uk_pr_debug("Sending request: unique: %" __PRIu64 ", opcode: %"
-			__PRIu32 ", nodeid: %" __PRIu64 ", pid %" __PRIu32 "\n",
-			((struct fuse_in_header *) req->in_buffer)->unique,
-			((struct fuse_in_header *) req->in_buffer)->opcode,
-			((struct fuse_in_header *) req->in_buffer)->nodeid,
-			((struct fuse_in_header *) req->in_buffer)->pid);
+	if (unlikely(rc < 0))
+		return rc;
 
-		virtqueue_host_notify(dev->vq_req[0]);
-		host_notified = 1;
-		rc = 0;
-	}
+	/*
+	 * virtio_fs_recv() takes q->spinlock before dequeueing, so the
+	 * reference can not be dropped before we have taken it.
+	 */
+	uk_fusereq_get(req);
+	q->inflight++;
+	UK_WRITE_ONCE(req->state, UK_FUSEREQ_SENT);
+	uk_pr_debug("Sending request: unique: %" __PRIu64 ", opcode: %"
+		__PRIu32 ", nodeid: %" __PRIu64 ", pid %" __PRIu32 "\n",
+		((struct fuse_in_header *) req->in_buffer)->unique,
+		((struct fuse_in_header *) req->in_buffer)->opcode,
+		((struct fuse_in_header *) req->in_buffer)->nodeid,
+		((struct fuse_in_header *) req->in_buffer)->pid);
+	return 0;
 
-out_unlock:
-	if (failed)
-		uk_pr_err(DRIVER_NAME": Failed to append to the sg list.\n");
-	ukplat_spin_unlock_irqrestore(&dev->spinlock, flags);
+err_sg:
+	uk_pr_err(DRIVER_NAME": Failed to append to the sg list.\n");
+	return rc;
+}
+
+/**
+ * @brief enqueues a request on the virtqueue @p q and notifies the host
+ *
+ * @param q
+ * @param req
+ * @return int -ENOSPC, if not enough descriptors are available on a vring.
+ */
+static int virtio_fs_queue_request(struct virtio_fs_queue *q,
+				   struct uk_fuse_req *req)
+{
+	unsigned long flags;
+	int rc;
+
+	UK_ASSERT(q);
 
 	/*
-	 * Release the reference to the FUSE request if it was not successfully
-	 * sent.
-	 */
-	if (!host_notified)
-		uk_fusereq_put(req);
+	* Protect against data races with virtio_fs_recv() calls
+	* which are trying to dequeue from the same vq.
+	*/
+	ukplat_spin_lock_irqsave(&q->spinlock, flags);
+	rc = virtio_fs_queue_enqueue(q, req);
+	if (likely(rc == 0))
+		virtqueue_host_notify(q->vq);
+	ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
 
 	return rc;
 }
 
+static int virtio_fs_request(struct uk_fuse_dev *fuse_dev,
+			     struct uk_fuse_req *req)
+{
+	struct virtio_fs_device *dev;
+
+	UK_ASSERT(fuse_dev);
+	UK_ASSERT(req);
+	dev = fuse_dev->priv;
+
+	return virtio_fs_queue_request(req->hiprio ? &dev->hiprio
+					       : virtio_fs_queue_select(dev),
+				       req);
+}
+
+/**
+ * @brief enqueues as many of @p reqs as fit on one queue and notifies the host
+ * once for all of them
+ *
+ * High priority requests go to the hiprio queue, the others to a request
+ * queue. The batch is cut short, where the priority changes.
+ *
+ * @param fuse_dev
+ * @param reqs
+ * @param count number of requests in @p reqs
+ * @return int the number of requests enqueued (from the start of @p reqs),
+ * or a negative error code if none has been enqueued (-ENOSPC, if not
+ * enough descriptors are available on the vring).
+ */
+static int virtio_fs_request_batch(struct uk_fuse_dev *fuse_dev,
+				   struct uk_fuse_req **reqs,
+				   unsigned int count)
+{
+	struct virtio_fs_device *dev;
+	struct virtio_fs_queue *q;
+	unsigned long flags;
+	unsigned int i;
+	int rc = 0;
+
+	UK_ASSERT(fuse_dev);
+	UK_ASSERT(reqs);
+
+	if (count == 0)
+		return 0;
+
+	dev = fuse_dev->priv;
+	q = reqs[0]->hiprio ? &dev->hiprio : virtio_fs_queue_select(dev);
+
+	ukplat_spin_lock_irqsave(&q->spinlock, flags);
+	for (i = 0; i < count; i++) {
+		/* The batch ends, where the queue changes */
+		if (reqs[i]->hiprio != reqs[0]->hiprio)
+			break;
+		rc = virtio_fs_queue_enqueue(q, reqs[i]);
+		if (rc < 0)
+			break;
+	}
+	if (i > 0)
+		virtqueue_host_notify(q->vq);
+	ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+
+	return i > 0 ? (int) i : rc;
+}
+
+static void virtio_fs_poll_mode(struct uk_fuse_dev *fuse_dev, bool polling)
+{
+	struct virtio_fs_device *dev;
+	struct virtio_fs_queue *q;
+	unsigned long flags;
+	int pending;
+
+	UK_ASSERT(fuse_dev);
+	dev = fuse_dev->priv;
+
+	if (polling) {
+		/* The first poller disables the interrupts */
+		if (ukarch_inc(&dev->pollers) != 0)
+			return;
+
+		for (__virtio_le32 i = 0; i < dev->num_request_queues; i++) {
+			q = &dev->req_queues[i];
+			ukplat_spin_lock_irqsave(&q->spinlock, flags);
+			virtqueue_intr_disable(q->vq);
+			ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+		}
+		return;
+	}
+
+	/* The last poller enables them again */
+	if (ukarch_dec(&dev->pollers) != 1)
+		return;
+
+	for (__virtio_le32 i = 0; i < dev->num_request_queues; i++) {
+		q = &dev->req_queues[i];
+		ukplat_spin_lock_irqsave(&q->spinlock, flags);
+		pending = virtqueue_intr_enable(q->vq);
+		ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+
+		/* Replies, that arrived after the last poll, do not raise
+		   an interrupt anymore. */
+		if (pending)
+			virtio_fs_recv(q->vq, q);
+	}
+}
+
+static int virtio_fs_poll(struct uk_fuse_dev *fuse_dev)
+{
+	struct virtio_fs_device *dev;
+	struct virtio_fs_queue *q;
+	int handled = 0;
+
+	UK_ASSERT(fuse_dev);
+	dev = fuse_dev->priv;
+
+	for (__virtio_le32 i = 0; i < dev->num_request_queues; i++) {
+		q = &dev->req_queues[i];
+		if (virtqueue_hasdata(q->vq))
+			handled += virtio_fs_recv(q->vq, q);
+	}
+
+	return handled;
+}
+
+/**
+ * @brief gives the notification buffer @p buf (back) to the device
+ *
+ * Has to be called with q->spinlock held.
+ */
+static int virtio_fs_notify_post(struct virtio_fs_queue *q, char *buf)
+{
+	int rc;
+
+	uk_sglist_reset(&q->sg);
+	rc = uk_sglist_append(&q->sg, buf, q->dev->notify_buf_size);
+	if (unlikely(rc < 0))
+		return rc;
+
+	return virtqueue_buffer_enqueue(q->vq, buf, &q->sg, 0, q->sg.sg_nseg);
+}
+
+/**
+ * @brief interrupt handler of the notification queue
+ *
+ * Notifications are processed by libukfuse outside of the interrupt
+ * context, which retrieves them with virtio_fs_notify_poll(). Interrupts
+ * stay off until then. Notifications for a device not in use are dropped.
+ */
+static int virtio_fs_notify_recv(struct virtqueue *vq, void *priv)
+{
+	struct virtio_fs_queue *q;
+	struct uk_fuse_dev *fusedev;
+	unsigned long flags;
+	uint32_t len;
+	char *buf;
+
+	UK_ASSERT(vq);
+	UK_ASSERT(priv);
+
+	q = priv;
+
+	ukplat_spin_lock_irqsave(&q->spinlock, flags);
+	fusedev = UK_READ_ONCE(q->dev->fusedev);
+	if (fusedev) {
+		virtqueue_intr_disable(vq);
+	} else {
+		while (virtqueue_buffer_dequeue(vq, (void **) &buf, &len) >= 0)
+			virtio_fs_notify_post(q, buf);
+		virtqueue_host_notify(vq);
+	}
+	ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+
+	if (fusedev)
+		uk_fuse_notify_wakeup(fusedev);
+
+	return 1;
+}
+
+static int virtio_fs_notify_poll(struct uk_fuse_dev *fuse_dev)
+{
+	struct virtio_fs_device *dev;
+	struct virtio_fs_queue *q;
+	unsigned long flags;
+	uint32_t len;
+	char *buf;
+	int rc, handled = 0;
+	bool pending;
+
+	UK_ASSERT(fuse_dev);
+	dev = fuse_dev->priv;
+	q = &dev->notify;
+
+	if (!dev->has_notify)
+		return 0;
+
+	do {
+		for (;;) {
+			ukplat_spin_lock_irqsave(&q->spinlock, flags);
+			rc = virtqueue_buffer_dequeue(q->vq, (void **) &buf,
+						      &len);
+			ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+			if (rc < 0)
+				break;
+
+			uk_fuse_notify(fuse_dev, buf, len);
+			handled++;
+
+			ukplat_spin_lock_irqsave(&q->spinlock, flags);
+			if (unlikely(virtio_fs_notify_post(q, buf) < 0))
+				uk_pr_err(DRIVER_NAME": Lost a notification "
+					  "buffer\n");
+			virtqueue_host_notify(q->vq);
+			ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+		}
+
+		/* Notifications, that arrived after the last dequeue, do not
+		   raise an interrupt anymore. */
+		ukplat_spin_lock_irqsave(&q->spinlock, flags);
+		pending = virtqueue_intr_enable(q->vq);
+		ukplat_spin_unlock_irqrestore(&q->spinlock, flags);
+	} while (pending);
+
+	return handled;
+}
+
+static int virtio_fs_dax_window(struct uk_fuse_dev *fuse_dev, uint64_t *addr,
+				uint64_t *len)
+{
+	struct virtio_fs_device *dev;
+	struct virtio_dev *vdev;
+
+	UK_ASSERT(fuse_dev);
+	dev = fuse_dev->priv;
+	vdev = dev->vdev;
+
+	if (!vdev->cops->shm_present
+	    || !vdev->cops->shm_present(vdev, VIRTIO_FS_SHMCAP_ID_CACHE))
+		return -ENODEV;
+
+	*addr = vdev->cops->get_shm_addr(vdev, VIRTIO_FS_SHMCAP_ID_CACHE);
+	*len = vdev->cops->get_shm_length(vdev, VIRTIO_FS_SHMCAP_ID_CACHE);
+	return *len ? 0 : -ENODEV;
+}
+
 static const struct uk_fusedev_trans_ops viofs_trans_ops = {
 	.connect		= virtio_fs_connect,
 	.disconnect		= virtio_fs_disconnect,
-	.request		= virtio_fs_request
+	.request		= virtio_fs_request,
+	.request_batch		= virtio_fs_request_batch,
+	.poll_mode		= virtio_fs_poll_mode,
+	.poll			= virtio_fs_poll,
+	.notify_poll		= virtio_fs_notify_poll,
+	.dax_window		= virtio_fs_dax_window
 };
 
 /**
@@ -340,6 +702,12 @@ static inline void virtio_fs_feature_set(struct virtio_fs_device *d)
 	d->vdev->features = 0;
 	// VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_9P_F_MOUNT_TAG);
 	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_VERSION_1);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_EVENT_IDX);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_INDIRECT_DESC);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_FS_F_NOTIFICATION);
+#if CONFIG_VIRTIO_RING_PACKED
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_RING_PACKED);
+#endif /* CONFIG_VIRTIO_RING_PACKED */
 }
 
 static inline int virtio_fs_scan_device_config(struct virtio_fs_device *d)
@@ -402,6 +770,17 @@ static int virtio_fs_feature_negotiate(struct virtio_fs_device *d)
 		rc = -ENOTSUP;
 		goto free_mem;
 	}
+
+	d->has_notify = VIRTIO_FEATURE_HAS(d->vdev->features,
+					   VIRTIO_FS_F_NOTIFICATION);
+	if (d->has_notify && 0 > virtio_modern_config_get(d->vdev,
+		__offsetof(struct virtio_fs_config, notify_buf_size),
+		&d->notify_buf_size, 4)) {
+		uk_pr_err(DRIVER_NAME": Failed to read notify_buf_size on \
+		the device %p\n", d);
+		rc = -EAGAIN;
+		goto free_mem;
+	}
 	return 0;
 
 free_mem:
@@ -410,63 +789,147 @@ out:
 	return rc;
 }
 
+/**
+ * @brief sets up the virtqueue @p id and the submission state around it
+ */
+static int virtio_fs_queue_setup(struct virtio_fs_device *d,
+				 struct virtio_fs_queue *q, uint16_t id,
+				 __u16 qdesc_size, virtqueue_callback_t callback)
+{
+	int rc;
+
+	ukarch_spin_init(&q->spinlock);
+	uk_sglist_init(&q->sg, ARRAY_SIZE(q->sgsegs), &q->sgsegs[0]);
+	q->dev = d;
+	q->inflight = 0;
+
+	q->vq = virtio_vqueue_setup(d->vdev, id, qdesc_size, callback, a);
+	if (unlikely(PTRISERR(q->vq))) {
+		uk_pr_err(DRIVER_NAME": Failed to set up virtqueue %"__PRIu16
+			  "\n", id);
+		rc = PTR2ERR(q->vq);
+		q->vq = NULL;
+		return rc;
+	}
+	q->vq->priv = q;
+	/* The modern PCI transport has to set queue_enable before DRIVER_OK
+	 * (virtio 1.1, 4.1.4.3.2). Other transports have no such step.
+	 */
+	virtio_vqueue_enable(d->vdev, q->vq);
+
+	return 0;
+}
+
+static void virtio_fs_queue_release(struct virtio_fs_device *d,
+				    struct virtio_fs_queue *q)
+{
+	if (!q->vq)
+		return;
+
+	virtio_vqueue_release(d->vdev, q->vq, a);
+	q->vq = NULL;
+}
+
+/**
+ * @brief allocates the receive buffers of the notification queue
+ *
+ * Each buffer holds the largest notification the device sends, but at least
+ * a page, so that lookups of any name can be invalidated.
+ */
+static int virtio_fs_notify_alloc(struct virtio_fs_device *d, __u16 qdesc_size)
+{
+	d->notify_buf_size = ALIGN_UP(MAX(d->notify_buf_size,
+					  (uint32_t) __PAGE_SIZE),
+				      (uint32_t) __PAGE_SIZE);
+	d->notify_nbufs = MIN(qdesc_size, VIRTIO_FS_NOTIFY_BUFS);
+
+	d->notify_bufs = uk_memalign(a, __PAGE_SIZE,
+				     (size_t) d->notify_nbufs
+				     * d->notify_buf_size);
+	if (!d->notify_bufs)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/**
+ * @brief releases the virtqueues and the buffers allocated by
+ * virtio_fs_vq_alloc(), also if it has failed half-way
+ */
+static void virtio_fs_vq_free(struct virtio_fs_device *d)
+{
+	if (d->req_queues) {
+		for (__virtio_le32 i = 0; i < d->num_request_queues; i++)
+			virtio_fs_queue_release(d, &d->req_queues[i]);
+		uk_free(a, d->req_queues);
+		d->req_queues = NULL;
+	}
+	virtio_fs_queue_release(d, &d->notify);
+	virtio_fs_queue_release(d, &d->hiprio);
+
+	if (d->notify_bufs)
+		uk_free(a, d->notify_bufs);
+	d->notify_bufs = NULL;
+}
+
 static int virtio_fs_vq_alloc(struct virtio_fs_device *d)
 {
 	__virtio_le32 vq_avail = 0;
-	__u16 qdesc_size[d->num_request_queues + 1];
+	__virtio_le32 nqueues = d->num_request_queues + 1 + d->has_notify;
+	uint16_t req_id = VIRTIO_FS_HIPRIO_QUEUE_ID + 1 + d->has_notify;
+	__u16 qdesc_size[nqueues];
 	int rc = 0;
 
-	vq_avail = virtio_find_vqs(d->vdev,
-				d->num_request_queues + 1, qdesc_size);
-	if (unlikely(vq_avail != d->num_request_queues + 1)) {
+	vq_avail = virtio_find_vqs(d->vdev, nqueues, qdesc_size);
+	if (unlikely(vq_avail != nqueues)) {
 		uk_pr_err(DRIVER_NAME": Expected %" __PRIvirtio_le32 " queues,\
 			  found %" __PRIvirtio_le32 "\n",
-			  d->num_request_queues + 1, vq_avail);
+			  nqueues, vq_avail);
 		return -ENOMEM;
 	}
-	/* TODOFS: where to free? */
-	d->vq_req = uk_calloc(a, d->num_request_queues,
-				sizeof(struct virtqueue *));
-	if (!d->vq_req)
+	/* Released by virtio_fs_vq_free() */
+	d->req_queues = uk_calloc(a, d->num_request_queues,
+				  sizeof(*d->req_queues));
+	if (!d->req_queues)
 		return -ENOMEM;
 
-	uk_sglist_init(&d->sg, ARRAY_SIZE(d->sgsegs), &d->sgsegs[0]);
-
 	/* Initialize the hiprio virtqueue first */
-	d->vq_hiprio = virtio_vqueue_setup(d->vdev,
-					   VIRTIO_FS_HIPRIO_QUEUE_ID,
-					   qdesc_size[0],
-					   virtio_fs_recv, a);
-	if (unlikely(PTRISERR(d->vq_hiprio))) {
-		uk_pr_err(DRIVER_NAME": Failed to set up the hiprio virtqueue \
-			%"__PRIu16"\n", 0);
-		rc = PTR2ERR(d->vq_hiprio);
+	rc = virtio_fs_queue_setup(d, &d->hiprio, VIRTIO_FS_HIPRIO_QUEUE_ID,
+				   qdesc_size[0], virtio_fs_recv);
+	if (unlikely(rc))
 		goto free_mem;
+
+	if (d->has_notify) {
+		rc = virtio_fs_queue_setup(d, &d->notify,
+					   VIRTIO_FS_NOTIFY_QUEUE_ID,
+					   qdesc_size[VIRTIO_FS_NOTIFY_QUEUE_ID],
+					   virtio_fs_notify_recv);
+		if (unlikely(rc))
+			goto free_mem;
+
+		rc = virtio_fs_notify_alloc(d,
+					    qdesc_size[VIRTIO_FS_NOTIFY_QUEUE_ID]);
+		if (unlikely(rc))
+			goto free_mem;
 	}
-	d->vq_hiprio->priv = d;
-	// TODOFS: not 100% sure, if enabling is required. It might be optional
-	virtio_vqueue_enable(d->vdev, d->vq_hiprio);
 
 	/* Initialize the request virtqueues */
 	for (uint16_t i = 0; i < d->num_request_queues; i++) {
-		d->vq_req[i] = virtio_vqueue_setup(d->vdev, i+1,
-						   qdesc_size[i+1],
-						   virtio_fs_recv, a);
-		if (unlikely(PTRISERR(d->vq_req[i]))) {
-			uk_pr_err(DRIVER_NAME": Failed to set up a request \
-				virtqueue %"__PRIu16"\n", i);
-			rc = PTR2ERR(d->vq_req[i]);
+		rc = virtio_fs_queue_setup(d, &d->req_queues[i], req_id + i,
+					   qdesc_size[req_id + i],
+					   virtio_fs_recv);
+		if (unlikely(rc))
 			goto free_mem;
-		}
-		d->vq_req[i]->priv = d;
-	// TODOFS: not 100% sure, if enabling is required. It might be optional
-		virtio_vqueue_enable(d->vdev, d->vq_req[i]);
 	}
 
+	uk_pr_info(DRIVER_NAME": Using %" __PRIvirtio_le32
+		   " request queue(s)%s\n", d->num_request_queues,
+		   d->has_notify ? " and notifications" : "");
+
 	return 0;
 
 free_mem:
-	uk_free(a, d->vq_req);
+	virtio_fs_vq_free(d);
 	return rc;
 }
 
@@ -484,6 +947,7 @@ static int virtio_fs_configure(struct virtio_fs_device *d)
 	rc = virtio_fs_vq_alloc(d);
 	if (rc) {
 		uk_pr_err(DRIVER_NAME": Could not allocate virtqueue\n");
+		uk_free(a, d->tag);
 		goto out_status_fail;
 	}
 
@@ -499,10 +963,21 @@ out_status_fail:
 
 static int virtio_fs_start(struct virtio_fs_device *d)
 {
-	virtqueue_intr_enable(d->vq_hiprio);
+	virtqueue_intr_enable(d->hiprio.vq);
 	for (__virtio_le32 i = 0; i < d->num_request_queues; i++)
-		virtqueue_intr_enable(d->vq_req[i]);
+		virtqueue_intr_enable(d->req_queues[i].vq);
 	virtio_dev_drv_up(d->vdev);
+
+	/* Stock the notification queue, once the device is live. */
+	if (d->has_notify) {
+		for (uint16_t i = 0; i < d->notify_nbufs; i++) {
+			if (virtio_fs_notify_post(&d->notify, d->notify_bufs
+					+ (size_t) i * d->notify_buf_size) < 0)
+				break;
+		}
+		virtqueue_intr_enable(d->notify.vq);
+		virtqueue_host_notify(d->notify.vq);
+	}
 	uk_pr_info(DRIVER_NAME": %s started\n", d->tag);
 
 	return 0;
@@ -543,7 +1018,6 @@ static int virtio_fs_add_dev(struct virtio_dev *vdev)
 		rc = -ENOMEM;
 		goto out;
 	}
-	ukarch_spin_init(&d->spinlock);
 	d->vdev = vdev;
 	virtio_fs_feature_set(d);
 	rc = virtio_fs_configure(d);
@@ -551,22 +1025,22 @@ static int virtio_fs_add_dev(struct virtio_dev *vdev)
 		goto out_free;
 	rc = virtio_fs_start(d);
 	if (rc)
-		goto out_free;
+		goto out_release;
 
-	/* TODOFS:
-	* 3.1.1. set the FAILED status bit, if irrecoverable failure
-	*/
 	ukarch_spin_lock(&virtio_fs_device_list_lock);
 	uk_list_add(&d->_list, &virtio_fs_device_list);
 	ukarch_spin_unlock(&virtio_fs_device_list_lock);
 
 
-	add_vdev_for_dax(vdev);
 	// test_method_1();
-	// vf_test_method();
 	bench_test();
 out:
 	return rc;
+out_release:
+	/* Irrecoverable (virtio 1.1, 3.1.1) */
+	virtio_dev_status_update(vdev, VIRTIO_CONFIG_STATUS_FAIL);
+	virtio_fs_vq_free(d);
+	uk_free(a, d->tag);
 out_free:
 	uk_free(a, d);
 	goto out;
@@ -39,6 +39,7 @@
 #include <uk/netdev_driver.h>
 #include <virtio/virtio_bus.h>
 #include <virtio/virtqueue.h>
+#include <virtio/virtio_ring.h>
 #include <virtio/virtio_net.h>
 
 /**
@@ -924,6 +925,14 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_GUEST_CSUM);
 	}
 
+	/**
+	 * Event index
+	 * NOTE: Suppresses notifications and interrupts, until the other side
+	 *       has caught up with the ring.
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_F_EVENT_IDX))
+		VIRTIO_FEATURE_SET(drv_features, VIRTIO_F_EVENT_IDX);
+
 	/**
 	 * Announce our enabled driver features back to the backend device
 	 */
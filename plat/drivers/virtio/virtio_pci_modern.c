@@ -1637,7 +1637,6 @@ static struct virtqueue *vpci_modern_vq_setup(struct virtio_dev *vdev,
 {
 	struct virtio_pci_modern_dev *vpdev = NULL;
 	struct virtqueue *vq;
-	struct virtqueue_vring *vrq;
 	__paddr_t desc_paddr, avail_paddr, used_paddr;
 	long flags;
 
@@ -1654,14 +1653,13 @@ static struct virtqueue *vpci_modern_vq_setup(struct virtio_dev *vdev,
 		goto err_exit;
 	}
 
-	vrq = to_virtqueue_vring(vq);
-	/* Physical address of the queue */
-	/* TODOFS: refract:
-	 * create a function in virtio_ring.c that returns these
+	/**
+	 * Physical address of the queue. For packed virtqueues, the avail and
+	 * used areas are the driver and device event suppression areas.
 	 */
-	desc_paddr = ukplat_virt_to_phys(vrq->vring.desc);
-	avail_paddr = ukplat_virt_to_phys(vrq->vring.avail);
-	used_paddr = ukplat_virt_to_phys(vrq->vring.used);
+	desc_paddr = virtqueue_physaddr(vq);
+	avail_paddr = virtqueue_get_avail_addr(vq);
+	used_paddr = virtqueue_get_used_addr(vq);
 
 	/* Select the queue of interest */
 	vpci_modern_write_common_2(vpdev,
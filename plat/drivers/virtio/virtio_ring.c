@@ -42,7 +42,9 @@
 #include <uk/arch/atomic.h>
 #include <uk/plat/io.h>
 #include <virtio/virtio_ring.h>
+#include <virtio/virtio_ring_packed.h>
 #include <virtio/virtqueue.h>
+#include <virtio/virtio_bus.h>
 
 #define VIRTQUEUE_MAX_SIZE  32768
 
@@ -71,8 +73,23 @@ void virtqueue_intr_disable(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed) {
+		virtqueue_packed_intr_disable(vq);
+		return;
+	}
+
 	vrq = to_virtqueue_vring(vq);
 	vrq->vring.avail->flags |= (VRING_AVAIL_F_NO_INTERRUPT);
+	/**
+	 * With event index, the host ignores the flag and interrupts, once the
+	 * used index passes used_event. Keep used_event one behind the last
+	 * descriptor chain we have seen, so that the host would have to use
+	 * a whole index wrap-around of chains first. virtqueue_buffer_dequeue()
+	 * keeps it there while the interrupt is disabled.
+	 */
+	if (vrq->event_idx)
+		vring_used_event(&vrq->vring) =
+			(__u16) (vrq->last_used_desc_idx - 1);
 }
 
 int virtqueue_intr_enable(struct virtqueue *vq)
@@ -82,12 +99,23 @@ int virtqueue_intr_enable(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_intr_enable(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	/* Check if there are no more packets enabled */
 	if (!virtqueue_hasdata(vq)) {
-		if (vrq->vring.avail->flags | VRING_AVAIL_F_NO_INTERRUPT) {
+		if (vrq->vring.avail->flags & VRING_AVAIL_F_NO_INTERRUPT) {
 			vrq->vring.avail->flags &=
 				(~VRING_AVAIL_F_NO_INTERRUPT);
+			/**
+			 * With event index, the host interrupts once it
+			 * uses the descriptor chain after the last one
+			 * we have seen.
+			 */
+			if (vrq->event_idx)
+				vring_used_event(&vrq->vring) =
+					vrq->last_used_desc_idx;
 			/**
 			 * We enabled the interrupts. We ensure it using the
 			 * memory barrier and check if there are any further
@@ -165,6 +193,13 @@ static inline void virtqueue_detach_desc(struct virtqueue_vring *vrq,
 	/* The value should be empty */
 	UK_ASSERT(vq_info->desc_count == 0);
 
+	/* Return the indirect descriptor table of the buffer */
+	if (vq_info->indirect != VIRTQUEUE_NO_INDIRECT) {
+		vrq->indirect_free[vrq->indirect_free_cnt++] =
+			vq_info->indirect;
+		vq_info->indirect = VIRTQUEUE_NO_INDIRECT;
+	}
+
 	/* Appending the now freed descriptor chain to the head of the list */
 	/* new h_f_d ---> this desc. chain ---> old h_f_d */
 	desc->next = vrq->head_free_desc;
@@ -174,11 +209,27 @@ static inline void virtqueue_detach_desc(struct virtqueue_vring *vrq,
 int virtqueue_notify_enabled(struct virtqueue *vq)
 {
 	struct virtqueue_vring *vrq;
+	__u16 old_idx, new_idx;
 
 	UK_ASSERT(vq);
+
+	if (vq->packed)
+		return virtqueue_packed_notify_enabled(vq);
+
 	vrq = to_virtqueue_vring(vq);
 
-	return ((vrq->vring.used->flags & VRING_USED_F_NO_NOTIFY) == 0);
+	if (!vrq->event_idx)
+		return ((vrq->vring.used->flags & VRING_USED_F_NO_NOTIFY) == 0);
+
+	/**
+	 * Notify only if the host asked for it within the descriptor chains
+	 * made available since the last notification.
+	 */
+	old_idx = vrq->last_notified_avail_idx;
+	new_idx = vrq->vring.avail->idx;
+	vrq->last_notified_avail_idx = new_idx;
+	return vring_need_event(vring_avail_event(&vrq->vring), new_idx,
+				old_idx);
 }
 
 /**
@@ -226,6 +277,9 @@ int virtqueue_hasdata(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_hasdata(vq);
+
 	vring = to_virtqueue_vring(vq);
 	return (vring->last_used_desc_idx != vring->vring.used->idx);
 }
@@ -235,9 +289,13 @@ __u64 virtqueue_feature_negotiate(__u64 feature_set)
 	__u64 feature = (1ULL << VIRTIO_TRANSPORT_F_START) - 1;
 
 	/**
-	 * Currently out vring driver does not support any ring feature. We will
-	 * add support to transport feature in the future.
+	 * Transport features supported by our vring driver.
 	 */
+	feature |= (1ULL << VIRTIO_F_INDIRECT_DESC);
+	feature |= (1ULL << VIRTIO_F_EVENT_IDX);
+#if CONFIG_VIRTIO_RING_PACKED
+	feature |= (1ULL << VIRTIO_F_RING_PACKED);
+#endif /* CONFIG_VIRTIO_RING_PACKED */
 	feature &= feature_set;
 	return feature;
 }
@@ -263,16 +321,72 @@ __paddr_t virtqueue_physaddr(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_physaddr(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	return ukplat_virt_to_phys(vrq->vring_mem);
 }
 
+/**
+ * @brief
+ * Place # @p read_bufs read buffers and # @p write_bufs into a free indirect
+ * descriptor table, which is referenced by a single descriptor at @p head
+ *
+ * @param vrq
+ * @param head descriptor, where we place the indirect descriptor table
+ * @param sg
+ * @param read_bufs number of read buffers
+ * @param write_bufs number of write buffers
+ * @return int index of the next free buffer that comes after the one we
+ * enqueued
+ */
+static inline int virtqueue_buffer_enqueue_indirect(
+		struct virtqueue_vring *vrq,
+		__u16 head, struct uk_sglist *sg, __u16 read_bufs,
+		__u16 write_bufs)
+{
+	int i = 0, total_desc = 0;
+	struct uk_sglist_seg *segs;
+	struct vring_desc *table;
+	__u16 tidx;
+
+	UK_ASSERT(vrq->indirect_free_cnt > 0);
+
+	total_desc = read_bufs + write_bufs;
+	tidx = vrq->indirect_free[--vrq->indirect_free_cnt];
+	table = &vrq->indirect_mem[tidx * VIRTQUEUE_INDIRECT_MAX_DESC];
+	vrq->vq_info[head].indirect = tidx;
+
+	for (i = 0; i < total_desc; i++) {
+		segs = &sg->sg_segs[i];
+		table[i].addr = segs->ss_paddr;
+		table[i].len = segs->ss_len;
+		table[i].flags = 0;
+		if (i >= read_bufs)
+			table[i].flags |= VRING_DESC_F_WRITE;
+
+		if (i < total_desc - 1) {
+			table[i].flags |= VRING_DESC_F_NEXT;
+			table[i].next = i + 1;
+		}
+	}
+
+	vrq->vring.desc[head].addr = ukplat_virt_to_phys(table);
+	vrq->vring.desc[head].len = total_desc * sizeof(*table);
+	vrq->vring.desc[head].flags = VRING_DESC_F_INDIRECT;
+	return vrq->vring.desc[head].next;
+}
+
 __paddr_t virtqueue_get_avail_addr(struct virtqueue *vq)
 {
 	struct virtqueue_vring *vrq = NULL;
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_get_avail_addr(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	return virtqueue_physaddr(vq) +
 		((char *)vrq->vring.avail - (char *)vrq->vring.desc);
@@ -284,6 +398,9 @@ __paddr_t virtqueue_get_used_addr(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_get_used_addr(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	return virtqueue_physaddr(vq) +
 		((char *)vrq->vring.used - (char *)vrq->vring.desc);
@@ -295,6 +412,9 @@ unsigned int virtqueue_vring_get_num(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_vring_get_num(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	return vrq->vring.num;
 }
@@ -306,6 +426,10 @@ int virtqueue_buffer_dequeue(struct virtqueue *vq, void **cookie, __u32 *len)
 	struct vring_used_elem *elem;
 
 	UK_ASSERT(vq);
+
+	if (vq->packed)
+		return virtqueue_packed_buffer_dequeue(vq, cookie, len);
+
 	UK_ASSERT(cookie);
 	vrq = to_virtqueue_vring(vq);
 
@@ -327,6 +451,22 @@ int virtqueue_buffer_dequeue(struct virtqueue *vq, void **cookie, __u32 *len)
 	*cookie = vrq->vq_info[head_idx].cookie;
 	virtqueue_detach_desc(vrq, head_idx);
 	vrq->vq_info[head_idx].cookie = NULL;
+
+	/**
+	 * If we expect an interrupt for the next descriptor chain, tell the
+	 * host with the event index. Otherwise, keep the event index behind
+	 * the chains we have seen (see virtqueue_intr_disable()).
+	 */
+	if (vrq->event_idx) {
+		if (!(vrq->vring.avail->flags & VRING_AVAIL_F_NO_INTERRUPT)) {
+			vring_used_event(&vrq->vring) =
+				vrq->last_used_desc_idx;
+			mb();
+		} else {
+			vring_used_event(&vrq->vring) =
+				(__u16) (vrq->last_used_desc_idx - 1);
+		}
+	}
 	return (vrq->vring.num - vrq->desc_avail);
 }
 
@@ -344,21 +484,36 @@ int virtqueue_buffer_enqueue(struct virtqueue *vq, void *cookie,
 			     struct uk_sglist *sg, __u16 read_bufs,
 			     __u16 write_bufs)
 {
-	__u32 total_desc = 0;
+	__u32 total_desc = 0, ring_desc;
 	__u16 head_idx = 0, idx = 0;
 	struct virtqueue_vring *vrq = NULL;
+	int indirect;
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_buffer_enqueue(vq, cookie, sg,
+						       read_bufs, write_bufs);
+
 	vrq = to_virtqueue_vring(vq);
 	total_desc = read_bufs + write_bufs;
-	if (unlikely(total_desc < 1 || total_desc > vrq->vring.num)) {
+
+	/**
+	 * Buffers with multiple segments take a single ring descriptor, as
+	 * long as there are indirect descriptor tables left.
+	 */
+	indirect = total_desc > 1
+		   && total_desc <= VIRTQUEUE_INDIRECT_MAX_DESC
+		   && vrq->indirect_free_cnt > 0;
+	ring_desc = indirect ? 1 : total_desc;
+
+	if (unlikely(total_desc < 1 || ring_desc > vrq->vring.num)) {
 		uk_pr_err("%"__PRIu32" invalid number of descriptor\n",
 			  total_desc);
 		return -EINVAL;
-	} else if (vrq->desc_avail < total_desc) {
+	} else if (vrq->desc_avail < ring_desc) {
 		uk_pr_err("Available descriptor:%"__PRIu16", Requested descriptor:%"__PRIu32"\n",
-			  vrq->desc_avail, total_desc);
+			  vrq->desc_avail, ring_desc);
 		return -ENOSPC;
 	}
 	/* Get the head of free descriptor */
@@ -366,16 +521,20 @@ int virtqueue_buffer_enqueue(struct virtqueue *vq, void *cookie,
 	UK_ASSERT(cookie);
 	/* Additional information to reconstruct the data buffer */
 	vrq->vq_info[head_idx].cookie = cookie;
-	vrq->vq_info[head_idx].desc_count = total_desc;
+	vrq->vq_info[head_idx].desc_count = ring_desc;
 
 	/**
 	 * We separate the descriptor management to enqueue segment(s).
 	 */
-	idx = virtqueue_buffer_enqueue_segments(vrq, head_idx, sg,
-			read_bufs, write_bufs);
+	if (indirect)
+		idx = virtqueue_buffer_enqueue_indirect(vrq, head_idx, sg,
+				read_bufs, write_bufs);
+	else
+		idx = virtqueue_buffer_enqueue_segments(vrq, head_idx, sg,
+				read_bufs, write_bufs);
 	/* Metadata maintenance for the virtqueue */
 	vrq->head_free_desc = idx;
-	vrq->desc_avail -= total_desc;
+	vrq->desc_avail -= ring_desc;
 
 	uk_pr_debug("Old head:%d, new head:%d, total_desc:%d\n",
 		    head_idx, idx, total_desc);
@@ -384,6 +543,48 @@ int virtqueue_buffer_enqueue(struct virtqueue *vq, void *cookie,
 	return vrq->desc_avail;
 }
 
+/**
+ * @brief allocates the indirect descriptor tables of a virtqueue
+ *
+ * Without them, the virtqueue keeps working with direct descriptors only.
+ */
+static void virtqueue_indirect_init(struct virtqueue_vring *vrq,
+				    struct uk_alloc *a)
+{
+	void *mem;
+
+	UK_CTASSERT(__PAGE_SIZE % (VIRTQUEUE_INDIRECT_MAX_DESC *
+				   sizeof(struct vring_desc)) == 0);
+
+	vrq->indirect_count = MIN(vrq->vring.num,
+				  (unsigned int) VIRTQUEUE_INDIRECT_MAX_TABLES);
+	vrq->indirect_free = uk_malloc(a, vrq->indirect_count *
+				       sizeof(*vrq->indirect_free));
+	if (!vrq->indirect_free)
+		goto err_out;
+
+	/* Tables are page aligned multiples of each other's size, so that
+	   none of them crosses a page boundary. */
+	if (uk_posix_memalign(a, &mem, __PAGE_SIZE,
+			      vrq->indirect_count *
+			      VIRTQUEUE_INDIRECT_MAX_DESC *
+			      sizeof(struct vring_desc)) != 0)
+		goto err_free;
+	vrq->indirect_mem = mem;
+
+	for (__u16 i = 0; i < vrq->indirect_count; i++)
+		vrq->indirect_free[i] = i;
+	vrq->indirect_free_cnt = vrq->indirect_count;
+	return;
+
+err_free:
+	uk_free(a, vrq->indirect_free);
+err_out:
+	uk_pr_warn("Allocation of indirect descriptors failed\n");
+	vrq->indirect_free = NULL;
+	vrq->indirect_count = 0;
+}
+
 static void virtqueue_vring_init(struct virtqueue_vring *vrq, __u16 nr_desc,
 				 __u16 align)
 {
@@ -394,6 +595,9 @@ static void virtqueue_vring_init(struct virtqueue_vring *vrq, __u16 nr_desc,
 	vrq->desc_avail = vrq->vring.num;
 	vrq->head_free_desc = 0;
 	vrq->last_used_desc_idx = 0;
+	vrq->last_notified_avail_idx = 0;
+	for (i = 0; i < nr_desc; i++)
+		vrq->vq_info[i].indirect = VIRTQUEUE_NO_INDIRECT;
 	for (i = 0; i < nr_desc - 1; i++)
 		vrq->vring.desc[i].next = i + 1;
 	/**
@@ -427,6 +631,11 @@ struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
 
 	UK_ASSERT(a);
 
+	/* Ring features are negotiated before the virtqueues are created */
+	if (VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_RING_PACKED))
+		return virtqueue_packed_create(queue_id, nr_descs, callback,
+					       notify, vdev, a);
+
 	vrq = uk_malloc(a, sizeof(*vrq) +
 			nr_descs * sizeof(struct virtqueue_desc_info));
 	if (!vrq) {
@@ -454,12 +663,21 @@ struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
 	}
 	memset(vrq->vring_mem, 0, ring_size);
 	virtqueue_vring_init(vrq, nr_descs, align);
+	vrq->event_idx = VIRTIO_FEATURE_HAS(vdev->features,
+					    VIRTIO_F_EVENT_IDX);
+	vrq->indirect_mem = NULL;
+	vrq->indirect_free = NULL;
+	vrq->indirect_count = 0;
+	vrq->indirect_free_cnt = 0;
+	if (VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_INDIRECT_DESC))
+		virtqueue_indirect_init(vrq, a);
 
 	vq = &vrq->vq;
 	vq->queue_id = queue_id;
 	vq->vdev = vdev;
 	vq->vq_callback = callback;
 	vq->vq_notify_host = notify;
+	vq->packed = 0;
 	return vq;
 
 err_freevq:
@@ -474,11 +692,22 @@ void virtqueue_destroy(struct virtqueue *vq, struct uk_alloc *a)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed) {
+		virtqueue_packed_destroy(vq, a);
+		return;
+	}
+
 	vrq = to_virtqueue_vring(vq);
 
 	/* Free the ring */
 	uk_free(a, vrq->vring_mem);
 
+	/* Free the indirect descriptor tables */
+	if (vrq->indirect_mem)
+		uk_free(a, vrq->indirect_mem);
+	if (vrq->indirect_free)
+		uk_free(a, vrq->indirect_free);
+
 	/* Free the virtqueue metadata */
 	uk_free(a, vrq);
 }
@@ -489,6 +718,9 @@ int virtqueue_is_full(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (vq->packed)
+		return virtqueue_packed_is_full(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	return (vrq->desc_avail == 0);
 }
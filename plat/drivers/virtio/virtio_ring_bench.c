@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Microbenchmark comparing the driver-side cost of the split and packed
+ * virtqueue layouts. The host is simulated in the guest: it uses every
+ * available buffer right away, so the numbers do not include any VM exits.
+ */
+#include <uk/config.h>
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#include <uk/alloc.h>
+#include <uk/sglist.h>
+#include <uk/plat/time.h>
+#include <uk/plat/common/cpu.h>
+#include <virtio/virtio_bus.h>
+#include <virtio/virtio_ring.h>
+#include <virtio/virtio_ring_packed.h>
+#include <virtio/virtqueue.h>
+
+#define VIRTQUEUE_BENCH_QSIZE		256
+#define VIRTQUEUE_BENCH_ROUNDS		100000
+/* Buffers made available per round, i.e., per host notification */
+#define VIRTQUEUE_BENCH_BATCH		16
+/* A request header (read) and a reply (write), like a FUSE request */
+#define VIRTQUEUE_BENCH_SEGS		2
+
+struct virtqueue_bench_dev {
+	/* Next ring index to be consumed by the simulated host */
+	__u16 last_avail;
+	/* Wrap counter of the simulated host (packed only) */
+	__u8 wrap;
+};
+
+static char bench_in[64];
+static char bench_out[64];
+
+/* Use all buffers made available in the split ring */
+static void virtqueue_bench_split_host(struct virtqueue *vq,
+				       struct virtqueue_bench_dev *host)
+{
+	struct virtqueue_vring *vrq = to_virtqueue_vring(vq);
+	struct vring_used_elem *elem;
+	__u16 head;
+
+	rmb();
+	while (host->last_avail != vrq->vring.avail->idx) {
+		head = vrq->vring.avail->ring[host->last_avail++ &
+					      (vrq->vring.num - 1)];
+		elem = &vrq->vring.used->ring[vrq->vring.used->idx &
+					      (vrq->vring.num - 1)];
+		elem->id = head;
+		elem->len = sizeof(bench_out);
+		wmb();
+		vrq->vring.used->idx++;
+	}
+}
+
+/* Use all buffers made available in the packed ring */
+static void virtqueue_bench_packed_host(struct virtqueue *vq,
+					struct virtqueue_bench_dev *host)
+{
+	struct virtqueue_packed *vrq = to_virtqueue_packed(vq);
+	struct vring_packed_desc *desc;
+	__u16 flags, head, count;
+
+	for (;;) {
+		head = host->last_avail;
+		flags = UK_READ_ONCE(vrq->desc[head].flags);
+		if (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) != host->wrap
+		    || !!(flags & (1 << VRING_PACKED_DESC_F_USED))
+		       == host->wrap)
+			break;
+		rmb();
+
+		/* Walk the chain to find its buffer ID and length */
+		count = 1;
+		desc = &vrq->desc[head];
+		while (desc->flags & VRING_DESC_F_NEXT) {
+			desc = &vrq->desc[(head + count) % vrq->num];
+			count++;
+		}
+		vrq->desc[head].id = desc->id;
+		vrq->desc[head].len = sizeof(bench_out);
+		wmb();
+		vrq->desc[head].flags = host->wrap
+			? (1 << VRING_PACKED_DESC_F_AVAIL) |
+			  (1 << VRING_PACKED_DESC_F_USED)
+			: 0;
+
+		host->last_avail += count;
+		if (host->last_avail >= vrq->num) {
+			host->last_avail -= vrq->num;
+			host->wrap ^= 1;
+		}
+	}
+}
+
+static int virtqueue_bench_run(const char *name, __u64 features,
+			       struct uk_alloc *a)
+{
+	struct virtio_dev vdev = { .features = features };
+	struct virtqueue_bench_dev host = { .last_avail = 0, .wrap = 1 };
+	struct uk_sglist_seg segs[VIRTQUEUE_BENCH_SEGS];
+	struct uk_sglist sg;
+	struct virtqueue *vq;
+	__nsec start, end;
+	void *cookie;
+	__u32 len;
+	int i, j, rc;
+
+	uk_sglist_init(&sg, VIRTQUEUE_BENCH_SEGS, segs);
+	uk_sglist_append(&sg, bench_in, sizeof(bench_in));
+	uk_sglist_append(&sg, bench_out, sizeof(bench_out));
+
+	vq = virtqueue_create(0, VIRTQUEUE_BENCH_QSIZE, __PAGE_SIZE,
+			      NULL, NULL, &vdev, a);
+	if (PTRISERR(vq)) {
+		uk_pr_err("%s: Failed to create the virtqueue: %d\n", name,
+			  PTR2ERR(vq));
+		return PTR2ERR(vq);
+	}
+
+	start = ukplat_monotonic_clock();
+	for (i = 0; i < VIRTQUEUE_BENCH_ROUNDS; i++) {
+		for (j = 0; j < VIRTQUEUE_BENCH_BATCH; j++) {
+			rc = virtqueue_buffer_enqueue(vq, bench_out, &sg,
+						      1, 1);
+			if (unlikely(rc < 0))
+				goto out;
+		}
+		/* Stands in for the notification of the host */
+		virtqueue_notify_enabled(vq);
+		if (vq->packed)
+			virtqueue_bench_packed_host(vq, &host);
+		else
+			virtqueue_bench_split_host(vq, &host);
+		while (virtqueue_hasdata(vq))
+			virtqueue_buffer_dequeue(vq, &cookie, &len);
+	}
+	end = ukplat_monotonic_clock();
+	rc = 0;
+
+	uk_pr_info("virtqueue bench: %s: %"__PRIu64" ns per request\n", name,
+		   (end - start) /
+		   ((__u64) VIRTQUEUE_BENCH_ROUNDS * VIRTQUEUE_BENCH_BATCH));
+out:
+	if (rc < 0)
+		uk_pr_err("%s: Failed to enqueue: %d\n", name, rc);
+	virtqueue_destroy(vq, a);
+	return rc;
+}
+
+static int virtqueue_bench(void)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	__u64 features = 1ULL << VIRTIO_F_VERSION_1;
+
+	virtqueue_bench_run("split", features, a);
+	virtqueue_bench_run("split (event index)",
+			    features | (1ULL << VIRTIO_F_EVENT_IDX), a);
+	virtqueue_bench_run("packed",
+			    features | (1ULL << VIRTIO_F_RING_PACKED), a);
+	virtqueue_bench_run("packed (event index)",
+			    features | (1ULL << VIRTIO_F_RING_PACKED)
+			    | (1ULL << VIRTIO_F_EVENT_IDX), a);
+	return 0;
+}
+uk_late_initcall(virtqueue_bench);
@@ -0,0 +1,450 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2019, Karlsruhe Institute of Technology (KIT).
+ *               All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Packed virtqueue layout of the virtio 1.1 specification (section 2.7).
+ * Descriptors, available and used buffers share a single ring, which the
+ * host consumes sequentially, thus touching fewer cache lines than with the
+ * split layout.
+ */
+#include <uk/config.h>
+#include <string.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#include <uk/plat/common/cpu.h>
+#include <uk/sglist.h>
+#include <uk/plat/io.h>
+#include <virtio/virtio_ring.h>
+#include <virtio/virtio_ring_packed.h>
+#include <virtio/virtqueue.h>
+#include <virtio/virtio_bus.h>
+
+/* The descriptor ring is followed by the driver and device event areas */
+#define VIRTQUEUE_PACKED_RING_SIZE(num)				\
+	((num) * sizeof(struct vring_packed_desc) +		\
+	 2 * sizeof(struct vring_packed_desc_event))
+
+/**
+ * @brief returns the avail and used flags of a descriptor made available
+ * with the wrap counter @p wrap
+ */
+static inline __u16 virtqueue_packed_avail_flags(__u8 wrap)
+{
+	return wrap ? (1 << VRING_PACKED_DESC_F_AVAIL)
+		    : (1 << VRING_PACKED_DESC_F_USED);
+}
+
+static inline void virtqueue_packed_update_used_event(
+		struct virtqueue_packed *vrq)
+{
+	vrq->driver_event->off_wrap = vrq->last_used |
+		(vrq->used_wrap << VRING_PACKED_EVENT_F_WRAP_CTR);
+}
+
+void virtqueue_packed_intr_disable(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	if (vrq->event_flags != VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vrq->event_flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+		vrq->driver_event->flags = vrq->event_flags;
+	}
+}
+
+int virtqueue_packed_intr_enable(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+	int rc = 0;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	/* Check if there are no more packets enabled */
+	if (!virtqueue_packed_hasdata(vq)) {
+		if (vrq->event_flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+			/**
+			 * With event index, the host interrupts once it
+			 * uses the descriptor after the last one we have
+			 * seen. The offset must be visible before the flags.
+			 */
+			if (vrq->event_idx) {
+				virtqueue_packed_update_used_event(vrq);
+				wmb();
+				vrq->event_flags = VRING_PACKED_EVENT_FLAG_DESC;
+			} else {
+				vrq->event_flags =
+					VRING_PACKED_EVENT_FLAG_ENABLE;
+			}
+			vrq->driver_event->flags = vrq->event_flags;
+			/**
+			 * Check for data after enabling the interrupt to
+			 * make sure we do not miss an interrupt while
+			 * transitioning (virtio specification section 2.7.10).
+			 */
+			mb();
+			if (virtqueue_packed_hasdata(vq)) {
+				virtqueue_packed_intr_disable(vq);
+				rc = 1;
+			}
+		}
+	} else {
+		/**
+		 * There are more packet in the virtqueue to be processed while
+		 * the interrupt was disabled.
+		 */
+		rc = 1;
+	}
+	return rc;
+}
+
+int virtqueue_packed_notify_enabled(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+	__u16 old_idx, new_idx, event_idx, off_wrap, flags;
+
+	UK_ASSERT(vq);
+	vrq = to_virtqueue_packed(vq);
+
+	new_idx = vrq->next_avail;
+	old_idx = new_idx - vrq->num_added;
+	vrq->num_added = 0;
+
+	flags = vrq->device_event->flags;
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	/**
+	 * Notify only if the host asked for it within the descriptors made
+	 * available since the last notification. An event offset of the
+	 * previous lap is moved below zero, so that the comparison of
+	 * vring_need_event() holds across the wrap around.
+	 */
+	off_wrap = vrq->device_event->off_wrap;
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vrq->avail_wrap)
+		event_idx -= vrq->num;
+	return vring_need_event(event_idx, new_idx, old_idx);
+}
+
+int virtqueue_packed_hasdata(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+	__u16 flags;
+	__u8 avail, used;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	flags = UK_READ_ONCE(vrq->desc[vrq->last_used].flags);
+	avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+	/* The host marks a used descriptor by setting both flags equal to
+	   its wrap counter */
+	return (avail == used && used == vrq->used_wrap);
+}
+
+__paddr_t virtqueue_packed_physaddr(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	return ukplat_virt_to_phys(vrq->vring_mem);
+}
+
+__paddr_t virtqueue_packed_get_avail_addr(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	return virtqueue_packed_physaddr(vq) +
+		((char *)vrq->driver_event - (char *)vrq->desc);
+}
+
+__paddr_t virtqueue_packed_get_used_addr(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vrq;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+	return virtqueue_packed_physaddr(vq) +
+		((char *)vrq->device_event - (char *)vrq->desc);
+}
+
+unsigned int virtqueue_packed_vring_get_num(struct virtqueue *vq)
+{
+	UK_ASSERT(vq);
+
+	return to_virtqueue_packed(vq)->num;
+}
+
+int virtqueue_packed_is_full(struct virtqueue *vq)
+{
+	UK_ASSERT(vq);
+
+	return (to_virtqueue_packed(vq)->desc_avail == 0);
+}
+
+int virtqueue_packed_buffer_dequeue(struct virtqueue *vq, void **cookie,
+				    __u32 *len)
+{
+	struct virtqueue_packed *vrq;
+	struct vring_packed_desc *desc;
+	__u16 id, count;
+
+	UK_ASSERT(vq);
+	UK_ASSERT(cookie);
+	vrq = to_virtqueue_packed(vq);
+
+	/* No new descriptor since last dequeue operation */
+	if (!virtqueue_packed_hasdata(vq))
+		return -ENOMSG;
+	/**
+	 * We are reading the used descriptor written by the host, after
+	 * having checked its flags.
+	 */
+	rmb();
+	desc = &vrq->desc[vrq->last_used];
+	id = desc->id;
+	UK_ASSERT(id < vrq->num);
+	if (len)
+		*len = desc->len;
+	*cookie = vrq->info[id].cookie;
+
+	/* The host writes one used descriptor for the whole chain, so skip
+	   over the rest of the chain */
+	count = vrq->info[id].desc_count;
+	vrq->desc_avail += count;
+	vrq->last_used += count;
+	if (vrq->last_used >= vrq->num) {
+		vrq->last_used -= vrq->num;
+		vrq->used_wrap ^= 1;
+	}
+
+	/* Return the buffer ID */
+	vrq->info[id].cookie = NULL;
+	vrq->info[id].next = vrq->free_head;
+	vrq->free_head = id;
+
+	/**
+	 * If we expect an interrupt for the next descriptor, tell the
+	 * host with the event offset.
+	 */
+	if (vrq->event_flags == VRING_PACKED_EVENT_FLAG_DESC) {
+		virtqueue_packed_update_used_event(vrq);
+		mb();
+	}
+	return (vrq->num - vrq->desc_avail);
+}
+
+int virtqueue_packed_buffer_enqueue(struct virtqueue *vq, void *cookie,
+				    struct uk_sglist *sg, __u16 read_bufs,
+				    __u16 write_bufs)
+{
+	struct virtqueue_packed *vrq;
+	struct vring_packed_desc *desc;
+	struct uk_sglist_seg *segs;
+	__u32 total_desc, i;
+	__u16 id, head, idx, flags, head_flags = 0;
+	__u8 wrap;
+
+	UK_ASSERT(vq);
+	UK_ASSERT(cookie);
+
+	vrq = to_virtqueue_packed(vq);
+	total_desc = read_bufs + write_bufs;
+
+	if (unlikely(total_desc < 1 || total_desc > vrq->num)) {
+		uk_pr_err("%"__PRIu32" invalid number of descriptor\n",
+			  total_desc);
+		return -EINVAL;
+	} else if (vrq->desc_avail < total_desc) {
+		uk_pr_err("Available descriptor:%"__PRIu16", Requested descriptor:%"__PRIu32"\n",
+			  vrq->desc_avail, total_desc);
+		return -ENOSPC;
+	}
+
+	/**
+	 * Every buffer consumes at least one descriptor, so there is always a
+	 * free buffer ID if there are enough descriptors.
+	 */
+	id = vrq->free_head;
+	UK_ASSERT(id < vrq->num);
+	vrq->free_head = vrq->info[id].next;
+	/* Additional information to reconstruct the data buffer */
+	vrq->info[id].cookie = cookie;
+	vrq->info[id].desc_count = total_desc;
+
+	head = vrq->next_avail;
+	wrap = vrq->avail_wrap;
+	for (i = 0, idx = head; i < total_desc; i++) {
+		segs = &sg->sg_segs[i];
+		desc = &vrq->desc[idx];
+		desc->addr = segs->ss_paddr;
+		desc->len = segs->ss_len;
+		desc->id = id;
+
+		flags = virtqueue_packed_avail_flags(wrap);
+		if (i >= read_bufs)
+			flags |= VRING_DESC_F_WRITE;
+		if (i < total_desc - 1)
+			flags |= VRING_DESC_F_NEXT;
+
+		/* The head is made available last, see below */
+		if (i == 0)
+			head_flags = flags;
+		else
+			desc->flags = flags;
+
+		if (++idx >= vrq->num) {
+			idx = 0;
+			wrap ^= 1;
+		}
+	}
+
+	/**
+	 * Write barrier to make sure the host sees the whole chain, once it
+	 * sees the available head descriptor.
+	 */
+	wmb();
+	vrq->desc[head].flags = head_flags;
+
+	/* Metadata maintenance for the virtqueue */
+	vrq->next_avail = idx;
+	vrq->avail_wrap = wrap;
+	vrq->desc_avail -= total_desc;
+	vrq->num_added += total_desc;
+
+	uk_pr_debug("Old head:%d, new head:%d, total_desc:%d\n",
+		    head, idx, total_desc);
+	return vrq->desc_avail;
+}
+
+struct virtqueue *virtqueue_packed_create(__u16 queue_id, __u16 nr_descs,
+					  virtqueue_callback_t callback,
+					  virtqueue_notify_host_t notify,
+					  struct virtio_dev *vdev,
+					  struct uk_alloc *a)
+{
+	struct virtqueue_packed *vrq;
+	struct virtqueue *vq;
+	int rc;
+	size_t ring_size;
+	__u16 i;
+
+	UK_ASSERT(a);
+	UK_ASSERT(vdev);
+
+	if (unlikely(nr_descs == 0 ||
+		     nr_descs > (1 << VRING_PACKED_EVENT_F_WRAP_CTR))) {
+		uk_pr_err("%"__PRIu16" invalid number of descriptor\n",
+			  nr_descs);
+		rc = -EINVAL;
+		goto err_exit;
+	}
+
+	vrq = uk_malloc(a, sizeof(*vrq) +
+			nr_descs * sizeof(struct virtqueue_packed_info));
+	if (!vrq) {
+		uk_pr_err("Allocation of virtqueue failed\n");
+		rc = -ENOMEM;
+		goto err_exit;
+	}
+	vrq->vring_mem = NULL;
+
+	/* Allocate and zero the descriptor ring and the event suppression
+	   areas in contiguous physical memory */
+	ring_size = VIRTQUEUE_PACKED_RING_SIZE(nr_descs);
+	if (uk_posix_memalign(a, &vrq->vring_mem,
+			      __PAGE_SIZE, ring_size) != 0) {
+		uk_pr_err("Allocation of vring failed\n");
+		rc = -ENOMEM;
+		goto err_freevq;
+	}
+	memset(vrq->vring_mem, 0, ring_size);
+
+	vrq->num = nr_descs;
+	vrq->desc = vrq->vring_mem;
+	vrq->driver_event =
+		(struct vring_packed_desc_event *) &vrq->desc[nr_descs];
+	vrq->device_event = vrq->driver_event + 1;
+	vrq->desc_avail = nr_descs;
+	vrq->next_avail = 0;
+	vrq->avail_wrap = 1;
+	vrq->last_used = 0;
+	vrq->used_wrap = 1;
+	vrq->num_added = 0;
+	vrq->free_head = 0;
+	for (i = 0; i < nr_descs; i++) {
+		vrq->info[i].cookie = NULL;
+		vrq->info[i].desc_count = 0;
+		vrq->info[i].next = i + 1;
+	}
+	/* Interrupts are enabled initially (flags zeroed above) */
+	vrq->event_flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	/* Ring features are negotiated before the virtqueues are created */
+	vrq->event_idx = VIRTIO_FEATURE_HAS(vdev->features,
+					    VIRTIO_F_EVENT_IDX);
+
+	vq = &vrq->vq;
+	vq->queue_id = queue_id;
+	vq->vdev = vdev;
+	vq->vq_callback = callback;
+	vq->vq_notify_host = notify;
+	vq->packed = 1;
+	return vq;
+
+err_freevq:
+	uk_free(a, vrq);
+err_exit:
+	return ERR2PTR(rc);
+}
+
+void virtqueue_packed_destroy(struct virtqueue *vq, struct uk_alloc *a)
+{
+	struct virtqueue_packed *vrq;
+
+	UK_ASSERT(vq);
+
+	vrq = to_virtqueue_packed(vq);
+
+	/* Free the ring */
+	uk_free(a, vrq->vring_mem);
+
+	/* Free the virtqueue metadata */
+	uk_free(a, vrq);
+}